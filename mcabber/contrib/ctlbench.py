@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+# Time N commands sent to a running mcabber through the FIFO and through
+# the control socket.
+#
+# mcabber must have both 'fifo_name' and 'control_socket' set (with the
+# fifo module loaded if mcabber was built with modules):
+# $ ./ctlbench.py -n 1000 ~/.mcabber/mcabber.fifo ~/.mcabber/mcabber.sock
+#
+# The FIFO gives no feedback, so the last line written to it sets the
+# 'ctlbench_marker' option, and the socket is polled until the option has
+# the expected value.  The socket is used in quiet mode ("%quiet on").
+# In the pipelined test, up to -w commands are sent before their replies
+# are read.
+# Note that the commands are really executed (default: /echo).
+
+import argparse
+import os
+import socket
+import sys
+import time
+
+
+class Control:
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.buf = b""
+
+    def send(self, lines):
+        data = "".join(l + "\n" for l in lines)
+        self.sock.sendall(data.encode("utf-8"))
+
+    def readline(self):
+        while b"\n" not in self.buf:
+            data = self.sock.recv(65536)
+            if not data:
+                sys.exit("Connection closed by mcabber")
+            self.buf += data
+        line, self.buf = self.buf.split(b"\n", 1)
+        return line.decode("utf-8", "replace")
+
+    def reply(self):
+        # "ok N" or "error N", followed by N lines
+        status, n = self.readline().split()
+        return status, [self.readline() for i in range(int(n))]
+
+    def command(self, line):
+        self.send([line])
+        return self.reply()
+
+
+def bench_fifo(fifo, ctl, cmds):
+    token = "%d.%d" % (os.getpid(), time.monotonic_ns())
+    start = time.monotonic()
+    fd = os.open(fifo, os.O_WRONLY)
+    data = "".join(c + "\n" for c in cmds)
+    data += "/set ctlbench_marker = %s\n" % token
+    os.write(fd, data.encode("utf-8"))
+    os.close(fd)
+    while True:
+        status, out = ctl.command("/set ctlbench_marker")
+        if any(token in l for l in out):
+            break
+    return time.monotonic() - start
+
+
+def bench_roundtrip(ctl, cmds):
+    start = time.monotonic()
+    for c in cmds:
+        ctl.command(c)
+    return time.monotonic() - start
+
+
+def bench_pipelined(ctl, cmds, window):
+    # At most 'window' commands are in flight: mcabber stops reading a
+    # client whose unread replies exceed 1 MB, so sending everything
+    # before reading would deadlock with a large -n.
+    start = time.monotonic()
+    sent = 0
+    for received in range(len(cmds)):
+        n = min(window - (sent - received), len(cmds) - sent)
+        if n > 0:
+            ctl.send(cmds[sent:sent + n])
+            sent += n
+        ctl.reply()
+    return time.monotonic() - start
+
+
+def main():
+    p = argparse.ArgumentParser(description="Time mcabber FIFO vs socket")
+    p.add_argument("-n", type=int, default=1000, help="number of commands")
+    p.add_argument("-c", default="/echo ctlbench", help="command to send")
+    p.add_argument("-w", type=int, default=64,
+                   help="pipelined commands in flight (default: 64)")
+    p.add_argument("fifo", help="mcabber FIFO ('fifo_name')")
+    p.add_argument("socket", help="mcabber socket ('control_socket')")
+    args = p.parse_args()
+    if args.n < 1 or args.w < 1:
+        p.error("-n and -w must be positive")
+
+    ctl = Control(args.socket)
+    if ctl.command("%quiet on")[0] != "ok":
+        sys.exit("Cannot enable the quiet mode")
+    cmds = [args.c] * args.n
+
+    for name, t in (("FIFO", bench_fifo(args.fifo, ctl, cmds)),
+                    ("socket (round trips)", bench_roundtrip(ctl, cmds)),
+                    ("socket (pipelined)",
+                     bench_pipelined(ctl, cmds, args.w))):
+        print("%-21s %6d commands in %8.3fs  (%9.1f commands/s)"
+              % (name + ":", args.n, t, args.n / t))
+
+
+if __name__ == "__main__":
+    main()
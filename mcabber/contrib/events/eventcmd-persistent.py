@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+#
+# Compatibility helper for the 'eventcmd_persistent' mcabber option.
+#
+# When 'eventcmd_persistent' is set, mcabber starts the events_command once
+# and writes the events to its standard input (see mcabberrc.example).
+# This script reads these events and runs a regular events script (such as
+# contrib/events/eventcmd) for each of them, with the usual arguments.
+# If the event has a message body, it is written to a file which is given
+# as the last argument, as mcabber does when 'event_log_files' is set.
+#
+# To use it, set the "events_command" option to the path of this script,
+# and EVENTCMD below (or the MCABBER_EVENTCMD environment variable) to the
+# path of your events script.
+#
+# This script is provided under the terms of the GNU General Public License,
+# see the file COPYING in the root mcabber source directory.
+#
+
+import os
+import subprocess
+import sys
+import tempfile
+
+EVENTCMD = os.environ.get("MCABBER_EVENTCMD",
+                          os.path.expanduser("~/.mcabber/eventcmd"))
+TMPDIR = os.environ.get("MCABBERTMPDIR") or tempfile.gettempdir()
+
+def unescape(field):
+	out = []
+	chars = iter(field)
+	for c in chars:
+		if c == '\\':
+			c = next(chars, '')
+			c = {'n': '\n', 't': '\t'}.get(c, c)
+		out.append(c)
+	return ''.join(out)
+
+children = []
+
+for line in sys.stdin.buffer:
+	line = line.decode(sys.getfilesystemencoding(), 'surrogateescape')
+	fields = line.rstrip('\n').split('\t')
+	if len(fields) != 4:
+		continue
+	event, info, jid, data = [unescape(f) for f in fields]
+
+	args = [EVENTCMD, event, info, jid]
+	if data:
+		fd, filename = tempfile.mkstemp(prefix="mcabber-%d." % os.getppid(),
+		                                dir=TMPDIR)
+		with os.fdopen(fd, 'wb') as f:
+			f.write((data + '\n').encode(sys.getfilesystemencoding(),
+			                             'surrogateescape'))
+		args.append(filename)
+
+	try:
+		children.append(subprocess.Popen(args, stdin=subprocess.DEVNULL,
+		                                 stdout=subprocess.DEVNULL,
+		                                 stderr=subprocess.DEVNULL))
+	except OSError:
+		pass
+
+	# Reap the finished scripts
+	children = [p for p in children if p.poll() is None]
@@ -4,8 +4,10 @@
 #include <glib.h>
 #include <mcabber/config.h> // For MCABBER_BRANCH
 
-#define MCABBER_API_VERSION 41
-#define MCABBER_API_MIN     41
+// Modules built with API versions MCABBER_API_MIN to MCABBER_API_VERSION
+// can be loaded.
+#define MCABBER_API_VERSION 42
+#define MCABBER_API_MIN     42
 
 #define MCABBER_BRANCH_DEV  1
 
@@ -0,0 +1,40 @@
+/*
+ * benchstubs.c -- Symbols of main.c needed by the benchmark programs
+ *
+ * Copyright (C) 2026 The mcabber authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include <config.h>
+#include "main.h"
+
+GMainContext *main_context;
+
+void mcabber_set_terminate_ui(void)
+{
+}
+
+void mcabber_block_signals(void)
+{
+}
+
+char *mcabber_version(void)
+{
+  return g_strdup(PACKAGE_VERSION);
+}
+
+/* vim: set expandtab cindent cinoptions=>2\:2(0 sw=2 ts=2:  For Vim users... */
@@ -0,0 +1,162 @@
+/*
+ * chatbench.c  -- Chat window rendering benchmark
+ *
+ * Copyright (C) 2026 The mcabber authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This program appends messages to a chat window and renders the frames
+ * to a temporary file instead of a terminal.  It reports the number of
+ * bytes sent to the terminal and the number of buffer lines drawn (each
+ * line is a wmove(), one to four wprintw() and a wclrtoeol()) per
+ * appended line, with incremental updates and with a full repaint of the
+ * window for each update (i.e. the behaviour before incremental updates
+ * were introduced).  It is not installed.
+ *
+ * Usage: chatbench [-n messages] [-b messages per frame]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "roster.h"
+#include "screen.h"
+#include "screen_internal.h"
+#include "settings.h"
+
+#define BENCH_LINES   "50"
+#define BENCH_COLUMNS "120"
+
+//  bench_run(out, jid, nmsg, batch, full)
+// Append nmsg messages to the jid chat window, and render a frame every
+// batch messages.  If full is TRUE, the window is fully repainted for
+// each update.  One message in eight is an outgoing message.
+static void bench_run(FILE *out, const char *jid, guint nmsg, guint batch,
+                      gboolean full)
+{
+  guint i, full0, incr0, lines0, nfull, nincr, nlines, frames = 0;
+  off_t bytes;
+  gint64 start;
+  double t;
+  char text[64];
+
+  scr_roster_jump_jid((char*)jid);
+  scr_frame_force();
+  scr_frame_render();
+  fflush(stdout);
+
+  scr_chatwin_stats(&full0, &incr0, &lines0);
+  bytes = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+  start = g_get_monotonic_time();
+
+  for (i = 0; i < nmsg; i++) {
+    g_snprintf(text, sizeof text, "Line %u of the chat rendering benchmark",
+               i);
+    if (full)
+      scr_chatwin_invalidate();
+    if (i % 8 == 7)
+      scr_write_outgoing_message(jid, text, 0, NULL);
+    else
+      scr_write_incoming_message(jid, text, 0, HBB_PREFIX_IN, 0);
+    if ((i+1) % batch == 0 || i+1 == nmsg) {
+      if (full)
+        scr_chatwin_invalidate();
+      scr_frame_force();
+      scr_frame_render();
+      frames++;
+    }
+  }
+  fflush(stdout);
+
+  t = (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC;
+  bytes = lseek(STDOUT_FILENO, 0, SEEK_CUR) - bytes;
+  scr_chatwin_stats(&nfull, &nincr, &nlines);
+  nfull -= full0;
+  nincr -= incr0;
+  nlines -= lines0;
+
+  fprintf(out, "%s: %u lines, %u frames, %u full repaints, "
+          "%u incremental updates in %.3fs\n",
+          full ? "Full repaints" : "Incremental  ", nmsg, frames,
+          nfull, nincr, t);
+  fprintf(out, "  %.1f bytes/line, %.2f lines drawn/line, %.1f us/line\n",
+          (double)bytes / nmsg, (double)nlines / nmsg, t * 1e6 / nmsg);
+}
+
+int main(int argc, char **argv)
+{
+  guint nmsg = 20000, batch = 1;
+  FILE *out, *term;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:b:")) != -1) {
+    switch (c) {
+    case 'n':
+      nmsg = strtoul(optarg, NULL, 10);
+      break;
+    case 'b':
+      batch = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n messages] [-b messages per frame]\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (!nmsg || !batch) {
+    fprintf(stderr, "Usage: %s [-n messages] [-b messages per frame]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // initscr() renders to stdout, so stdout is redirected to a temporary
+  // file, and the report is written to the original stdout.
+  fflush(stdout);
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  term = tmpfile();
+  if (!out || !term || dup2(fileno(term), STDOUT_FILENO) == -1) {
+    fprintf(stderr, "Cannot redirect the standard output\n");
+    return EXIT_FAILURE;
+  }
+  setenv("LINES", BENCH_LINES, 1);
+  setenv("COLUMNS", BENCH_COLUMNS, 1);
+  if (!getenv("TERM"))
+    setenv("TERM", "xterm", 1);
+
+  roster_init();
+  settings_init();
+  scr_init_settings();
+  scr_init_locale_charset();
+  scr_init_curses();
+  scr_draw_main_window(TRUE);
+  scr_roster_display("*");
+  scr_set_chatmode(TRUE);
+
+  fprintf(out, "Terminal: %s, %sx%s\n", getenv("TERM"), BENCH_COLUMNS,
+          BENCH_LINES);
+  bench_run(out, "incremental@example.org", nmsg, batch, FALSE);
+  bench_run(out, "full@example.org", nmsg, batch, TRUE);
+
+  scr_terminate_curses();
+  fclose(out);
+  fclose(term);
+  return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab cindent cinoptions=>2\:2(0 sw=2 ts=2:  For Vim users... */
@@ -30,6 +30,7 @@
 #include "help.h"
 #include "roster.h"
 #include "screen.h"
+#include "screen_internal.h"
 #include "compl.h"
 #include "hooks.h"
 #include "hbuf.h"
@@ -95,43 +96,83 @@ static void do_carbons(char *arg);
 
 static void room_bookmark(gpointer bud, char *arg);
 
-// Global variable for the commands list
-static GSList *Commands;
+// Global variable for the commands table
+// The keys are the lowercased command names, the values are lists of
+// commands with this name (the most recently added first, this is the one
+// that is used).
+static GHashTable *Commands;
 static GSList *safe_commands;
 
+//  cmd_fold(name, len, buf)
+// Copy the lowercased len first bytes of name to buf, which must be
+// sizeof(((cmd*)0)->name) bytes long.
+// Returns FALSE if the name is too long to be a command name.
+static gboolean cmd_fold(const char *name, gsize len, char *buf)
+{
+  gsize i;
+
+  if (len >= sizeof(((cmd*)0)->name))
+    return FALSE;
+  for (i = 0; i < len; i++)
+    buf[i] = g_ascii_tolower(name[i]);
+  buf[len] = '\0';
+  return TRUE;
+}
+
 #ifdef MODULES_ENABLE
 #include "modules.h"
 
 gpointer cmd_del(gpointer id)
 {
-  GSList *sl_cmd;
-  if (!id) return NULL;
-  for (sl_cmd = Commands; sl_cmd; sl_cmd = sl_cmd->next)
-    if (sl_cmd -> data == id) {
-      cmd *command = (cmd *) sl_cmd->data;
-      gpointer userdata = command->userdata;
-      Commands = g_slist_delete_link(Commands, sl_cmd);
-      compl_del_category_word(COMPL_CMD, command->name);
-      g_free(command);
-      return userdata;
-    }
-  return NULL;
+  cmd *command = id;
+  char key[sizeof(command->name)];
+  GSList *cmdlist, *newlist;
+  gpointer userdata;
+
+  if (!id || !Commands)
+    return NULL;
+
+  cmd_fold(command->name, strlen(command->name), key);
+  cmdlist = g_hash_table_lookup(Commands, key);
+  if (!g_slist_find(cmdlist, command))
+    return NULL;
+
+  newlist = g_slist_remove(cmdlist, command);
+  if (!newlist) {
+    g_hash_table_remove(Commands, key);
+    compl_del_category_word(COMPL_CMD, command->name);
+  } else if (newlist != cmdlist) {
+    g_hash_table_replace(Commands, g_strdup(key), newlist);
+  }
+
+  userdata = command->userdata;
+  g_free(command);
+  return userdata;
 }
 #endif
 
 //  cmd_add()
-// Adds a command to the commands list and to the CMD completion list
+// Adds a command to the commands table and to the CMD completion list
 gpointer cmd_add(const char *name, const char *help, guint flags_row1,
                  guint flags_row2, void (*f)(char*), gpointer userdata)
 {
   cmd *n_cmd = g_new0(cmd, 1);
+  char key[sizeof(n_cmd->name)];
+  GSList *cmdlist;
+
   strncpy(n_cmd->name, name, 32-1);
   n_cmd->help = help;
   n_cmd->completion_flags[0] = flags_row1;
   n_cmd->completion_flags[1] = flags_row2;
   n_cmd->func = f;
   n_cmd->userdata = userdata;
-  Commands = g_slist_prepend(Commands, n_cmd);
+
+  if (!Commands)
+    Commands = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, NULL);
+  cmd_fold(n_cmd->name, strlen(n_cmd->name), key);
+  cmdlist = g_hash_table_lookup(Commands, key);
+  g_hash_table_replace(Commands, g_strdup(key),
+                       g_slist_prepend(cmdlist, n_cmd));
   // Add to completion CMD category
   compl_add_category_word(COMPL_CMD, name);
   return n_cmd;
@@ -405,7 +446,7 @@ void cmd_init(void)
 char *expandalias(const char *line)
 {
   const char *p1, *p2;
-  char *word;
+  char buf[64], *word = buf;
   const gchar *value;
   char *newline = (char*)line;
 
@@ -416,9 +457,16 @@ char *expandalias(const char *line)
   for (p2 = p1 ; *p2 && (*p2 != ' ') ; p2++)
     ;
   // Extract the word and look for an alias in the list
-  word = g_strndup(p1, p2-p1);
+  // (the word is copied to the stack unless it is very long)
+  if (p2-p1 < (gssize)sizeof(buf)) {
+    memcpy(buf, p1, p2-p1);
+    buf[p2-p1] = '\0';
+  } else {
+    word = g_strndup(p1, p2-p1);
+  }
   value = settings_get(SETTINGS_TYPE_ALIAS, (const char*)word);
-  g_free(word);
+  if (word != buf)
+    g_free(word);
 
   if (value)
     newline = g_strdup_printf("%c%s%s", COMMAND_CHAR, value, p2);
@@ -432,8 +480,11 @@ char *expandalias(const char *line)
 cmd *cmd_get(const char *command)
 {
   const char *p1, *p2;
-  char *com;
-  GSList *sl_com;
+  char com[sizeof(((cmd*)0)->name)];
+  GSList *cmdlist;
+
+  if (!Commands)
+    return NULL;
 
   // Ignore leading COMMAND_CHAR
   for (p1 = command ; *p1 == COMMAND_CHAR ; p1++)
@@ -441,18 +492,14 @@ cmd *cmd_get(const char *command)
   // Locate the end of the command
   for (p2 = p1 ; *p2 && (*p2 != ' ') ; p2++)
     ;
-  // Copy the clean command
-  com = g_strndup(p1, p2-p1);
-
-  // Look for command in the list
-  for (sl_com=Commands; sl_com; sl_com = g_slist_next(sl_com)) {
-    if (!strcasecmp(com, ((cmd*)sl_com->data)->name))
-      break;
-  }
-  g_free(com);
+  // Copy the clean, lowercased command
+  if (!cmd_fold(p1, p2-p1, com))
+    return NULL;
 
-  if (sl_com)       // Command has been found.
-    return (cmd*)sl_com->data;
+  // Look for command in the table
+  cmdlist = g_hash_table_lookup(Commands, com);
+  if (cmdlist)      // Command has been found.
+    return (cmd*)cmdlist->data;
   return NULL;
 }
 
@@ -460,14 +507,16 @@ cmd *cmd_get(const char *command)
 // Process a command line.
 // If iscmd is TRUE, process the command even if verbatim mmode is set;
 // it is intended to be used for key bindings.
-void process_command(const char *line, guint iscmd)
+// Return FALSE if the command couldn't be executed (unknown or not
+// implemented command).
+gboolean process_command(const char *line, guint iscmd)
 {
   char *p;
   char *xpline;
   cmd *curcmd;
 
   if (!line)
-    return;
+    return FALSE;
 
   // We do alias expansion here
   if (iscmd || scr_get_multimode() != 2)
@@ -491,7 +540,7 @@ void process_command(const char *line, guint iscmd)
     // It isn't an /msay command
     scr_append_multiline(xpline);
     g_free(xpline);
-    return;
+    return TRUE;
   }
 
   // Commands handling
@@ -501,13 +550,13 @@ void process_command(const char *line, guint iscmd)
     scr_LogPrint(LPRINT_NORMAL, "Unrecognized command.  "
                  "Please see the manual for a list of known commands.");
     g_free(xpline);
-    return;
+    return FALSE;
   }
   if (!curcmd->func) {
     scr_LogPrint(LPRINT_NORMAL,
                  "This functionality is not yet implemented, sorry.");
     g_free(xpline);
-    return;
+    return FALSE;
   }
   // Lets go to the command parameters
   for (p = xpline+1; *p && (*p != ' ') ; p++)
@@ -525,6 +574,7 @@ void process_command(const char *line, guint iscmd)
   (*curcmd->func)(p);
 #endif
   g_free(xpline);
+  return TRUE;
 }
 
 //  process_line(line)
@@ -1313,8 +1363,8 @@ static int send_message_to(const char *fjid, const char *msg, const char *subj,
     goto send_message_to_return;
   }
 
-  // Hook
-  if (!isroom)
+  // Hook (for a message being encrypted, it will be run when it is sent)
+  if (!isroom && crypted != ENCRYPTED_PENDING)
     hk_message_out(bare_jid, muc_nick, 0, hmsg, crypted, FALSE, xep184);
 
 send_message_to_return:
@@ -1544,7 +1594,7 @@ char *load_message_from_file(const char *filename)
     scr_LogPrint(LPRINT_LOGNORM, "Cannot open message file (%s)", filename);
     return NULL;
   }
-  if (!buf.st_size || buf.st_size >= HBB_BLOCKSIZE) {
+  if (!buf.st_size || buf.st_size >= HBB_MAX_MSGSIZE) {
     if (!buf.st_size)
       scr_LogPrint(LPRINT_LOGNORM, "Message file is empty (%s)", filename);
     else
@@ -1553,8 +1603,9 @@ char *load_message_from_file(const char *filename)
     return NULL;
   }
 
-  msgbuf = g_new0(char, HBB_BLOCKSIZE);
-  len = fread(msgbuf, 1, HBB_BLOCKSIZE-1, fd);
+  // The file may grow while we read it; we only take what fstat reported.
+  msgbuf = g_new0(char, buf.st_size + 1);
+  len = fread(msgbuf, 1, buf.st_size, fd);
   fclose(fd);
 
   // Check there is no binary data.  It must be a *message* file!
@@ -1910,6 +1961,7 @@ static void do_info(char *arg)
   if (bjid) {
     GSList *resources, *p_res;
     char *bstr = "unknown";
+    guint dups;
 
     // Enter chat mode
     scr_set_chatmode(TRUE);
@@ -1942,6 +1994,12 @@ static void do_info(char *arg)
       strcat(buffer, " (pending)");
     scr_WriteIncomingMessage(bjid, buffer, 0, HBB_PREFIX_INFO, 0);
 
+    dups = xmpp_msg_dedup_count(bjid);
+    if (dups) {
+      snprintf(buffer, 127, "Duplicate messages dropped: %u", dups);
+      scr_WriteIncomingMessage(bjid, buffer, 0, HBB_PREFIX_INFO, 0);
+    }
+
     resources = buddy_getresources(bud);
     if (!resources && type == ROSTER_TYPE_USER) {
       // No resource; display last status message, if any.
@@ -3770,6 +3828,15 @@ static void do_pgp(char *arg)
                                      "Encryption enforced (no negotiation)",
                                      0, HBB_PREFIX_INFO, 0);
           }
+#ifdef HAVE_GPGME
+          if (gpg_enabled()) {
+            guint hits, misses;
+            gpg_verify_cache_stats(&hits, &misses);
+            g_string_printf(sbuf, "Signature verification cache: "
+                            "%u hits, %u misses", hits, misses);
+            scr_WriteIncomingMessage(fjid, sbuf->str, 0, HBB_PREFIX_INFO, 0);
+          }
+#endif
           g_string_free(sbuf, TRUE);
           break;
       default:
@@ -4099,6 +4166,23 @@ static void do_iline(char *arg)
 
 static void do_screen_refresh(char *arg)
 {
+  guint rendered, coalesced;
+  guint full, incremental, lines;
+
+  if (!strcasecmp(arg, "stats")) {
+    scr_frame_stats(&rendered, &coalesced);
+    scr_LogPrint(LPRINT_NORMAL, "Screen: %u frames rendered, %u updates "
+                 "coalesced.", rendered, coalesced);
+    scr_chatwin_stats(&full, &incremental, &lines);
+    scr_LogPrint(LPRINT_NORMAL, "Chat windows: %u full repaints, %u "
+                 "incremental updates, %u lines drawn.",
+                 full, incremental, lines);
+    return;
+  }
+  if (*arg) {
+    scr_LogPrint(LPRINT_NORMAL, "Unrecognized parameter!");
+    return;
+  }
   readline_refresh_screen();
 }
 
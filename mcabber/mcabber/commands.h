@@ -17,7 +17,7 @@ typedef struct {
 void cmd_init(void);
 cmd *cmd_get(const char *command);
 void process_line(const char *line);
-void process_command(const char *line, guint iscmd);
+gboolean process_command(const char *line, guint iscmd);
 char *expandalias(const char *line);
 #ifdef MODULES_ENABLE
 gpointer cmd_del(gpointer id);
@@ -38,27 +38,38 @@
 #include "logprint.h"
 
 // Completion structure
+// The possible completions are stored one after the other in a single
+// buffer (NUL-separated), and their offsets in the offsets array.
 typedef struct {
-  GList *list;          // list of matches
+  GString *buffer;      // matches
+  GArray *offsets;      // offsets of the matches in buffer
   guint len_prefix;     // length of text already typed by the user
   guint len_compl;      // length of the last completion
-  GList *next;          // pointer to next completion to try
+  gint next;            // index of the next completion to try, or -1
 } compl_t;
 
 typedef GSList *(*compl_handler_t) (void); // XXX userdata? *dynlist?
 
 // Category structure
+// The words of the sorted categories (and the cached lists of the dynamic
+// ones) are kept in an array sorted with g_ascii_strcasecmp(), so that the
+// words starting with a given prefix can be found with a binary search.
 typedef struct {
   guint flags;
-  GSList *words;
+  GSList *words;          // Words of a static category, in completion order
+  GPtrArray *index;       // Sorted words (the words of a sorted static
+                          // category, or the cached list of a dynamic one)
+  gpointer owner;         // Buddy of the cached list (COMPL_CAT_BUDDY)
   compl_handler_t dynamic;
 } category_t;
 
 #define COMPL_CAT_BUILTIN   0x01
 #define COMPL_CAT_ACTIVE    0x02
 #define COMPL_CAT_DYNAMIC   0x04
+#define COMPL_CAT_CACHED    0x08  // Dynamic list cached (compl_invalidate())
 #define COMPL_CAT_REVERSE   0x10
 #define COMPL_CAT_NOSORT    0x20
+#define COMPL_CAT_BUDDY     0x40  // Dynamic list depends on current buddy
 
 #define COMPL_CAT_USERFLAGS 0x30
 
@@ -95,6 +106,7 @@ static GSList *compl_dyn_events (void)
 static inline void register_builtin_cat(guint c, compl_handler_t dynamic) {
   Categories[c-1].flags   = COMPL_CAT_BUILTIN | COMPL_CAT_ACTIVE;
   Categories[c-1].words   = NULL;
+  Categories[c-1].index   = NULL;
   Categories[c-1].dynamic = dynamic;
   if (dynamic != NULL) {
     Categories[c-1].flags |= COMPL_CAT_DYNAMIC;
@@ -133,6 +145,27 @@ void compl_init_system(void)
   register_builtin_cat(COMPL_OTRPOLICY, NULL);
   register_builtin_cat(COMPL_MODULE, NULL);
   register_builtin_cat(COMPL_CARBONS, NULL);
+
+  // The roster lists are cached (see compl_invalidate())
+  Categories[COMPL_JID-1].flags       |= COMPL_CAT_CACHED;
+  Categories[COMPL_GROUPNAME-1].flags |= COMPL_CAT_CACHED;
+  Categories[COMPL_RESOURCE-1].flags  |= COMPL_CAT_CACHED | COMPL_CAT_BUDDY;
+}
+
+//  compl_invalidate(categ)
+// Drop the cached list of a dynamic category, it will be rebuilt the next
+// time it is needed.  This should be called when the source list changes.
+void compl_invalidate(guint categ)
+{
+  category_t *cat;
+
+  if (!categ || categ > num_categories)
+    return;
+  cat = &Categories[categ-1];
+  if ((cat->flags & COMPL_CAT_CACHED) && cat->index) {
+    g_ptr_array_free(cat->index, TRUE);
+    cat->index = NULL;
+  }
 }
 
 #ifdef MODULES_ENABLE
@@ -160,6 +193,8 @@ guint compl_new_category(guint flags)
   }
   Categories[i].flags = COMPL_CAT_ACTIVE | (flags & COMPL_CAT_USERFLAGS);
   Categories[i].words = NULL;
+  Categories[i].index = NULL;
+  Categories[i].dynamic = NULL;
   return i+1;
 }
 
@@ -190,9 +225,123 @@ void compl_del_category(guint compl)
   for (wel = Categories[compl].words; wel; wel = g_slist_next (wel))
     g_free (wel -> data);
   g_slist_free (Categories[compl].words);
+  if (Categories[compl].index)
+    g_ptr_array_free(Categories[compl].index, TRUE);
+  Categories[compl].index = NULL;
 }
 #endif
 
+static gint compl_index_cmp(gconstpointer a, gconstpointer b)
+{
+  return g_ascii_strcasecmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+//  compl_lower_bound(index, word, len)
+// Return the position of the first word of the sorted index whose len
+// first characters are not lower than word (case-insensitive).
+// Use len = strlen(word)+1 to compare whole words.
+static guint compl_lower_bound(GPtrArray *index, const char *word, gsize len)
+{
+  guint lo = 0, hi = index->len;
+
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    if (g_ascii_strncasecmp(g_ptr_array_index(index, mid), word, len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+//  compl_upper_bound(index, word, len)
+// Return the position of the first word of the sorted index whose len
+// first characters are greater than word (case-insensitive).
+static guint compl_upper_bound(GPtrArray *index, const char *word, gsize len)
+{
+  guint lo = 0, hi = index->len;
+
+  while (lo < hi) {
+    guint mid = lo + (hi - lo) / 2;
+    if (g_ascii_strncasecmp(g_ptr_array_index(index, mid), word, len) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+//  compl_get_index(cat)
+// Return the sorted words of a category (NULL if the category is empty or
+// isn't sorted).  The cached list of a dynamic category is rebuilt if
+// needed.
+static GPtrArray *compl_get_index(category_t *cat)
+{
+  GSList *list, *slp;
+
+  if (!(cat->flags & COMPL_CAT_DYNAMIC))
+    return cat->index;
+  if (!(cat->flags & COMPL_CAT_CACHED))
+    return NULL;
+
+  if (cat->flags & COMPL_CAT_BUDDY) {
+    gpointer owner = current_buddy ? BUDDATA(current_buddy) : NULL;
+    if (cat->index && cat->owner != owner) {
+      g_ptr_array_free(cat->index, TRUE);
+      cat->index = NULL;
+    }
+    cat->owner = owner;
+  }
+
+  if (!cat->index) {
+    list = (*cat->dynamic) ();
+    cat->index = g_ptr_array_new_with_free_func(&g_free);
+    for (slp = list; slp; slp = g_slist_next(slp))
+      if (slp->data)
+        g_ptr_array_add(cat->index, slp->data);
+    g_slist_free(list);
+    g_ptr_array_sort(cat->index, &compl_index_cmp);
+  }
+  return cat->index;
+}
+
+//  compl_start()
+// Create the InputCompl structure.
+static compl_t *compl_start(void)
+{
+  compl_t *c;
+
+  if (InputCompl) { // This should not happen, but hey...
+    scr_log_print(LPRINT_DEBUG, "Warning: new_completion() - "
+                                "Previous completion exists!");
+    done_completion();
+  }
+
+  c = g_new0(compl_t, 1);
+  c->buffer = g_string_new(NULL);
+  c->offsets = g_array_new(FALSE, FALSE, sizeof(guint));
+  c->next = -1;
+  InputCompl = c;
+  return c;
+}
+
+//  compl_add_match(c, word, len, suffix)
+// Add the end of word (after the len characters typed by the user) to the
+// possible completions.
+static inline void compl_add_match(compl_t *c, const char *word, size_t len,
+                                   const gchar *suffix)
+{
+  guint offset = c->buffer->len;
+
+  if (!word[len])   // Nothing to complete
+    return;
+  g_string_append(c->buffer, word+len);
+  if (suffix)
+    g_string_append(c->buffer, suffix);
+  g_string_append_c(c->buffer, '\0');
+  g_array_append_val(c->offsets, offset);
+}
+
 //  new_completion(prefix, compl_cat, suffix)
 // . prefix    = beginning of the word, typed by the user
 // . compl_cat = pointer to a completion category list (list of *char)
@@ -203,56 +352,88 @@ void compl_del_category(guint compl)
 guint new_completion(const char *prefix, GSList *compl_cat, const gchar *suffix)
 {
   compl_t *c;
-  guint  ret_len = 0;
   GSList *sl_cat;
   gint (*cmp)(const char *s1, const char *s2, size_t n);
   size_t len = strlen(prefix);
 
-  if (InputCompl) { // This should not happen, but hey...
-    scr_log_print(LPRINT_DEBUG, "Warning: new_completion() - "
-                                "Previous completion exists!");
-    done_completion();
-  }
-
   if (settings_opt_get_int("completion_ignore_case"))
     cmp = &strncasecmp;
   else
     cmp = &strncmp;
 
-  c = g_new0(compl_t, 1);
+  c = compl_start();
   // Build the list of matches
   for (sl_cat = compl_cat; sl_cat; sl_cat = g_slist_next(sl_cat)) {
     char *word = sl_cat->data;
-    if (!cmp(prefix, word, len)) {
-      if (strlen(word) != len) {
-        gchar *compval;
-        if (suffix)
-          compval = g_strdup_printf("%s%s", word+len, suffix);
-        else
-          compval = g_strdup(word+len);
-        // for a bit of efficiency, will reverse order afterwards
-        c->list = g_list_prepend(c->list, compval);
-        ret_len ++;
-      }
+    if (!cmp(prefix, word, len))
+      compl_add_match(c, word, len, suffix);
+  }
+  return c->offsets->len;
+}
+
+//  new_category_completion(compl_cat, prefix, suffix)
+// Same as new_completion(), with the words of the completion category
+// compl_cat.  For sorted categories, only the words starting with prefix
+// are examined.
+guint new_category_completion(guint categ, const char *prefix,
+                              const gchar *suffix)
+{
+  category_t *cat;
+  GPtrArray *index;
+  compl_t *c;
+  size_t len = strlen(prefix);
+  guint lo, hi, i;
+  gboolean icase;
+
+  if (!categ || categ > num_categories ||
+      !(Categories[categ-1].flags & COMPL_CAT_ACTIVE)) {
+    scr_log_print(LPRINT_DEBUG, "Error: new_category_completion() - "
+                  "Invalid category.");
+    return 0;
+  }
+  cat = &Categories[categ-1];
+
+  if (cat->flags & COMPL_CAT_DYNAMIC) {
+    if (!(cat->flags & COMPL_CAT_CACHED)) {
+      GSList *list = (*cat->dynamic) (), *slp;
+      guint n = new_completion(prefix, list, suffix);
+      for (slp = list; slp; slp = g_slist_next(slp))
+        g_free(slp->data);
+      g_slist_free(list);
+      return n;
     }
+  } else if (cat->flags & COMPL_CAT_NOSORT) {
+    return new_completion(prefix, cat->words, suffix);
   }
-  c->list = g_list_reverse(c->list);
-  c->next = NULL;
-  InputCompl = c;
-  return ret_len;
+
+  c = compl_start();
+  index = compl_get_index(cat);
+  if (!index)
+    return 0;
+
+  icase = settings_opt_get_int("completion_ignore_case");
+  lo = compl_lower_bound(index, prefix, len);
+  hi = compl_upper_bound(index, prefix, len);
+  for (i = 0; i < hi - lo; i++) {
+    const char *word;
+    if (cat->flags & COMPL_CAT_REVERSE)
+      word = g_ptr_array_index(index, hi - 1 - i);
+    else
+      word = g_ptr_array_index(index, lo + i);
+    if (icase || !strncmp(prefix, word, len))
+      compl_add_match(c, word, len, suffix);
+  }
+  return c->offsets->len;
 }
 
 //  done_completion();
 void done_completion(void)
 {
-  GList *clp;
-
   if (!InputCompl)  return;
 
   // Free the current completion list
-  for (clp = InputCompl->list; clp; clp = g_list_next(clp))
-    g_free(clp->data);
-  g_list_free(InputCompl->list);
+  g_string_free(InputCompl->buffer, TRUE);
+  g_array_free(InputCompl->offsets, TRUE);
   g_free(InputCompl);
   InputCompl = NULL;
 }
@@ -273,25 +454,25 @@ const char *complete(gboolean fwd)
 
   if (!InputCompl)  return NULL;
 
-  if (!c->next) {
+  if (c->next < 0) {
     if (fwd)
-      c->next = c->list;  // back to the beginning
+      c->next = 0;  // back to the beginning
     else
-      c->next = g_list_last(c->list); // back to the ending
+      c->next = (gint)c->offsets->len - 1; // back to the ending
   } else {
     if (fwd)
-      c->next = g_list_next(c->next);
+      c->next++;
     else
-      c->next = g_list_previous(c->next);
+      c->next--;
   }
 
-  if (!c->next) {
-    c->next = NULL;
+  if (c->next < 0 || c->next >= (gint)c->offsets->len) {
+    c->next = -1;
     c->len_compl = 0;
     return NULL;
   }
 
-  r = (char*)c->next->data;
+  r = c->buffer->str + g_array_index(c->offsets, guint, c->next);
 
   if (!utf8_mode) {
     c->len_compl = strlen(r);
@@ -307,16 +488,6 @@ const char *complete(gboolean fwd)
 
 /* Categories functions */
 
-static gint compl_sort_forward(gconstpointer a, gconstpointer b)
-{
-  return g_ascii_strcasecmp((const gchar *)a, (const gchar *)b);
-}
-
-static gint compl_sort_reverse(gconstpointer a, gconstpointer b)
-{
-  return -g_ascii_strcasecmp((const gchar *)a, (const gchar *)b);
-}
-
 static gint compl_sort_append(gconstpointer a, gconstpointer b)
 {
   return 1;
@@ -358,20 +529,44 @@ void compl_add_category_word(guint categ, const gchar *word)
     nword = g_strdup(word);
   }
 
-  if (g_slist_find_custom(Categories[categ].words, nword,
-                          (GCompareFunc)g_strcmp0) == NULL) {
-    guint flags = Categories[categ].flags;
-    GCompareFunc comparator = compl_sort_forward;
-    if (flags & COMPL_CAT_NOSORT) {
-      if (flags & COMPL_CAT_REVERSE)
-        comparator = compl_sort_prepend;
-      else
-        comparator = compl_sort_append;
-    } else if (flags & COMPL_CAT_REVERSE)
-      comparator = compl_sort_reverse;
-
-    Categories[categ].words = g_slist_insert_sorted
+  if (Categories[categ].flags & COMPL_CAT_NOSORT) {
+    GCompareFunc comparator = compl_sort_append;
+    if (Categories[categ].flags & COMPL_CAT_REVERSE)
+      comparator = compl_sort_prepend;
+
+    if (g_slist_find_custom(Categories[categ].words, nword,
+                            (GCompareFunc)g_strcmp0) == NULL)
+      Categories[categ].words = g_slist_insert_sorted
                                   (Categories[categ].words, nword, comparator);
+    else
+      g_free(nword);
+  } else {
+    GPtrArray *index = Categories[categ].index;
+    guint i;
+
+    if (!index)
+      index = Categories[categ].index = g_ptr_array_new();
+
+    // Look for the word among the words that are equal, ignoring case,
+    // and insert it after them.
+    for (i = compl_lower_bound(index, nword, strlen(nword)+1);
+         i < index->len &&
+         !g_ascii_strcasecmp(g_ptr_array_index(index, i), nword); i++) {
+      if (!strcmp(g_ptr_array_index(index, i), nword)) {
+        g_free(nword);
+        return;
+      }
+    }
+    g_ptr_array_add(index, NULL);
+    memmove(&index->pdata[i+1], &index->pdata[i],
+            (index->len - 1 - i) * sizeof(gpointer));
+    index->pdata[i] = nword;
+
+    // The words list is in the same order (or in reverse order)
+    if (Categories[categ].flags & COMPL_CAT_REVERSE)
+      i = index->len - 1 - i;
+    Categories[categ].words = g_slist_insert(Categories[categ].words,
+                                             nword, i);
   }
 }
 
@@ -406,12 +601,25 @@ void compl_del_category_word(guint categ, const gchar *word)
   else
     nword = NULL;
 
-  for (wel = Categories[categ].words; wel; wel = g_slist_next (wel)) {
-    if (!strcasecmp((char*)wel->data, word)) {
-      g_free(wel->data);
-      Categories[categ].words = g_slist_delete_link
-                                (Categories[categ].words, wel);
-      break; // Only remove first occurence
+  if (Categories[categ].index) {
+    GPtrArray *index = Categories[categ].index;
+    guint i = compl_lower_bound(index, word, strlen(word)+1);
+
+    // Only remove first occurence
+    if (i < index->len &&
+        !g_ascii_strcasecmp(g_ptr_array_index(index, i), word)) {
+      gchar *w = g_ptr_array_remove_index(index, i);
+      Categories[categ].words = g_slist_remove(Categories[categ].words, w);
+      g_free(w);
+    }
+  } else {
+    for (wel = Categories[categ].words; wel; wel = g_slist_next (wel)) {
+      if (!strcasecmp((char*)wel->data, word)) {
+        g_free(wel->data);
+        Categories[categ].words = g_slist_delete_link
+                                  (Categories[categ].words, wel);
+        break; // Only remove first occurence
+      }
     }
   }
 
@@ -432,7 +640,7 @@ GSList *compl_get_category_list(guint categ, guint *dynlist)
 
   categ --;
 
-  if ((categ > num_categories) ||
+  if ((categ >= num_categories) ||
       !(Categories[categ].flags & COMPL_CAT_ACTIVE)) {
     scr_log_print(LPRINT_DEBUG, "Error: compl_get_category_list() - "
                   "Category does not exist.");
@@ -440,7 +648,16 @@ GSList *compl_get_category_list(guint categ, guint *dynlist)
   }
 
   if (Categories[categ].flags & COMPL_CAT_DYNAMIC) {
+    GPtrArray *index = compl_get_index(&Categories[categ]);
     *dynlist = TRUE;
+    if (index) {  // Copy the cached list
+      GSList *list = NULL;
+      guint i;
+      for (i = index->len; i > 0; i--)
+        list = g_slist_prepend(list,
+                               g_strdup(g_ptr_array_index(index, i-1)));
+      return list;
+    }
     return (*Categories[categ].dynamic) ();
   } else {
     *dynlist = FALSE;
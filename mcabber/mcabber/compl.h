@@ -46,9 +46,12 @@ void  compl_del_category(guint id);
 void    compl_add_category_word(guint categ, const gchar *command);
 void    compl_del_category_word(guint categ, const gchar *word);
 GSList *compl_get_category_list(guint categ, guint *dynlist);
+void    compl_invalidate(guint categ);
 
 guint   new_completion(const gchar *prefix, GSList *compl_cat,
                        const gchar *suffix);
+guint   new_category_completion(guint categ, const gchar *prefix,
+                                const gchar *suffix);
 void    done_completion(void);
 guint   cancel_completion(void);
 const char *complete(gboolean fwd);
@@ -1,5 +1,5 @@
 /*
- * fifo_internal.c      -- Read commands from a named pipe
+ * fifo_internal.c      -- Read commands from a named pipe or a socket
  *
  * Copyright (C) 2008,2009 Mikael Berthe <mikael@lilotux.net>
  * Copyright (C) 2009      Myhailo Danylenko <isbear@ukrpost.net>
@@ -19,9 +19,12 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <glib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -37,6 +40,30 @@ static char *fifo_name = NULL;
 static GIOChannel *fifo_channel = NULL;
 
 static const char *FIFO_ENV_NAME = "MCABBER_FIFO";
+static const char *CTL_ENV_NAME  = "MCABBER_CONTROL_SOCKET";
+
+// Control socket clients
+typedef struct {
+  GIOChannel *channel;
+  GSource    *in_source;
+  GSource    *out_source;
+  GString    *inbuf;
+  GString    *outbuf;
+  gsize       outpos;     // Bytes of outbuf already sent
+  gboolean    quiet;
+  gboolean    eof;        // The client won't send anything more
+} ctl_client_t;
+
+#define CTL_READ_SIZE     65536
+// Stop reading from a client when that many reply bytes are pending
+#define CTL_OUTBUF_MAX    (1024 * 1024)
+#define CTL_LINE_MAX      (64 * 1024)
+
+static char *ctl_name = NULL;
+static GIOChannel *ctl_channel = NULL;
+static GSource *ctl_source = NULL;
+static GSList *ctl_clients = NULL;
+static GString *ctl_output = NULL;
 
 static gboolean attach_fifo(const char *name);
 
@@ -138,7 +165,7 @@ static gboolean attach_fifo(const char *name)
   return TRUE;
 }
 
-void fifo_deinit(void)
+static void fifo_close(void)
 {
   unsetenv(FIFO_ENV_NAME);
 
@@ -161,7 +188,7 @@ void fifo_deinit(void)
 static int fifo_init_internal(const char *fifo_path)
 {
   if (fifo_path) {
-    fifo_deinit();
+    fifo_close();
     fifo_name = expand_filename(fifo_path);
 
     if (!check_fifo(fifo_name)) {
@@ -192,21 +219,359 @@ static gchar *fifo_guard(const gchar *key, const gchar *new_value)
   if (new_value)
     fifo_init_internal(new_value);
   else
-    fifo_deinit();
+    fifo_close();
+  return g_strdup(new_value);
+}
+
+/* Control socket */
+
+static GSource *ctl_add_watch(GIOChannel *channel, GIOCondition cond,
+                              GSourceFunc func, gpointer data)
+{
+  GSource *source = g_io_create_watch(channel, cond);
+  g_source_set_callback(source, func, data, NULL);
+  g_source_attach(source, main_context);
+  return source;
+}
+
+static void ctl_remove_watch(GSource **source)
+{
+  if (*source) {
+    g_source_destroy(*source);
+    g_source_unref(*source);
+    *source = NULL;
+  }
+}
+
+static void ctl_set_flags(int fd)
+{
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void ctl_client_free(ctl_client_t *client)
+{
+  ctl_clients = g_slist_remove(ctl_clients, client);
+  ctl_remove_watch(&client->in_source);
+  ctl_remove_watch(&client->out_source);
+  g_io_channel_unref(client->channel);
+  g_string_free(client->inbuf, TRUE);
+  g_string_free(client->outbuf, TRUE);
+  g_free(client);
+}
+
+static gboolean ctl_client_read(GIOChannel *channel, GIOCondition condition,
+                                gpointer data);
+static gboolean ctl_client_write(GIOChannel *channel, GIOCondition condition,
+                                 gpointer data);
+
+//  ctl_client_flush(client)
+// Send as much of the pending replies as possible, and watch the socket
+// for the rest.  Return FALSE if the client has been freed.
+static gboolean ctl_client_flush(ctl_client_t *client)
+{
+  int fd = g_io_channel_unix_get_fd(client->channel);
+
+  while (client->outpos < client->outbuf->len) {
+    ssize_t n = write(fd, client->outbuf->str + client->outpos,
+                      client->outbuf->len - client->outpos);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      ctl_client_free(client);
+      return FALSE;
+    }
+    client->outpos += n;
+  }
+
+  if (client->outpos == client->outbuf->len) {
+    g_string_truncate(client->outbuf, 0);
+    client->outpos = 0;
+    ctl_remove_watch(&client->out_source);
+    if (client->eof) {
+      ctl_client_free(client);
+      return FALSE;
+    }
+  } else if (!client->out_source) {
+    client->out_source = ctl_add_watch(client->channel, G_IO_OUT,
+                                       (GSourceFunc)ctl_client_write, client);
+  }
+
+  // Throttle the clients which do not read their replies
+  if (client->outbuf->len - client->outpos > CTL_OUTBUF_MAX)
+    ctl_remove_watch(&client->in_source);
+  else if (!client->in_source && !client->eof)
+    client->in_source = ctl_add_watch(client->channel,
+                                      G_IO_IN|G_IO_PRI|G_IO_ERR|G_IO_HUP,
+                                      (GSourceFunc)ctl_client_read, client);
+  return TRUE;
+}
+
+//  ctl_client_command(client, line)
+// Execute a command line and append the reply to the client output buffer.
+// The reply is a status line ("ok N" or "error N"), followed by the N lines
+// of output of the command.
+// Return FALSE if the client has been closed by the command.
+static gboolean ctl_client_command(ctl_client_t *client, const char *line)
+{
+  const char *p;
+  guint nlines = 0;
+  gboolean ok;
+
+  if (!ctl_output)
+    ctl_output = g_string_new(NULL);
+  g_string_truncate(ctl_output, 0);
+
+  if (*line == '%') {
+    // Control directive
+    if (!strcmp(line, "%quiet on") || !strcmp(line, "%quiet off")) {
+      client->quiet = (line[8] == 'n');
+      ok = TRUE;
+    } else {
+      g_string_append(ctl_output, "Unknown directive.\n");
+      ok = FALSE;
+    }
+  } else {
+    if (client->quiet || settings_opt_get_int("fifo_hide_commands"))
+      scr_LogPrint(LPRINT_LOG, "Executing control command: %s", line);
+    else
+      scr_LogPrint(LPRINT_LOGNORM, "Executing control command: %s", line);
+
+    scr_log_capture(ctl_output, client->quiet);
+    ok = process_command(line, TRUE);
+    scr_log_capture(NULL, FALSE);
+    // The command might have closed the socket (e.g. /set control_socket)
+    if (!g_slist_find(ctl_clients, client))
+      return FALSE;
+  }
+
+  for (p = ctl_output->str; *p; p++)
+    if (*p == '\n')
+      nlines++;
+  g_string_append_printf(client->outbuf, "%s %u\n", (ok ? "ok" : "error"),
+                         nlines);
+  g_string_append_len(client->outbuf, ctl_output->str, ctl_output->len);
+  return TRUE;
+}
+
+static gboolean ctl_client_read(GIOChannel *channel, GIOCondition condition,
+                                gpointer data)
+{
+  ctl_client_t *client = data;
+  int fd = g_io_channel_unix_get_fd(channel);
+  gsize oldlen = client->inbuf->len;
+  gchar *line, *eol;
+  ssize_t n;
+
+  // Read as much as we can: a client usually sends a batch of commands,
+  // we execute all of them and send the replies at once.
+  g_string_set_size(client->inbuf, oldlen + CTL_READ_SIZE);
+  do {
+    n = read(fd, client->inbuf->str + oldlen, CTL_READ_SIZE);
+  } while (n < 0 && errno == EINTR);
+  g_string_set_size(client->inbuf, oldlen + MAX(n, 0));
+
+  if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    ctl_client_free(client);
+    return FALSE;
+  }
+  if (n == 0) {
+    // The last command might not be terminated by a newline
+    if (client->inbuf->len)
+      g_string_append_c(client->inbuf, '\n');
+    client->eof = TRUE;
+  }
+
+  line = client->inbuf->str;
+  while ((eol = memchr(line, '\n',
+                       client->inbuf->len - (line - client->inbuf->str)))) {
+    *eol = '\0';
+    if (eol > line && eol[-1] == '\r')
+      eol[-1] = '\0';
+    if (*line && !ctl_client_command(client, line))
+      return FALSE;
+    line = eol + 1;
+  }
+  g_string_erase(client->inbuf, 0, line - client->inbuf->str);
+  if (client->inbuf->len > CTL_LINE_MAX) {
+    ctl_client_free(client);
+    return FALSE;
+  }
+
+  if (client->eof)
+    ctl_remove_watch(&client->in_source);
+  ctl_client_flush(client);
+  // The source might already be destroyed, returning TRUE is harmless
+  return TRUE;
+}
+
+static gboolean ctl_client_write(GIOChannel *channel, GIOCondition condition,
+                                 gpointer data)
+{
+  ctl_client_flush(data);
+  return TRUE;
+}
+
+static gboolean ctl_accept(GIOChannel *channel, GIOCondition condition,
+                           gpointer data)
+{
+  int fd;
+
+  while ((fd = accept(g_io_channel_unix_get_fd(channel), NULL, NULL)) >= 0) {
+    ctl_client_t *client = g_new0(ctl_client_t, 1);
+
+    ctl_set_flags(fd);
+    client->channel = g_io_channel_unix_new(fd);
+    g_io_channel_set_close_on_unref(client->channel, TRUE);
+    client->inbuf  = g_string_sized_new(CTL_READ_SIZE);
+    client->outbuf = g_string_new(NULL);
+    client->quiet  = settings_opt_get_int("control_socket_quiet");
+    client->in_source = ctl_add_watch(client->channel,
+                                      G_IO_IN|G_IO_PRI|G_IO_ERR|G_IO_HUP,
+                                      (GSourceFunc)ctl_client_read, client);
+    ctl_clients = g_slist_prepend(ctl_clients, client);
+  }
+  return TRUE;
+}
+
+//  ctl_check_socket(name)
+// Return TRUE if we can create a socket at this path: the file doesn't
+// exist, or it is a stale socket (nobody listens to it anymore).
+static gboolean ctl_check_socket(const char *name, struct sockaddr_un *addr)
+{
+  struct stat finfo;
+  int fd, ret;
+
+  if (stat(name, &finfo) == -1)
+    return (errno == ENOENT);
+  if (!S_ISSOCK(finfo.st_mode))
+    return FALSE;
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    return FALSE;
+  ret = connect(fd, (struct sockaddr*)addr, sizeof(*addr));
+  close(fd);
+  if (ret == 0)
+    return FALSE;   // Another process is using it
+  return (unlink(name) == 0);
+}
+
+static void ctl_close(void)
+{
+  unsetenv(CTL_ENV_NAME);
+
+  while (ctl_clients)
+    ctl_client_free(ctl_clients->data);
+  ctl_remove_watch(&ctl_source);
+  if (ctl_channel) {
+    g_io_channel_unref(ctl_channel);
+    ctl_channel = NULL;
+    unlink(ctl_name);
+  }
+  g_free(ctl_name);
+  ctl_name = NULL;
+}
+
+static int ctl_init_internal(const char *path)
+{
+  struct sockaddr_un addr;
+  mode_t oldmask;
+  int fd;
+
+  ctl_close();
+  ctl_name = expand_filename(path);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(ctl_name) >= sizeof(addr.sun_path)) {
+    scr_LogPrint(LPRINT_LOGNORM, "Error: Control socket path is too long");
+    goto ctl_init_error;
+  }
+  strcpy(addr.sun_path, ctl_name);
+
+  if (!ctl_check_socket(ctl_name, &addr)) {
+    scr_LogPrint(LPRINT_LOGNORM, "WARNING: Cannot create the control socket. "
+                 "%s already exists", ctl_name);
+    goto ctl_init_error;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    scr_LogPrint(LPRINT_LOGNORM, "Error: Cannot create the control socket");
+    goto ctl_init_error;
+  }
+  // Only the user can connect to the socket
+  oldmask = umask(S_IRWXG|S_IRWXO);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+      listen(fd, SOMAXCONN) == -1) {
+    int eerrno = errno;
+    umask(oldmask);
+    close(fd);
+    scr_LogPrint(LPRINT_LOGNORM, "Error: Cannot bind the control socket "
+                 "(%s)", strerror(eerrno));
+    goto ctl_init_error;
+  }
+  umask(oldmask);
+  ctl_set_flags(fd);
+
+  ctl_channel = g_io_channel_unix_new(fd);
+  g_io_channel_set_close_on_unref(ctl_channel, TRUE);
+  ctl_source = ctl_add_watch(ctl_channel, G_IO_IN, (GSourceFunc)ctl_accept,
+                             NULL);
+
+  setenv(CTL_ENV_NAME, ctl_name, 1);
+
+  scr_LogPrint(LPRINT_LOGNORM, "Control socket initialized (%s)", path);
+  return 1;
+
+ctl_init_error:
+  g_free(ctl_name);
+  ctl_name = NULL;
+  return -1;
+}
+
+static gchar *ctl_guard(const gchar *key, const gchar *new_value)
+{
+  if (new_value)
+    ctl_init_internal(new_value);
+  else
+    ctl_close();
   return g_strdup(new_value);
 }
 
+void fifo_deinit(void)
+{
+  fifo_close();
+  ctl_close();
+  if (ctl_output) {
+    g_string_free(ctl_output, TRUE);
+    ctl_output = NULL;
+  }
+}
+
 // Returns 1 in case of success, -1 on error
+// A control socket failure is not an error: it has already been logged by
+// ctl_init_internal(), and the FIFO keeps working without the socket.
 int fifo_init(void)
 {
   const char *path = settings_opt_get("fifo_name");
+  const char *ctlpath = settings_opt_get("control_socket");
   static gboolean guard_installed = FALSE;
-  if (!guard_installed)
-    if (!(guard_installed = settings_set_guard("fifo_name", fifo_guard)))
+  int ret = 1;
+
+  if (!guard_installed) {
+    if (!(guard_installed = settings_set_guard("fifo_name", fifo_guard) &&
+                            settings_set_guard("control_socket", ctl_guard)))
       scr_LogPrint(LPRINT_DEBUG, "fifo: BUG: Cannot install option guard!");
+  }
   if (path)
-    return fifo_init_internal(path);
-  return 1;
+    ret = fifo_init_internal(path);
+  if (ctlpath)
+    ctl_init_internal(ctlpath);
+  return ret;
 }
 
 /* vim: set expandtab cindent cinoptions=>2\:2(0 sw=2 ts=2:  For Vim users... */
@@ -104,8 +104,13 @@ static inline void do_wrap(GList **p_hbuf, GList *first_hbuf_elt,
       }
       hbuf_b_curr->ptr_end  = end;
       hbuf_b_curr->ptr_end_alloc = hbuf_b_prev->ptr_end_alloc;
-      // This is OK because insert_before(NULL) == append():
-      *p_hbuf = g_list_insert_before(*p_hbuf, curr_elt->next, hbuf_b_curr);
+      // Link the new block right after the current one.  We don't use
+      // g_list_insert_before(*p_hbuf, NULL, ...) at the end of the list,
+      // because it walks the whole buffer for every wrapped line.
+      if (curr_elt->next)
+        g_list_insert_before(curr_elt, curr_elt->next, hbuf_b_curr);
+      else
+        g_list_append(curr_elt, hbuf_b_curr);
     }
     curr_elt = g_list_next(curr_elt);
   }
@@ -117,6 +122,9 @@ static inline void do_wrap(GList **p_hbuf, GList *first_hbuf_elt,
 // maxhbufblocks is the maximum number of hbuf blocks we can allocate.  If
 // null, there is no limit.  If non-null, it should be >= 2.
 //
+// Messages that don't fit in a shared block are stored in a block of their
+// own, whatever their size.
+//
 // Note 1: Splitting according to width won't work if there are tabs; they
 //         should be expanded before.
 // Note 2: width does not include the ending \0.
@@ -602,4 +610,78 @@ guint hbuf_get_blocks_number(GList *hbuf)
   return count;
 }
 
+//  hbuf_ring_add_line(ring, p_hbuf, text, timestamp, prefix_flags, width)
+// Add a message to a ring buffer.  The message text is stored in a block
+// of its own (see hbuf_ring_trim()).  If width is not null, then lines are
+// wrapped at this length.
+void hbuf_ring_add_line(hbuf_ring_t *ring, GList **p_hbuf, const char *text,
+        time_t timestamp, guint prefix_flags, guint width)
+{
+  hbuf_block_t *hbuf_block_elt;
+  guint textlen;
+
+  if (!text) return;
+
+  textlen = strlen(text);
+
+  hbuf_block_elt = g_new0(hbuf_block_t, 1);
+  hbuf_block_elt->prefix.timestamp = timestamp;
+  hbuf_block_elt->prefix.flags     = prefix_flags;
+  hbuf_block_elt->flags   = HBB_FLAG_ALLOC | HBB_FLAG_PERSISTENT;
+  hbuf_block_elt->ptr     = g_strndup(text, textlen);
+  hbuf_block_elt->ptr_end = hbuf_block_elt->ptr + textlen + 1;
+  hbuf_block_elt->ptr_end_alloc = hbuf_block_elt->ptr_end;
+
+  // Same as hbuf_add_line(): *p_hbuf is kept near the end of the list
+  if (*p_hbuf)
+    *p_hbuf = g_list_last(*p_hbuf);
+  *p_hbuf = g_list_append(*p_hbuf, hbuf_block_elt);
+  if (!ring->head)
+    ring->head = g_list_first(*p_hbuf);
+  ring->messages++;
+
+  do_wrap(p_hbuf, g_list_last(*p_hbuf), width);
+}
+
+//  hbuf_ring_trim(ring, p_hbuf, maxmessages)
+// Evict the oldest messages of the ring buffer, so that there are no more
+// than maxmessages messages left.  Each eviction is done in constant time
+// (apart from the wrapped lines of the message).
+// Returns the number of evicted messages.
+guint hbuf_ring_trim(hbuf_ring_t *ring, GList **p_hbuf, guint maxmessages)
+{
+  guint evicted = 0U;
+  gboolean lost_hbuf = FALSE;
+
+  while (ring->head && ring->messages > maxmessages) {
+    GList *hbuf_elt = ring->head;
+    hbuf_block_t *hbuf_b_elt;
+
+    // Remove the message block and the lines following it, up to the
+    // next message
+    do {
+      GList *next_elt = g_list_next(hbuf_elt);
+      hbuf_b_elt = (hbuf_block_t*)(hbuf_elt->data);
+      if (hbuf_b_elt->flags & HBB_FLAG_ALLOC)
+        g_free(hbuf_b_elt->ptr);
+      g_free(hbuf_b_elt);
+      if (hbuf_elt == *p_hbuf)
+        lost_hbuf = TRUE;
+      g_list_delete_link(hbuf_elt, hbuf_elt);
+      hbuf_elt = next_elt;
+    } while (hbuf_elt &&
+             !(((hbuf_block_t*)hbuf_elt->data)->flags & HBB_FLAG_ALLOC));
+
+    ring->head = hbuf_elt;
+    ring->messages--;
+    evicted++;
+  }
+
+  if (!ring->head)
+    ring->messages = 0U;
+  if (lost_hbuf || !ring->head)
+    *p_hbuf = ring->head;
+  return evicted;
+}
+
 /* vim: set expandtab cindent cinoptions=>2\:2(0 sw=2 ts=2:  For Vim users... */
@@ -4,10 +4,14 @@
 #include <time.h>
 #include <glib.h>
 
-// With current implementation a message must fit in a hbuf block,
-// so we shouldn't choose a too small size.
+// Size of the shared hbuf blocks.  Messages bigger than a block get a
+// dedicated block of their own, so we shouldn't choose a too small size.
 #define HBB_BLOCKSIZE   8192    // > 20 please
 
+// Maximum size of a message composed in multi-line mode or loaded from
+// a file.
+#define HBB_MAX_MSGSIZE (64 * HBB_BLOCKSIZE)
+
 // Flags:
 // - ALLOC: the ptr data has been allocated, it can be freed
 // - PERSISTENT: this is a new history line
@@ -40,6 +44,14 @@ typedef struct {
   char *text;
 } hbb_line;
 
+// Ring of messages, for buffers with a bounded number of messages
+// (e.g. the status buffer).  Each message has its own data block, so that
+// the oldest one can be evicted without touching the rest of the buffer.
+typedef struct {
+  GList *head;      // First line of the buffer
+  guint  messages;  // Number of messages in the buffer
+} hbuf_ring_t;
+
 void hbuf_add_line(GList **p_hbuf, const char *text, time_t timestamp,
         guint prefix_flags, guint width, guint maxhbufblocks,
         unsigned mucnicklen, gpointer xep184);
@@ -60,6 +72,10 @@ void hbuf_dump_to_file(GList *hbuf, const char *filename);
 
 guint hbuf_get_blocks_number(GList *p_hbuf);
 
+void hbuf_ring_add_line(hbuf_ring_t *ring, GList **p_hbuf, const char *text,
+        time_t timestamp, guint prefix_flags, guint width);
+guint hbuf_ring_trim(hbuf_ring_t *ring, GList **p_hbuf, guint maxmessages);
+
 #endif /* __MCABBER_HBUF_H__ */
 
 /* vim: set expandtab cindent cinoptions=>2\:2(0 sw=2 ts=2:  For Vim users... */
@@ -0,0 +1,288 @@
+/*
+ * highlight.c  -- Nickname and keyword highlighting
+ *
+ * Copyright (C) 2026 The mcabber authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// All the patterns (our room nicknames and the keywords) are compiled into
+// a single Aho-Corasick automaton, so that a message is scanned only once,
+// whatever the number of patterns.  The matching is case-insensitive for
+// ASCII letters (like strcasestr()), and a match must be a whole word.
+
+#include <string.h>
+
+#include "highlight.h"
+#include "settings.h"
+#include "utf8.h"
+
+typedef struct {
+  guint     len;
+  gboolean  keyword;
+  gint      nick;       // Index of the nickname in hl_nicks, or -1
+} hl_pattern_t;
+
+static struct {
+  guint     nclasses;     // Number of byte classes (0: no pattern byte)
+  guint8    class[256];   // Byte -> class
+  guint     nstates;
+  guint    *delta;        // Transitions, nstates * nclasses
+  gint     *out;          // State -> pattern ending here, or -1
+  guint    *dict;         // State -> next state with an output, or 0
+  GArray   *patterns;     // hl_pattern_t
+} hl_ac;
+
+// All the nicknames we have used in rooms.  The automaton is only rebuilt
+// when a new nickname is seen (we usually use the same nickname in all the
+// rooms).
+static GPtrArray  *hl_nicks;      // Lowercase nicknames
+static GHashTable *hl_nick_index; // Lowercase nickname -> index+1
+static gboolean    hl_stalled = TRUE;
+
+static void hl_ac_free(void)
+{
+  g_free(hl_ac.delta);
+  g_free(hl_ac.out);
+  g_free(hl_ac.dict);
+  if (hl_ac.patterns)
+    g_array_free(hl_ac.patterns, TRUE);
+  memset(&hl_ac, 0, sizeof(hl_ac));
+}
+
+//  hl_ac_add(word, keyword, nick)
+// Add a pattern to the trie.  The automaton must be large enough.
+static void hl_ac_add(const gchar *word, gboolean keyword, gint nick)
+{
+  const guchar *p;
+  guint s = 0;
+  hl_pattern_t *pat;
+
+  for (p = (const guchar*)word; *p; p++) {
+    guint *t = &hl_ac.delta[s * hl_ac.nclasses + hl_ac.class[*p]];
+    if (!*t) {
+      *t = hl_ac.nstates++;
+      hl_ac.out[*t] = -1;
+    }
+    s = *t;
+  }
+
+  if (hl_ac.out[s] < 0) {
+    hl_pattern_t newpat = { p - (const guchar*)word, FALSE, -1 };
+    hl_ac.out[s] = hl_ac.patterns->len;
+    g_array_append_val(hl_ac.patterns, newpat);
+  }
+  // Duplicate patterns are merged (nicknames are unique, case-insensitive)
+  pat = &g_array_index(hl_ac.patterns, hl_pattern_t, hl_ac.out[s]);
+  pat->keyword |= keyword;
+  if (nick >= 0)
+    pat->nick = nick;
+}
+
+//  hl_ac_build(keywords)
+// Compile the nicknames and the keywords (NULL-terminated array).
+static void hl_ac_build(gchar **keywords)
+{
+  guint i, s, c, maxstates = 1;
+  guint *queue, qhead = 0, qtail = 0;
+  guint nc, nnicks = hl_nicks ? hl_nicks->len : 0;
+
+  hl_ac_free();
+
+  // Byte classes, upper and lower case ASCII letters share a class
+  for (i = 0; i < nnicks + g_strv_length(keywords); i++) {
+    const guchar *p;
+    const gchar *w = (i < nnicks ? g_ptr_array_index(hl_nicks, i) :
+                      keywords[i - nnicks]);
+    if (!w || !*w)
+      continue;
+    maxstates += strlen(w);
+    for (p = (const guchar*)w; *p; p++) {
+      guchar b = g_ascii_tolower(*p);
+      if (!hl_ac.class[b]) {
+        hl_ac.class[b] = ++hl_ac.nclasses;
+        hl_ac.class[(guchar)g_ascii_toupper(b)] = hl_ac.class[b];
+      }
+    }
+  }
+  if (maxstates == 1)
+    return;       // No pattern
+
+  nc = ++hl_ac.nclasses;
+  hl_ac.delta = g_new0(guint, maxstates * nc);
+  hl_ac.out   = g_new(gint, maxstates);
+  hl_ac.dict  = g_new0(guint, maxstates);
+  hl_ac.patterns = g_array_new(FALSE, FALSE, sizeof(hl_pattern_t));
+  hl_ac.nstates = 1;
+  hl_ac.out[0] = -1;
+
+  for (i = 0; i < nnicks; i++)
+    hl_ac_add(g_ptr_array_index(hl_nicks, i), FALSE, i);
+  for (i = 0; keywords[i]; i++)
+    if (*keywords[i])
+      hl_ac_add(keywords[i], TRUE, -1);
+
+  // Breadth-first traversal: compute the failure transitions and complete
+  // the transition table.  fail[] is only needed during the construction.
+  {
+    guint *fail = g_new0(guint, hl_ac.nstates);
+    queue = g_new(guint, hl_ac.nstates);
+
+    for (c = 0; c < nc; c++) {
+      guint t = hl_ac.delta[c];
+      if (t)
+        queue[qtail++] = t;
+    }
+    while (qhead < qtail) {
+      s = queue[qhead++];
+      for (c = 0; c < nc; c++) {
+        guint *t = &hl_ac.delta[s * nc + c];
+        guint f = hl_ac.delta[fail[s] * nc + c];
+        if (*t) {
+          fail[*t] = f;
+          hl_ac.dict[*t] = (hl_ac.out[f] >= 0 ? f : hl_ac.dict[f]);
+          queue[qtail++] = *t;
+        } else {
+          *t = f;
+        }
+      }
+    }
+    g_free(fail);
+    g_free(queue);
+  }
+}
+
+static inline gboolean hl_word_char(const char *p)
+{
+  unsigned c = get_char(p);
+  return iswalnum(c) || c == '_';
+}
+
+//  hl_update()
+// Rebuild the automaton if the keywords or the nicknames have changed.
+static void hl_update(void)
+{
+  gchar **keywords;
+  const gchar *kw;
+  guint i;
+
+  if (!hl_stalled)
+    return;
+  hl_stalled = FALSE;
+
+  kw = settings_opt_get("highlight_keywords");
+  keywords = g_strsplit(kw ? kw : "", ",", 0);
+  for (i = 0; keywords[i]; i++)
+    g_strstrip(keywords[i]);
+  hl_ac_build(keywords);
+  g_strfreev(keywords);
+}
+
+//  hl_find(text, nick, matches)
+// Look for the nickname nick (can be NULL) and the highlight keywords in
+// text.  If matches isn't NULL, the hl_match_t structures are appended to
+// this array.
+// Return a mask of the kinds of the matches (HL_MATCH_*).
+guint hl_find(const char *text, const char *nick, GArray *matches)
+{
+  guint found = 0;
+  guint s = 0;
+  gint nickidx = -1;
+  const guchar *p;
+
+  if (nick && *nick) {
+    gchar *lnick = g_ascii_strdown(nick, -1);
+
+    if (!hl_nicks) {
+      hl_nicks = g_ptr_array_new_with_free_func(&g_free);
+      hl_nick_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, NULL);
+    }
+    nickidx = GPOINTER_TO_INT(g_hash_table_lookup(hl_nick_index, lnick)) - 1;
+    if (nickidx < 0) {
+      // New nickname
+      nickidx = hl_nicks->len;
+      g_ptr_array_add(hl_nicks, lnick);
+      g_hash_table_insert(hl_nick_index, g_strdup(lnick),
+                          GINT_TO_POINTER(nickidx + 1));
+      hl_stalled = TRUE;
+    } else {
+      g_free(lnick);
+    }
+  }
+
+  hl_update();
+  if (!hl_ac.patterns || !text)
+    return 0;
+
+  for (p = (const guchar*)text; *p; p++) {
+    guint o;
+
+    s = hl_ac.delta[s * hl_ac.nclasses + hl_ac.class[*p]];
+    for (o = (hl_ac.out[s] >= 0 ? s : hl_ac.dict[s]); o; o = hl_ac.dict[o]) {
+      hl_pattern_t *pat = &g_array_index(hl_ac.patterns, hl_pattern_t,
+                                         hl_ac.out[o]);
+      const char *start = (const char*)p + 1 - pat->len;
+      guint kind;
+
+      if (nickidx >= 0 && pat->nick == nickidx)
+        kind = HL_MATCH_NICK;
+      else if (pat->keyword)
+        kind = HL_MATCH_KEYWORD;
+      else
+        continue;
+      // The match must not be in the middle of another word (i.e.
+      // preceded/followed immediately by an alphanumeric character or an
+      // underscore).
+      if (start > text && hl_word_char(prev_char((char*)start, text)))
+        continue;
+      if (hl_word_char((const char*)p + 1))
+        continue;
+
+      found |= kind;
+      if (matches) {
+        hl_match_t m = { start - text, pat->len, kind };
+        g_array_append_val(matches, m);
+      } else if (found == (HL_MATCH_NICK | HL_MATCH_KEYWORD)) {
+        return found;
+      }
+    }
+  }
+  return found;
+}
+
+static gchar *hl_guard(const gchar *key, const gchar *new_value)
+{
+  hl_stalled = TRUE;
+  return g_strdup(new_value);
+}
+
+void hl_init(void)
+{
+  settings_set_guard("highlight_keywords", hl_guard);
+}
+
+void hl_deinit(void)
+{
+  hl_ac_free();
+  if (hl_nicks) {
+    g_ptr_array_free(hl_nicks, TRUE);
+    g_hash_table_destroy(hl_nick_index);
+    hl_nicks = NULL;
+    hl_nick_index = NULL;
+  }
+  hl_stalled = TRUE;
+}
+
+/* vim: set expandtab cindent cinoptions=>2\:2(0 sw=2 ts=2:  For Vim users... */
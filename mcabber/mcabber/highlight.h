@@ -0,0 +1,22 @@
+#ifndef __MCABBER_HIGHLIGHT_H__
+#define __MCABBER_HIGHLIGHT_H__ 1
+
+#include <glib.h>
+
+// Match kinds
+#define HL_MATCH_NICK       (1U<<0)   // Our nickname in the room
+#define HL_MATCH_KEYWORD    (1U<<1)   // One of the 'highlight_keywords'
+
+typedef struct {
+  guint offset;   // Byte offset of the match in the message
+  guint len;      // Length in bytes
+  guint kind;     // HL_MATCH_NICK or HL_MATCH_KEYWORD
+} hl_match_t;
+
+void  hl_init(void);
+void  hl_deinit(void);
+guint hl_find(const char *text, const char *nick, GArray *matches);
+
+#endif /* __MCABBER_HIGHLIGHT_H__ */
+
+/* vim: set expandtab cindent cinoptions=>2\:2(0 sw=2 ts=2:  For Vim users... */
@@ -32,6 +32,7 @@
 #include "utils.h"
 #include "screen.h"
 #include "settings.h"
+#include "utf8.h"
 #include "utils.h"
 #include "roster.h"
 #include "xmpp.h"
@@ -157,14 +158,71 @@ static void write_histo_line(const char *bjid,
   }
 }
 
+// History file reader
+// The file is read by large chunks; records are located with memchr() and
+// parsed in place.
+#define HLOG_READ_CHUNK  (64*1024)
+
+typedef struct {
+  FILE     *fp;
+  char     *buf;
+  gsize     size;   // Allocated size
+  gsize     start;  // Beginning of the unparsed data
+  gsize     end;    // End of the data
+  gboolean  eof;
+} hlog_reader_t;
+
+//  hlog_reader_fill(reader, maxsize)
+// Read more data.  Unparsed data are moved to the beginning of the buffer,
+// and the buffer is enlarged if it is full (up to maxsize bytes).
+// Return FALSE if no data could be added.
+static gboolean hlog_reader_fill(hlog_reader_t *r, gsize maxsize)
+{
+  size_t n;
+
+  if (r->eof)
+    return FALSE;
+
+  if (r->start) {
+    memmove(r->buf, r->buf + r->start, r->end - r->start);
+    r->end -= r->start;
+    r->start = 0;
+  }
+  if (r->end + 1 >= r->size) {
+    if (r->size >= maxsize)
+      return FALSE;
+    r->size = MIN(2 * r->size, maxsize);
+    r->buf = g_renew(char, r->buf, r->size);
+  }
+
+  // Keep one byte for the trailing NUL
+  n = fread(r->buf + r->end, 1, r->size - 1 - r->end, r->fp);
+  if (!n) {
+    r->eof = TRUE;
+    return FALSE;
+  }
+  r->end += n;
+  return TRUE;
+}
+
+//  hlog_next_line(p, end)
+// Return a pointer to the beginning of the next line, or NULL if the line
+// is not complete.
+static inline char *hlog_next_line(char *p, char *end)
+{
+  p = memchr(p, '\n', end - p);
+  return p ? p+1 : NULL;
+}
+
 //  hlog_read_history()
 // Reads the jid's history logfile
 void hlog_read_history(const char *bjid, GList **p_buddyhbuf, guint width)
 {
   char *filename;
   guchar type, info;
-  char *data, *tail;
-  guint data_size;
+  char *data, *tail, *text;
+  hlog_reader_t reader;
+  gsize maxsize;
   char *xtext;
   time_t timestamp;
   guint prefix_flags;
@@ -183,21 +241,12 @@ void hlog_read_history(const char *bjid, GList **p_buddyhbuf, guint width)
       (settings_opt_get_int("load_muc_logs") != 1))
     return;
 
-  data_size = HBB_BLOCKSIZE+32;
-  data = g_new(char, data_size);
-  if (!data) {
-    scr_LogPrint(LPRINT_LOGNORM, "Not enough memory to read history file");
-    return;
-  }
-
   filename = user_histo_file(bjid);
 
   fp = fopen(filename, "r");
   g_free(filename);
-  if (!fp) {
-    g_free(data);
+  if (!fp)
     return;
-  }
 
   // If file is large (> 3MB here), display a message to inform the user
   // (it can take a while...)
@@ -210,6 +259,17 @@ void hlog_read_history(const char *bjid, GList **p_buddyhbuf, guint width)
 
   max_num_of_blocks = get_max_history_blocks();
 
+  // A single record can't be bigger than maxsize
+  if (max_num_of_blocks)
+    maxsize = MAX(HLOG_READ_CHUNK, 5U*max_num_of_blocks*HBB_BLOCKSIZE + 32);
+  else
+    maxsize = G_MAXSIZE;
+
+  memset(&reader, 0, sizeof(reader));
+  reader.fp   = fp;
+  reader.size = HLOG_READ_CHUNK;
+  reader.buf  = g_new(char, reader.size);
+
   starttime = 0L;
   if (settings_opt_get_int("max_history_age") > 0) {
     int maxdays = settings_opt_get_int("max_history_age");
@@ -221,68 +281,61 @@ void hlog_read_history(const char *bjid, GList **p_buddyhbuf, guint width)
   }
 
   /* See write_histo_line() for line format... */
-  while (!feof(fp)) {
+  for (;;) {
     guint dataoffset = 25;
-    guint noeol;
+    guint headerlen, nlines;
+    char *end;
 
-    if (fgets(data, data_size-1, fp) == NULL)
-      break;
-    ln++;
+    data = reader.buf + reader.start;
+    end  = reader.buf + reader.end;
 
-    tail = data;
-
-    while (!feof(fp)) {
-      for (tail = data; *tail; tail++) ;
-      if (tail == data) {
-        // That would happen if the log file has NUL characters...
-        scr_LogPrint(LPRINT_LOGNORM, "Corrupted history file!  Trying to recover.");
-        err = 1;
+    // Header line
+    tail = hlog_next_line(data, end);
+    if (!tail) {
+      if (hlog_reader_fill(&reader, maxsize))
+        continue;
+      // The buffer may have been moved
+      data = reader.buf + reader.start;
+      end  = reader.buf + reader.end;
+      if (data == end)
         break;
-      }
-      noeol = (*(tail-1) != '\n');
-      if (!noeol)
+      if (!reader.eof) {
+        scr_LogPrint(LPRINT_LOGNORM, "Line too long in history file!");
         break;
-      /* TODO: duplicated code... could do better... */
-      if (tail == data + data_size-2) {
-        // The buffer is too small to contain the whole line.
-        // Let's allocate some more space.
-        if (!max_num_of_blocks ||
-            data_size/HBB_BLOCKSIZE < 5U*max_num_of_blocks) {
-          guint toffset = tail - data;
-          // Allocate one more block.
-          data_size = HBB_BLOCKSIZE * (1 + data_size/HBB_BLOCKSIZE);
-          data = g_renew(char, data, data_size);
-          // Update the tail pointer, as the data may have been moved.
-          tail = data + toffset;
-          if (fgets(tail, data_size-1 - (tail-data), fp) == NULL)
-            break;
-        } else {
-          scr_LogPrint(LPRINT_LOGNORM, "Line too long in history file!");
-          ln--;
-          break;
-        }
       }
+      // Last line, without EOL
+      tail = end;
     }
+    headerlen = tail - data;
+    ln++;
 
     type = data[0];
     info = data[1];
 
-    if ((type != 'M' && type != 'S') ||
+    if (headerlen < 26 || (type != 'M' && type != 'S') ||
         ((data[11] != 'T') || (data[20] != 'Z') ||
          (data[21] != ' ') ||
-         (data[25] != ' ' && data[26] != ' '))) {
+         (data[25] != ' ' && (headerlen < 27 || data[26] != ' ')))) {
       if (!err) {
         scr_LogPrint(LPRINT_LOGNORM,
                      "Error in history file format (%s), l.%u", bjid, ln);
         err = 1;
       }
+      reader.start += headerlen;
       continue;
     }
     // The number of lines can be written with 3 or 4 bytes.
     if (data[25] != ' ') dataoffset = 26;
-    data[21] = data[dataoffset] = 0;
-    timestamp = from_iso8601(&data[3], 1);
-    len = (guint) atoi(&data[22]);
+    if (!from_iso8601_utc(&data[3], &timestamp)) {
+      char ts[20];
+      memcpy(ts, &data[3], 18);
+      ts[18] = 0;
+      timestamp = from_iso8601(ts, 1);
+    }
+    len = 0;
+    for (text = &data[22]; text < &data[dataoffset] && g_ascii_isdigit(*text);
+         text++)
+      len = len*10 + (*text - '0');
 
     // Some checks
     if (((type == 'M') && (info != 'S' && info != 'R' && info != 'I')) ||
@@ -292,41 +345,39 @@ void hlog_read_history(const char *bjid, GList **p_buddyhbuf, guint width)
                      bjid, ln);
         err = 1;
       }
+      reader.start += headerlen;
       continue;
     }
 
-    while (len--) {
-      ln++;
-      if (fgets(tail, data_size-1 - (tail-data), fp) == NULL)
+    // Continuation lines
+    for (nlines = 0; nlines < len && tail < end; nlines++) {
+      char *next = hlog_next_line(tail, end);
+      if (!next)
         break;
-
-      while (*tail) tail++;
-      noeol = (*(tail-1) != '\n');
-      if (tail == data + data_size-2 && (len || noeol)) {
-        // The buffer is too small to contain the whole message.
-        // Let's allocate some more space.
-        if (!max_num_of_blocks ||
-            data_size/HBB_BLOCKSIZE < 5U*max_num_of_blocks) {
-          guint toffset = tail - data;
-          // If the line hasn't been read completely and we reallocate the
-          // buffer, we want to read one more time.
-          if (noeol)
-            len++;
-          // Allocate one more block.
-          data_size = HBB_BLOCKSIZE * (1 + data_size/HBB_BLOCKSIZE);
-          data = g_renew(char, data, data_size);
-          // Update the tail pointer, as the data may have been moved.
-          tail = data + toffset;
-        } else {
+      tail = next;
+    }
+    if (nlines < len) {
+      if (!reader.eof) {
+        if (hlog_reader_fill(&reader, maxsize)) {
+          ln--;
+          continue; // Parse the record again, with more data
+        }
+        if (!reader.eof) {
           // There will probably be a parse error on next read, because
           // this message hasn't been read entirely.
           scr_LogPrint(LPRINT_LOGNORM, "Message too big in history file!");
+          reader.start += headerlen;
+          continue;
         }
+        // The buffer may have been moved
+        data = reader.buf + reader.start;
+        end  = reader.buf + reader.end;
       }
+      // The file has been truncated
+      tail = end;
     }
-    // Remove last CR (we keep it if the line is empty, too)
-    if ((tail > data+dataoffset+1) && (*(tail-1) == '\n'))
-      *(tail-1) = 0;
+    ln += nlines;
+    reader.start += tail - data;
 
     // Check if the data is older than max_history_age
     if (starttime) {
@@ -338,6 +389,18 @@ void hlog_read_history(const char *bjid, GList **p_buddyhbuf, guint width)
 
     if (type == 'M') {
       char *converted;
+      gsize textlen;
+
+      text = &data[dataoffset+1];
+      if (text > tail)
+        text = tail;
+      // Remove last CR
+      if (tail > text && *(tail-1) == '\n')
+        tail--;
+      textlen = tail - text;
+      // There's always room for the NUL, see hlog_reader_fill()
+      *tail = 0;
+
       if (info == 'S') {
         prefix_flags = HBB_PREFIX_OUT | HBB_PREFIX_HLIGHT_OUT;
       } else {
@@ -345,20 +408,29 @@ void hlog_read_history(const char *bjid, GList **p_buddyhbuf, guint width)
         if (info == 'I')
           prefix_flags = HBB_PREFIX_INFO;
       }
-      converted = from_utf8(&data[dataoffset+1]);
-      if (converted) {
-        xtext = ut_expand_tabs(converted); // Expand tabs
-        hbuf_add_line(p_buddyhbuf, xtext, timestamp, prefix_flags, width,
-                      max_num_of_blocks, 0, NULL);
-        if (xtext != converted)
-          g_free(xtext);
-        g_free(converted);
+      // With an UTF-8 locale, the text can be used as is unless it has
+      // tabs or CRs to expand.
+      if (utf8_mode && !memchr(text, '\t', textlen) &&
+          !memchr(text, '\x0d', textlen)) {
+        if (g_utf8_validate(text, textlen, NULL))
+          hbuf_add_line(p_buddyhbuf, text, timestamp, prefix_flags, width,
+                        max_num_of_blocks, 0, NULL);
+      } else {
+        converted = from_utf8(text);
+        if (converted) {
+          xtext = ut_expand_tabs(converted); // Expand tabs
+          hbuf_add_line(p_buddyhbuf, xtext, timestamp, prefix_flags, width,
+                        max_num_of_blocks, 0, NULL);
+          if (xtext != converted)
+            g_free(xtext);
+          g_free(converted);
+        }
       }
       err = 0;
     }
   }
   fclose(fp);
-  g_free(data);
+  g_free(reader.buf);
 }
 
 //  hlog_enable()
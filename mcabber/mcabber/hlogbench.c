@@ -0,0 +1,214 @@
+/*
+ * hlogbench.c  -- History log parsing benchmark
+ *
+ * Copyright (C) 2026 The mcabber authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This program writes a synthetic history log file in a temporary
+ * directory, and measures the throughput of from_iso8601_utc() and
+ * hlog_read_history().  It is not installed.
+ *
+ * Usage: hlogbench [-n messages] [-r rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "histolog.h"
+#include "hbuf.h"
+#include "screen.h"
+#include "settings.h"
+#include "utf8.h"
+#include "utils.h"
+
+#define BENCH_JID     "bench@example.org"
+#define BENCH_WIDTH   80
+
+//  write_log(filename, nmsg, p_size)
+// Write a history log with nmsg messages (one in eight spans several lines)
+// and status changes.  Return FALSE if the file can't be written.
+static gboolean write_log(const char *filename, guint nmsg, gsize *p_size)
+{
+  static const char *words[] = {
+    "hello", "world", "the", "history", "file", "is", "read", "by",
+    "large", "chunks", "and", "parsed", "in", "place", "mcabber", "ok"
+  };
+  FILE *fp;
+  GString *text;
+  time_t ts = 1262304000; // 2010-01-01
+  guint i, j, nl;
+  char str_ts[20];
+
+  fp = fopen(filename, "w");
+  if (!fp)
+    return FALSE;
+
+  text = g_string_sized_new(256);
+  *p_size = 0;
+  srand(1);
+  for (i = 0; i < nmsg; i++) {
+    ts += rand() % 600;
+    to_iso8601(str_ts, ts);
+    if (i % 16 == 15) {
+      *p_size += fprintf(fp, "S%c %-18.18s 000 Status message %u\n",
+                         "_OFDNA"[i % 6], str_ts, i);
+      continue;
+    }
+    g_string_truncate(text, 0);
+    nl = 0;
+    for (j = 1 + rand() % 24; j; j--) {
+      if (i % 8 == 7 && j % 6 == 0) {
+        g_string_append_c(text, '\n');
+        nl++;
+      } else if (text->len) {
+        g_string_append_c(text, ' ');
+      }
+      g_string_append(text, words[rand() % G_N_ELEMENTS(words)]);
+    }
+    *p_size += fprintf(fp, "M%c %-18.18s %03u %s\n", (i & 1) ? 'R' : 'S',
+                       str_ts, nl, text->str);
+  }
+  g_string_free(text, TRUE);
+  return !fclose(fp);
+}
+
+static double elapsed(gint64 start)
+{
+  return (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC;
+}
+
+//  bench_timestamps(nmsg, rounds)
+// Compare from_iso8601_utc() with the generic from_iso8601().
+static void bench_timestamps(guint nmsg, guint rounds)
+{
+  char (*stamps)[20];
+  gint64 start;
+  double t_utc, t_gen;
+  time_t ts = 1262304000, t, sum = 0;
+  guint i, r, ncalls = nmsg * rounds;
+
+  stamps = g_malloc(nmsg * sizeof(*stamps));
+  for (i = 0; i < nmsg; i++) {
+    ts += 7919;
+    to_iso8601(stamps[i], ts);
+  }
+
+  start = g_get_monotonic_time();
+  for (r = 0; r < rounds; r++)
+    for (i = 0; i < nmsg; i++)
+      if (from_iso8601_utc(stamps[i], &t))
+        sum += t;
+  t_utc = elapsed(start);
+
+  start = g_get_monotonic_time();
+  for (r = 0; r < rounds; r++)
+    for (i = 0; i < nmsg; i++)
+      sum -= from_iso8601(stamps[i], 1);
+  t_gen = elapsed(start);
+
+  g_free(stamps);
+
+  printf("from_iso8601_utc: %u calls in %.3fs (%.1f ns/call, %.1f MB/s)\n",
+         ncalls, t_utc, t_utc * 1e9 / ncalls, 18.0 * ncalls / t_utc / 1e6);
+  printf("from_iso8601:     %u calls in %.3fs (%.1f ns/call, %.1f MB/s)\n",
+         ncalls, t_gen, t_gen * 1e9 / ncalls, 18.0 * ncalls / t_gen / 1e6);
+  if (sum)
+    printf("Warning: from_iso8601_utc() and from_iso8601() disagree!\n");
+}
+
+//  bench_read(size, rounds)
+// Time hlog_read_history() on the log file of BENCH_JID.
+static void bench_read(gsize size, guint rounds)
+{
+  GList *hbuf;
+  gint64 start;
+  double t, best = 0;
+  guint r, nlines = 0;
+
+  for (r = 0; r < rounds; r++) {
+    hbuf = NULL;
+    start = g_get_monotonic_time();
+    hlog_read_history(BENCH_JID, &hbuf, BENCH_WIDTH);
+    t = elapsed(start);
+    if (!r || t < best)
+      best = t;
+    nlines = g_list_length(hbuf);
+    hbuf_free(&hbuf);
+  }
+
+  printf("hlog_read_history: %lu bytes, %u buffer lines, best of %u: "
+         "%.3fs (%.1f MB/s)\n", (unsigned long)size, nlines, rounds,
+         best, size / best / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+  guint nmsg = 200000, rounds = 5;
+  gchar *dir, *filename;
+  gsize size;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:r:")) != -1) {
+    switch (c) {
+    case 'n':
+      nmsg = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      rounds = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n messages] [-r rounds]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (!nmsg || !rounds) {
+    fprintf(stderr, "Usage: %s [-n messages] [-r rounds]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  settings_init();
+  scr_init_locale_charset();
+
+  dir = g_dir_make_tmp("hlogbench-XXXXXX", NULL);
+  if (!dir) {
+    fprintf(stderr, "Cannot create a temporary directory\n");
+    return EXIT_FAILURE;
+  }
+  hlog_enable(FALSE, dir, TRUE);
+
+  filename = g_build_filename(dir, BENCH_JID, NULL);
+  if (!write_log(filename, nmsg, &size)) {
+    fprintf(stderr, "Cannot write <%s>\n", filename);
+    rmdir(dir);
+    return EXIT_FAILURE;
+  }
+
+  printf("Locale charset: %s\n", utf8_mode ? "UTF-8" : "non UTF-8");
+  bench_timestamps(nmsg, rounds);
+  bench_read(size, rounds);
+
+  unlink(filename);
+  rmdir(dir);
+  g_free(filename);
+  g_free(dir);
+  return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab cindent cinoptions=>2\:2(0 sw=2 ts=2:  For Vim users... */
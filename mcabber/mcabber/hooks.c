@@ -18,6 +18,8 @@
  */
 
 #include <loudmouth/loudmouth.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -33,18 +35,43 @@
 #include "utf8.h"
 #include "commands.h"
 #include "main.h"
+#include "highlight.h"
 
 #ifdef MODULES_ENABLE
 #include <glib.h>
 
 typedef struct {
   hk_handler_t handler;
+  hk_message_handler_t msg_handler; // Typed handler (message hooks)
   gint      priority;
   gpointer  userdata;
   guint     hid;
 } hook_list_data_t;
 
-static GHashTable *hk_handler_hash = NULL;
+typedef struct {
+  gchar    *name;
+  GSList   *handlers;
+} hook_entry_t;
+
+// Hook names are interned: each hook has a numeric id, which is an index
+// in hk_hooks.  The core hooks have fixed ids (see hooks.h).
+static GPtrArray  *hk_hooks = NULL;     // Hook id -> hook_entry_t
+static GHashTable *hk_hook_ids = NULL;  // Hook name -> hook id
+
+// The order must match the HOOK_ID_* values
+static const gchar *core_hooks[] = {
+  HOOK_PRE_MESSAGE_IN,
+  HOOK_POST_MESSAGE_IN,
+  HOOK_MESSAGE_OUT,
+  HOOK_MDR_RECEIVED,
+  HOOK_STATUS_CHANGE,
+  HOOK_MY_STATUS_CHANGE,
+  HOOK_POST_CONNECT,
+  HOOK_PRE_DISCONNECT,
+  HOOK_UNREAD_LIST_CHANGE,
+  HOOK_SUBSCRIPTION,
+  NULL
+};
 
 //  _new_hook_id()
 // Return a unique Hook Id
@@ -55,27 +82,54 @@ static guint _new_hook_id(void)
   return ++hidcounter;
 }
 
-//  _new_hook_queue(hookname)
-// Create a new hash table entry with a GSList pointer for the specified hook
-static GSList **_new_hook_queue(const gchar *hookname)
+//  _new_hook(hookname)
+// Register a new hook name and return its id.
+static guint _new_hook(const gchar *hookname)
 {
-  GSList **p;
-  // Create the hash table if needed.
-  if (!hk_handler_hash) {
-    hk_handler_hash = g_hash_table_new_full(&g_str_hash, &g_str_equal,
-                                            &g_free, &g_free);
-    if (!hk_handler_hash) {
-      scr_log_print(LPRINT_LOGNORM, "Couldn't create hook hash table!");
-      return NULL;
-    }
+  hook_entry_t *hook = g_new0(hook_entry_t, 1);
+
+  hook->name = g_strdup(hookname);
+  g_ptr_array_add(hk_hooks, hook);
+  g_hash_table_insert(hk_hook_ids, hook->name,
+                      GUINT_TO_POINTER(hk_hooks->len - 1));
+  return hk_hooks->len - 1;
+}
+
+//  hk_hook_id(hookname)
+// Return the numeric id of the hook, registering the name if needed.
+guint hk_hook_id(const gchar *hookname)
+{
+  guint hookid;
+
+  if (!hk_hooks) {
+    const gchar **p;
+    hk_hooks = g_ptr_array_new();
+    hk_hook_ids = g_hash_table_new(&g_str_hash, &g_str_equal);
+    g_ptr_array_add(hk_hooks, NULL); // Id 0 is not used
+    for (p = core_hooks; *p; p++)
+      _new_hook(*p);
   }
 
-  // Add a queue for the requested hook
-  p = g_new(GSList*, 1);
-  *p = NULL;
-  g_hash_table_insert(hk_handler_hash, g_strdup(hookname), p);
+  hookid = GPOINTER_TO_UINT(g_hash_table_lookup(hk_hook_ids, hookname));
+  if (!hookid)
+    hookid = _new_hook(hookname);
+  return hookid;
+}
+
+static inline hook_entry_t *_get_hook(guint hookid)
+{
+  if (!hk_hooks || !hookid || hookid >= hk_hooks->len)
+    return NULL;
+  return g_ptr_array_index(hk_hooks, hookid);
+}
 
-  return p;
+//  hk_has_handlers(hookid)
+// Return TRUE if there is at least one handler for the hook.
+// This can be used to avoid building the hook arguments.
+gboolean hk_has_handlers(guint hookid)
+{
+  hook_entry_t *hook = _get_hook(hookid);
+  return hook && hook->handlers;
 }
 
 static gint _hk_compare_prio(hook_list_data_t *a, hook_list_data_t *b)
@@ -85,32 +139,51 @@ static gint _hk_compare_prio(hook_list_data_t *a, hook_list_data_t *b)
   return 0;
 }
 
+static guint _hk_add_handler(hk_handler_t handler,
+                             hk_message_handler_t msg_handler,
+                             const gchar *hookname, gint priority,
+                             gpointer userdata)
+{
+  hook_entry_t *hook = _get_hook(hk_hook_id(hookname));
+  hook_list_data_t *h = g_new(hook_list_data_t, 1);
+
+  h->handler     = handler;
+  h->msg_handler = msg_handler;
+  h->priority    = priority;
+  h->userdata    = userdata;
+  h->hid         = _new_hook_id();
+
+  hook->handlers = g_slist_insert_sorted(hook->handlers, h,
+                                         (GCompareFunc)_hk_compare_prio);
+  return h->hid;
+}
+
 //  hk_add_handler(handler, hookname, priority, userdata)
-// Create a hook handler and a hook hash entry if needed.
+// Create a hook handler.
 // Return the handler id.
 guint hk_add_handler(hk_handler_t handler, const gchar *hookname,
                      gint priority, gpointer userdata)
 {
-  GSList **hqueue = NULL;
-  hook_list_data_t *h = g_new(hook_list_data_t, 1);
-
-  h->handler  = handler;
-  h->priority = priority;
-  h->userdata = userdata;
-  h->hid      = _new_hook_id();
-
-  if (hk_handler_hash)
-    hqueue = g_hash_table_lookup(hk_handler_hash, hookname);
+  return _hk_add_handler(handler, NULL, hookname, priority, userdata);
+}
 
-  if (!hqueue)
-    hqueue = _new_hook_queue(hookname);
+//  hk_add_message_handler(handler, hookname, priority, userdata)
+// Create a typed hook handler for a message hook (HOOK_PRE_MESSAGE_IN,
+// HOOK_POST_MESSAGE_IN or HOOK_MESSAGE_OUT).
+// Return the handler id, or 0 if this isn't a message hook.
+guint hk_add_message_handler(hk_message_handler_t handler,
+                             const gchar *hookname, gint priority,
+                             gpointer userdata)
+{
+  guint hookid = hk_hook_id(hookname);
 
-  if (!hqueue)
+  if (hookid != HOOK_ID_PRE_MESSAGE_IN && hookid != HOOK_ID_POST_MESSAGE_IN &&
+      hookid != HOOK_ID_MESSAGE_OUT) {
+    scr_log_print(LPRINT_LOGNORM, "*ERROR*: %s is not a message hook!",
+                  hookname);
     return 0;
-
-  *hqueue = g_slist_insert_sorted(*hqueue, h, (GCompareFunc)_hk_compare_prio);
-
-  return h->hid;
+  }
+  return _hk_add_handler(NULL, handler, hookname, priority, userdata);
 }
 
 static gint _hk_queue_search_cb(hook_list_data_t *a, guint *hid)
@@ -122,61 +195,153 @@ static gint _hk_queue_search_cb(hook_list_data_t *a, guint *hid)
 
 //  hk_del_handler(hookname, hook_id)
 // Remove the handler with specified hook id from the hookname queue.
-// The hash entry is removed if the queue is empty.
 void hk_del_handler(const gchar *hookname, guint hid)
 {
-  GSList **hqueue;
+  hook_entry_t *hook = NULL;
   GSList *el;
 
   if (!hid)
     return;
 
-  hqueue = g_hash_table_lookup(hk_handler_hash, hookname);
-
-  if (!hqueue) {
+  if (hk_hook_ids)
+    hook = _get_hook(GPOINTER_TO_UINT(g_hash_table_lookup(hk_hook_ids,
+                                                          hookname)));
+  if (!hook) {
     scr_log_print(LPRINT_LOGNORM, "*ERROR*: Couldn't remove hook handler!");
     return;
   }
 
-  el = g_slist_find_custom(*hqueue, &hid,
+  el = g_slist_find_custom(hook->handlers, &hid,
                            (GCompareFunc)_hk_queue_search_cb);
   if (el) {
     g_free(el->data);
-    *hqueue = g_slist_delete_link(*hqueue, el);
-    // Remove hook hash table entry if the hook queue is empty
-    if (!*hqueue)
-      g_hash_table_remove(hk_handler_hash, hookname);
+    hook->handlers = g_slist_delete_link(hook->handlers, el);
   }
 }
 
-//  hk_run_handlers(hookname, args)
-// Process all hooks for the "hookname" event.
+//  hk_run_handlers_id(hookid, args)
+// Process all hooks for the hookid event.
+// Typed handlers are skipped, as there is no typed argument.
 // Note that the processing is interrupted as soon as one of the handlers
 // do not return HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS (i.e. 0).
-guint hk_run_handlers(const gchar *hookname, hk_arg_t *args)
+guint hk_run_handlers_id(guint hookid, hk_arg_t *args)
 {
-  GSList **hqueue;
+  hook_entry_t *hook = _get_hook(hookid);
   GSList *h;
   guint ret = 0;
 
-  if (!hk_handler_hash)
+  if (!hook)
+    return 0; // Should we use a special code?
+
+  for (h = hook->handlers; h; h = g_slist_next(h)) {
+    hook_list_data_t *data = h->data;
+    if (!data->handler)
+      continue;
+    ret = (data->handler)(hook->name, args, data->userdata);
+    if (ret) break;
+  }
+  return ret;
+}
+
+//  hk_run_handlers(hookname, args)
+// Process all hooks for the "hookname" event.
+// See hk_run_handlers_id().
+guint hk_run_handlers(const gchar *hookname, hk_arg_t *args)
+{
+  if (!hk_hook_ids)
     return 0;
 
-  hqueue = g_hash_table_lookup(hk_handler_hash, hookname);
-  if (!hqueue)
-    return 0; // Should we use a special code?
+  return hk_run_handlers_id(GPOINTER_TO_UINT(g_hash_table_lookup(hk_hook_ids,
+                                                                 hookname)),
+                            args);
+}
+
+//  hk_message_args(hookid, msg, strdelay)
+// Build the string arguments of a message hook.
+// strdelay must be at least 32 bytes long.
+// The array should be freed by the caller after use.
+static hk_arg_t *hk_message_args(guint hookid, const hk_message_t *msg,
+                                 gchar *strdelay)
+{
+  hk_arg_t *args = g_new0(hk_arg_t, 9);
+  hk_arg_t *arg = args;
+
+#define HK_ARG(n, v)  do { arg->name = (n); arg->value = (v); arg++; } while (0)
+#define HK_BOOL(b)    ((b) ? "true" : "false")
+  HK_ARG("jid", msg->jid);
+  if (hookid == HOOK_ID_MESSAGE_OUT) {
+    HK_ARG("message", msg->message);
+    return args;
+  }
+
+  if (msg->delayed)
+    to_iso8601(strdelay, msg->delayed);
+  else
+    strdelay[0] = '\0';
+
+  HK_ARG("resource", msg->resource);
+  HK_ARG("message", msg->message);
+  HK_ARG("groupchat", HK_BOOL(msg->groupchat));
+  if (hookid == HOOK_ID_POST_MESSAGE_IN)
+    HK_ARG("attention", HK_BOOL(msg->attention));
+  HK_ARG("delayed", strdelay);
+  HK_ARG("error", HK_BOOL(msg->error));
+  HK_ARG("carbon", HK_BOOL(msg->carbon));
+#undef HK_BOOL
+#undef HK_ARG
+  return args;
+}
+
+//  hk_run_message_handlers(hookid, msg)
+// Process all hooks for a message event.  The string arguments are only
+// built if there is an untyped handler.
+static guint hk_run_message_handlers(guint hookid, const hk_message_t *msg)
+{
+  hook_entry_t *hook = _get_hook(hookid);
+  hk_arg_t *args = NULL;
+  gchar strdelay[32];
+  GSList *h;
+  guint ret = 0;
 
-  for (h = *hqueue; h; h = g_slist_next(h)) {
+  if (!hook)
+    return 0;
+
+  for (h = hook->handlers; h; h = g_slist_next(h)) {
     hook_list_data_t *data = h->data;
-    ret = (data->handler)(hookname, args, data->userdata);
+    if (data->msg_handler) {
+      ret = (data->msg_handler)(hook->name, msg, data->userdata);
+    } else {
+      if (!args)
+        args = hk_message_args(hookid, msg, strdelay);
+      ret = (data->handler)(hook->name, args, data->userdata);
+    }
     if (ret) break;
   }
+  g_free(args);
   return ret;
 }
 #endif
 
 static char *extcmd;
 
+// Persistent events command ('eventcmd_persistent' option)
+// The command is started once, and the events are written to its standard
+// input, one per line (see evhelper_send()).  If the helper is too slow,
+// events are queued up to EVHELPER_QUEUE_MAX bytes and then dropped.
+// Events are also dropped (and counted) while the helper can't be
+// restarted, and when it exits with some events still queued.
+#define EVHELPER_QUEUE_MAX      (256*1024)
+#define EVHELPER_RESTART_DELAY  5   // Minimum delay between restarts (s)
+
+static struct {
+  pid_t    pid;
+  int      fd;          // Write end of the pipe, -1 if not running
+  guint    watch;       // G_IO_OUT watch, when the queue isn't empty
+  GString *queue;       // Data not written yet
+  time_t   started;
+  guint    dropped;     // Number of dropped events
+} evhelper = { 0, -1, 0, NULL, 0, 0 };
+
 static const char *COMMAND_ME = "/me ";
 
 void hk_message_in(const char *bjid, const char *resname,
@@ -196,14 +361,7 @@ void hk_message_in(const char *bjid, const char *resname,
   const char *ename = NULL;
   gboolean attention = FALSE, mucprivmsg = FALSE;
   gboolean error_msg_subtype = (type == LM_MESSAGE_SUB_TYPE_ERROR);
-#ifdef MODULES_ENABLE
-  gchar strdelay[32];
-
-  if (timestamp)
-    to_iso8601(strdelay, timestamp);
-  else
-    strdelay[0] = '\0';
-#endif
+  GArray *hlmatches = NULL;
 
   if (encrypted == ENCRYPTED_PGP)
     message_flags |= HBB_PREFIX_PGPCRYPT;
@@ -216,7 +374,7 @@ void hk_message_in(const char *bjid, const char *resname,
   if (type == LM_MESSAGE_SUB_TYPE_GROUPCHAT) {
     rtype = ROSTER_TYPE_ROOM;
     is_groupchat = TRUE;
-    log_muc_conf = settings_opt_get_int("log_muc_conf");
+    log_muc_conf = settings_opt_slot_int(OPT_SLOT_LOG_MUC_CONF);
     if (!resname) {
       message_flags = HBB_PREFIX_INFO | HBB_PREFIX_NOFLAG;
       resname = "";
@@ -243,19 +401,18 @@ void hk_message_in(const char *bjid, const char *resname,
   }
 
 #ifdef MODULES_ENABLE
-  {
+  if (hk_has_handlers(HOOK_ID_PRE_MESSAGE_IN)) {
     guint h_result;
-    hk_arg_t args[] = {
-      { "jid", bjid },
-      { "resource", resname },
-      { "message", msg },
-      { "groupchat", is_groupchat ? "true" : "false" },
-      { "delayed", strdelay },
-      { "error", error_msg_subtype ? "true" : "false" },
-      { "carbon", carbon ? "true" : "false" },
-      { NULL, NULL },
+    hk_message_t hmsg = {
+      .jid       = bjid,
+      .resource  = resname,
+      .message   = msg,
+      .delayed   = timestamp,
+      .groupchat = is_groupchat,
+      .error     = error_msg_subtype,
+      .carbon    = carbon,
     };
-    h_result = hk_run_handlers(HOOK_PRE_MESSAGE_IN, args);
+    h_result = hk_run_message_handlers(HOOK_ID_PRE_MESSAGE_IN, &hmsg);
     if (h_result == HOOK_HANDLER_RESULT_NO_MORE_HANDLER_DROP_DATA) {
       scr_LogPrint(LPRINT_DEBUG, "Message dropped (hook result).");
       g_free(bmsg);
@@ -303,38 +460,27 @@ void hk_message_in(const char *bjid, const char *resname,
       // This is a regular chatroom message.
       const char *nick = buddy_getnickname(roster_usr->data);
 
-      if (nick) {
-        // Let's see if we are the message sender, in which case we'll
-        // highlight it.
-        if (resname && !strcmp(resname, nick)) {
-          message_flags |= HBB_PREFIX_HLIGHT_OUT;
-        } else {
-          // We're not the sender.  Can we see our nick?
-          const char *msgptr = msg;
-          while ((msgptr = strcasestr(msgptr, nick)) != NULL) {
-            const char *leftb, *rightb;
-            // The message contains our nick.  Let's check it's not
-            // in the middle of another word (i.e. preceded/followed
-            // immediately by an alphanumeric character or an underscore.
-            rightb = msgptr+strlen(nick);
-            if (msgptr == msg)
-              leftb = NULL;
-            else
-              leftb = prev_char((char*)msgptr, msg);
-            msgptr = next_char((char*)msgptr);
-            // Check left boundary
-            if (leftb && (iswalnum(get_char(leftb)) || get_char(leftb) == '_'))
-              continue;
-            // Check right boundary
-            if (!iswalnum(get_char(rightb)) && get_char(rightb) != '_')
-              attention = TRUE;
-            if (attention && !settings_opt_get_int("muc_disable_nick_hl"))
-              message_flags |= HBB_PREFIX_HLIGHT;
-          }
-        }
+      // Let's see if we are the message sender, in which case we'll
+      // highlight it.
+      if (nick && resname && !strcmp(resname, nick)) {
+        message_flags |= HBB_PREFIX_HLIGHT_OUT;
+      } else {
+        // We're not the sender.  Can we see our nick or a keyword?
+        guint hlkinds;
+#ifdef MODULES_ENABLE
+        if (hk_has_handlers(HOOK_ID_POST_MESSAGE_IN))
+          hlmatches = g_array_new(FALSE, FALSE, sizeof(hl_match_t));
+#endif
+        hlkinds = hl_find(msg, nick, hlmatches);
+        if (hlkinds)
+          attention = TRUE;
+        if ((hlkinds & HL_MATCH_KEYWORD) ||
+            ((hlkinds & HL_MATCH_NICK) &&
+             !settings_opt_slot_int(OPT_SLOT_MUC_DISABLE_NICK_HL)))
+          message_flags |= HBB_PREFIX_HLIGHT;
       }
     }
-  } else if (settings_opt_get_int("roster_autolock_resource")) {
+  } else if (settings_opt_slot_int(OPT_SLOT_ROSTER_AUTOLOCK_RESOURCE)) {
     buddy_setactiveresource(roster_usr->data, resname);
     scr_update_chat_status(FALSE);
   }
@@ -375,7 +521,7 @@ void hk_message_in(const char *bjid, const char *resname,
       (!is_room || (is_groupchat && log_muc_conf && !timestamp)))
     hlog_write_message(bjid, timestamp, 0, wmsg);
 
-  if (settings_opt_get_int("events_ignore_active_window") &&
+  if (settings_opt_slot_int(OPT_SLOT_EVENTS_IGNORE_ACTIVE_WINDOW) &&
       current_buddy && scr_get_chatmode()) {
     gpointer bud = BUDDATA(current_buddy);
     if (bud) {
@@ -385,12 +531,12 @@ void hk_message_in(const char *bjid, const char *resname,
     }
   }
 
-  if (settings_opt_get_int("eventcmd_use_nickname"))
+  if (settings_opt_slot_int(OPT_SLOT_EVENTCMD_USE_NICKNAME))
     ename = roster_getname(bjid);
 
   // Display the sender in the log window
   if ((!is_groupchat) && !(message_flags & HBB_PREFIX_ERR) &&
-      settings_opt_get_int("log_display_sender")) {
+      settings_opt_slot_int(OPT_SLOT_LOG_DISPLAY_SENDER)) {
     const char *name = roster_getname(bjid);
     if (!name) name = "";
     scr_LogPrint(LPRINT_NORMAL, "Message received from %s <%s/%s>",
@@ -398,19 +544,20 @@ void hk_message_in(const char *bjid, const char *resname,
   }
 
 #ifdef MODULES_ENABLE
-  {
-    hk_arg_t args[] = {
-      { "jid", bjid },
-      { "resource", resname },
-      { "message", msg },
-      { "groupchat", is_groupchat ? "true" : "false" },
-      { "attention", attention ? "true" : "false" },
-      { "delayed", strdelay },
-      { "error", error_msg_subtype ? "true" : "false" },
-      { "carbon", carbon ? "true" : "false" },
-      { NULL, NULL },
+  if (hk_has_handlers(HOOK_ID_POST_MESSAGE_IN)) {
+    hk_message_t hmsg = {
+      .jid       = bjid,
+      .resource  = resname,
+      .message   = msg,
+      .delayed   = timestamp,
+      .groupchat = is_groupchat,
+      .attention = attention,
+      .error     = error_msg_subtype,
+      .carbon    = carbon,
+      .matches   = hlmatches ? (hl_match_t *)hlmatches->data : NULL,
+      .nmatches  = hlmatches ? hlmatches->len : 0,
     };
-    hk_run_handlers(HOOK_POST_MESSAGE_IN, args);
+    hk_run_message_handlers(HOOK_ID_POST_MESSAGE_IN, &hmsg);
   }
 #endif
 
@@ -424,7 +571,7 @@ void hk_message_in(const char *bjid, const char *resname,
   // Beep, if enabled:
   // - if it's a private message
   // - if it's a public message and it's highlighted
-  if (settings_opt_get_int("beep_on_message")) {
+  if (settings_opt_slot_int(OPT_SLOT_BEEP_ON_MESSAGE)) {
     if ((!is_groupchat && !(message_flags & HBB_PREFIX_ERR)) ||
         (is_groupchat  && (message_flags & HBB_PREFIX_HLIGHT)))
       scr_beep();
@@ -439,6 +586,8 @@ void hk_message_in(const char *bjid, const char *resname,
     scr_update_roster();
   }
 
+  if (hlmatches)
+    g_array_free(hlmatches, TRUE);
   g_free(bmsg);
   g_free(mmsg);
 }
@@ -489,13 +638,14 @@ void hk_message_out(const char *bjid, const char *nick,
     hlog_write_message(bjid, timestamp, 1, msg);
 
 #ifdef MODULES_ENABLE
-  {
-    hk_arg_t args[] = {
-      { "jid", bjid },
-      { "message", wmsg },
-      { NULL, NULL },
+  if (hk_has_handlers(HOOK_ID_MESSAGE_OUT)) {
+    hk_message_t hmsg = {
+      .jid       = bjid,
+      .message   = wmsg,
+      .delayed   = timestamp,
+      .carbon    = carbon,
     };
-    hk_run_handlers(HOOK_MESSAGE_OUT, args);
+    hk_run_message_handlers(HOOK_ID_MESSAGE_OUT, &hmsg);
     // TODO: check (and use) return value
   }
 #endif
@@ -518,15 +668,15 @@ void hk_statuschange(const char *bjid, const char *resname, gchar prio,
   const char *rn = (resname ? resname : "");
   const char *ename = NULL;
 
-  if (settings_opt_get_int("eventcmd_use_nickname"))
+  if (settings_opt_slot_int(OPT_SLOT_EVENTCMD_USE_NICKNAME))
     ename = roster_getname(bjid);
 
   oldstat = roster_getstatus(bjid, resname);
 
-  st_in_buf = settings_opt_get_int("show_status_in_buffer");
+  st_in_buf = settings_opt_slot_int(OPT_SLOT_SHOW_STATUS_IN_BUFFER);
 
-  if (settings_opt_get_int("log_display_presence")) {
-    int buddy_format = settings_opt_get_int("buddy_format");
+  if (settings_opt_slot_int(OPT_SLOT_LOG_DISPLAY_PRESENCE)) {
+    int buddy_format = settings_opt_slot_int(OPT_SLOT_BUDDY_FORMAT);
     bn = NULL;
     if (buddy_format) {
       const char *name = roster_getname(bjid);
@@ -572,7 +722,7 @@ void hk_statuschange(const char *bjid, const char *resname, gchar prio,
   hlog_write_status(bjid, timestamp, status, status_msg);
 
 #ifdef MODULES_ENABLE
-  {
+  if (hk_has_handlers(HOOK_ID_STATUS_CHANGE)) {
     char os[2] = " \0";
     char ns[2] = " \0";
     hk_arg_t args[] = {
@@ -586,7 +736,7 @@ void hk_statuschange(const char *bjid, const char *resname, gchar prio,
     os[0] = imstatus2char[oldstat];
     ns[0] = imstatus2char[status];
 
-    hk_run_handlers(HOOK_STATUS_CHANGE, args);
+    hk_run_handlers_id(HOOK_ID_STATUS_CHANGE, args);
   }
 #endif
 
@@ -602,7 +752,7 @@ void hk_mystatuschange(time_t timestamp, enum imstatus old_status,
                (msg ? msg : ""));
 
 #ifdef MODULES_ENABLE
-  {
+  if (hk_has_handlers(HOOK_ID_MY_STATUS_CHANGE)) {
     char ns[2] = " \0";
     hk_arg_t args[] = {
       { "new_status", ns },
@@ -611,7 +761,7 @@ void hk_mystatuschange(time_t timestamp, enum imstatus old_status,
     };
     ns[0] = imstatus2char[new_status];
 
-    hk_run_handlers(HOOK_MY_STATUS_CHANGE, args);
+    hk_run_handlers_id(HOOK_ID_MY_STATUS_CHANGE, args);
   }
 #endif
 
@@ -628,7 +778,7 @@ void hk_postconnect(void)
     hk_arg_t args[] = {
       { NULL, NULL },
     };
-    hk_run_handlers(HOOK_POST_CONNECT, args);
+    hk_run_handlers_id(HOOK_ID_POST_CONNECT, args);
   }
 #endif
 
@@ -654,7 +804,7 @@ void hk_predisconnect(void)
     hk_arg_t args[] = {
       { NULL, NULL },
     };
-    hk_run_handlers(HOOK_PRE_DISCONNECT, args);
+    hk_run_handlers_id(HOOK_ID_PRE_DISCONNECT, args);
   }
 #endif
 
@@ -688,7 +838,7 @@ void hk_unread_list_change(guint unread_count, guint attention_count,
     return;
 
 #ifdef MODULES_ENABLE
-  {
+  if (hk_has_handlers(HOOK_ID_UNREAD_LIST_CHANGE)) {
     str_unread = g_strdup_printf("%u", unread_count);
     gchar *str_attention = g_strdup_printf("%u", attention_count);
     gchar *str_muc_unread = g_strdup_printf("%u", muc_unread);
@@ -700,7 +850,7 @@ void hk_unread_list_change(guint unread_count, guint attention_count,
       { "muc_attention", str_muc_attention }, // MUC attention (highlight)
       { NULL, NULL },
     };
-    hk_run_handlers(HOOK_UNREAD_LIST_CHANGE, args);
+    hk_run_handlers_id(HOOK_ID_UNREAD_LIST_CHANGE, args);
     g_free(str_unread);
     g_free(str_attention);
     g_free(str_muc_unread);
@@ -746,7 +896,7 @@ guint hk_subscription(LmMessageSubType mstype, const gchar *bjid,
       { "message", msg ? msg : "" },
       { NULL, NULL },
     };
-    h_result = hk_run_handlers(HOOK_SUBSCRIPTION, args);
+    h_result = hk_run_handlers_id(HOOK_ID_SUBSCRIPTION, args);
   }
   if (h_result != HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS) {
     scr_LogPrint(LPRINT_DEBUG, "Subscription message ignored (hook result).");
@@ -759,11 +909,203 @@ guint hk_subscription(LmMessageSubType mstype, const gchar *bjid,
 
 /* External commands */
 
+//  evhelper_drop(n)
+// Count n dropped events.
+static void evhelper_drop(guint n)
+{
+  if (!n)
+    return;
+  if (!evhelper.dropped)
+    scr_LogPrint(LPRINT_LOGNORM, "Events command is unavailable or too slow, "
+                 "dropping events.");
+  evhelper.dropped += n;
+}
+
+//  evhelper_stop()
+// Close the pipe to the persistent events command.  The helper gets an
+// end-of-file and should exit.  The events still queued are dropped.
+static void evhelper_stop(void)
+{
+  if (evhelper.watch)
+    g_source_remove(evhelper.watch);
+  evhelper.watch = 0;
+  if (evhelper.fd != -1)
+    close(evhelper.fd);
+  evhelper.fd = -1;
+  evhelper.pid = 0;
+  if (evhelper.queue && evhelper.queue->len) {
+    const char *p;
+    guint n = 0;
+    // One event per line (a partially written event counts as dropped)
+    for (p = evhelper.queue->str; *p; p++)
+      if (*p == '\n')
+        n++;
+    evhelper_drop(n);
+    g_string_truncate(evhelper.queue, 0);
+  }
+}
+
+//  evhelper_start()
+// Launch the persistent events command, with a pipe to its standard input.
+// Return TRUE if the helper is running.
+static gboolean evhelper_start(void)
+{
+  int pfd[2];
+  pid_t pid;
+  time_t now = time(NULL);
+
+  if (evhelper.fd != -1)
+    return TRUE;
+
+  // Do not restart a failing command in a loop
+  if (evhelper.started && now - evhelper.started < EVHELPER_RESTART_DELAY)
+    return FALSE;
+  evhelper.started = now;
+
+  if (pipe(pfd) == -1) {
+    scr_LogPrint(LPRINT_LOGNORM, "Cannot create pipe for external command.");
+    return FALSE;
+  }
+
+  if ((pid=fork()) == -1) {
+    scr_LogPrint(LPRINT_LOGNORM, "Fork error, cannot launch external command.");
+    close(pfd[0]);
+    close(pfd[1]);
+    return FALSE;
+  }
+
+  if (pid == 0) { // child
+    close(pfd[1]);
+    dup2(pfd[0], STDIN_FILENO);
+    if (pfd[0] != STDIN_FILENO)
+      close(pfd[0]);
+    close(STDOUT_FILENO);
+    close(STDERR_FILENO);
+    execl(extcmd, extcmd, (char *)NULL);
+    exit(1);
+  }
+
+  close(pfd[0]);
+  fcntl(pfd[1], F_SETFL, fcntl(pfd[1], F_GETFL) | O_NONBLOCK);
+  fcntl(pfd[1], F_SETFD, FD_CLOEXEC);
+  evhelper.fd  = pfd[1];
+  evhelper.pid = pid;
+  if (!evhelper.queue)
+    evhelper.queue = g_string_new(NULL);
+  scr_LogPrint(LPRINT_DEBUG, "Events command started (pid %d).", (int)pid);
+  return TRUE;
+}
+
+static gboolean evhelper_cb(GIOChannel *channel, GIOCondition cond,
+                            gpointer data);
+
+//  evhelper_flush()
+// Write as much queued data as possible to the helper.
+// A watch is set up if some data are left.
+static void evhelper_flush(void)
+{
+  gsize written = 0;
+
+  while (written < evhelper.queue->len) {
+    ssize_t n = write(evhelper.fd, evhelper.queue->str + written,
+                      evhelper.queue->len - written);
+    if (n > 0) {
+      written += n;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && errno == EAGAIN) {
+      break;
+    } else {
+      // The helper has exited; it will be restarted with the next event.
+      scr_LogPrint(LPRINT_LOGNORM, "Events command has exited.");
+      evhelper_stop();
+      return;
+    }
+  }
+  g_string_erase(evhelper.queue, 0, written);
+
+  if (evhelper.queue->len && !evhelper.watch) {
+    GIOChannel *channel = g_io_channel_unix_new(evhelper.fd);
+    evhelper.watch = g_io_add_watch(channel, G_IO_OUT|G_IO_ERR|G_IO_HUP,
+                                    evhelper_cb, NULL);
+    g_io_channel_unref(channel);
+  } else if (!evhelper.queue->len && evhelper.watch) {
+    g_source_remove(evhelper.watch);
+    evhelper.watch = 0;
+  }
+}
+
+static gboolean evhelper_cb(GIOChannel *channel, GIOCondition cond,
+                            gpointer data)
+{
+  if (cond & (G_IO_ERR|G_IO_HUP)) {
+    scr_LogPrint(LPRINT_LOGNORM, "Events command has exited.");
+    evhelper.watch = 0;
+    evhelper_stop();
+    return FALSE;
+  }
+  evhelper.watch = 0; // evhelper_flush() will set it again if needed
+  evhelper_flush();
+  return FALSE;
+}
+
+//  evhelper_append_field(str, field)
+// Append an event field, escaping backslashes, tabs and newlines.
+static void evhelper_append_field(GString *str, const char *field)
+{
+  const char *p;
+
+  for (p = field; p && *p; p++) {
+    if (*p == '\\')
+      g_string_append(str, "\\\\");
+    else if (*p == '\t')
+      g_string_append(str, "\\t");
+    else if (*p == '\n')
+      g_string_append(str, "\\n");
+    else
+      g_string_append_c(str, *p);
+  }
+}
+
+//  evhelper_send(type, info, bjid, data)
+// Send an event to the persistent events command.
+// The line format is "TYPE<tab>INFO<tab>JID<tab>DATA\n"; the fields are
+// the same as the events_command arguments, and DATA is the message body
+// (when event_log_files is set).
+static void evhelper_send(const char *type, const char *info,
+                          const char *bjid, const char *data)
+{
+  // The helper may be waiting for EVHELPER_RESTART_DELAY
+  if (!evhelper_start() || evhelper.queue->len >= EVHELPER_QUEUE_MAX) {
+    evhelper_drop(1);
+    return;
+  }
+  if (evhelper.dropped) {
+    scr_LogPrint(LPRINT_LOGNORM, "%u event(s) have been dropped.",
+                 evhelper.dropped);
+    evhelper.dropped = 0;
+  }
+
+  evhelper_append_field(evhelper.queue, type);
+  g_string_append_c(evhelper.queue, '\t');
+  evhelper_append_field(evhelper.queue, info);
+  g_string_append_c(evhelper.queue, '\t');
+  evhelper_append_field(evhelper.queue, bjid);
+  g_string_append_c(evhelper.queue, '\t');
+  evhelper_append_field(evhelper.queue, data);
+  g_string_append_c(evhelper.queue, '\n');
+
+  if (!evhelper.watch)
+    evhelper_flush();
+}
+
 //  hk_ext_cmd_init()
 // Initialize external command variable.
 // Can be called with parameter NULL to reset and free memory.
 void hk_ext_cmd_init(const char *command)
 {
+  evhelper_stop();
+  evhelper.started = 0;
   if (extcmd) {
     g_free(extcmd);
     extcmd = NULL;
@@ -817,7 +1159,20 @@ void hk_ext_cmd(const char *bjid, guchar type, guchar info, const char *data)
 
   if (!arg_type || !arg_info) return;
 
-  if (strchr("MG", type) && data && settings_opt_get_int("event_log_files")) {
+  if (settings_opt_slot_int(OPT_SLOT_EVENTCMD_PERSISTENT)) {
+    char *data_locale = NULL;
+    if (strchr("MG", type) && data &&
+        settings_opt_slot_int(OPT_SLOT_EVENT_LOG_FILES))
+      data_locale = from_utf8(data);
+    evhelper_send(arg_type, arg_info, bjid, data_locale);
+    g_free(data_locale);
+    return;
+  }
+  if (evhelper.fd != -1)
+    evhelper_stop();
+
+  if (strchr("MG", type) && data &&
+      settings_opt_slot_int(OPT_SLOT_EVENT_LOG_FILES)) {
     int fd;
     const char *prefix;
     char *prefix_xp = NULL;
@@ -12,6 +12,7 @@
 #include <mcabber/config.h>
 #ifdef MODULES_ENABLE
 #include <glib.h>
+#include <mcabber/highlight.h>
 
 // Core hooks
 #define HOOK_PRE_MESSAGE_IN     "hook-pre-message-in"
@@ -25,6 +26,20 @@
 #define HOOK_UNREAD_LIST_CHANGE "hook-unread-list-change"
 #define HOOK_SUBSCRIPTION       "hook-subscription"
 
+// Core hook ids (see hk_hook_id())
+enum {
+  HOOK_ID_PRE_MESSAGE_IN = 1,
+  HOOK_ID_POST_MESSAGE_IN,
+  HOOK_ID_MESSAGE_OUT,
+  HOOK_ID_MDR_RECEIVED,
+  HOOK_ID_STATUS_CHANGE,
+  HOOK_ID_MY_STATUS_CHANGE,
+  HOOK_ID_POST_CONNECT,
+  HOOK_ID_PRE_DISCONNECT,
+  HOOK_ID_UNREAD_LIST_CHANGE,
+  HOOK_ID_SUBSCRIPTION,
+};
+
 typedef enum {
   HOOK_HANDLER_RESULT_ALLOW_MORE_HANDLERS = 0,
   HOOK_HANDLER_RESULT_NO_MORE_HANDLER,
@@ -39,10 +54,37 @@ typedef struct {
 typedef guint (*hk_handler_t) (const gchar *hookname, hk_arg_t *args,
                                gpointer userdata);
 
+// Typed argument of the message hooks
+// (HOOK_PRE_MESSAGE_IN, HOOK_POST_MESSAGE_IN and HOOK_MESSAGE_OUT)
+typedef struct {
+  const char *jid;
+  const char *resource;   // NULL for outgoing messages
+  const char *message;    // Message body, converted to locale charset
+  time_t      delayed;    // Timestamp of a delayed message, or 0
+  gboolean    groupchat;
+  gboolean    attention;  // HOOK_POST_MESSAGE_IN only
+  gboolean    error;
+  gboolean    carbon;
+  // Highlighted words (our nickname, keywords) in a room message,
+  // HOOK_POST_MESSAGE_IN only.  The offsets are relative to message.
+  const hl_match_t *matches;
+  guint       nmatches;
+} hk_message_t;
+
+typedef guint (*hk_message_handler_t) (const gchar *hookname,
+                                       const hk_message_t *msg,
+                                       gpointer userdata);
+
+guint hk_hook_id(const gchar *hookname);
+gboolean hk_has_handlers(guint hookid);
 guint hk_add_handler(hk_handler_t handler, const gchar *hookname,
                      gint priority, gpointer userdata);
+guint hk_add_message_handler(hk_message_handler_t handler,
+                             const gchar *hookname, gint priority,
+                             gpointer userdata);
 void  hk_del_handler(const gchar *hookname, guint hid);
 guint hk_run_handlers(const gchar *hookname, hk_arg_t *args);
+guint hk_run_handlers_id(guint hookid, hk_arg_t *args);
 #endif
 
 void hk_message_in(const char *bjid, const char *resname,
@@ -0,0 +1,270 @@
+/*
+ * jobs.c       -- Background jobs (worker threads pool)
+ *
+ * Copyright (C) 2026 The mcabber authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "jobs.h"
+#include "settings.h"
+#include "logprint.h"
+#include "main.h"
+
+#define JOBS_DEFAULT_THREADS    2
+
+typedef struct {
+  gchar      *queue;    // Ordering queue name (case-folded), or NULL
+  job_func_t  func;
+  job_done_t  done;
+  gpointer    data;
+  gboolean    detached; // Not waited for at exit
+  gboolean    finished; // Only used from the main loop
+} job_t;
+
+static GThreadPool *jobs_pool;
+static gboolean     jobs_pool_ready;
+// Number of running jobs which must be waited for at exit
+static guint        jobs_running;
+static gboolean     jobs_stopping;
+static GMutex       jobs_lock;
+static GCond        jobs_cond;
+// Set in the worker threads once the signals have been blocked
+static GPrivate     jobs_thread_ready;
+// Hash table of ordering queues (GQueue of job_t, oldest first)
+static GHashTable  *jobs_queues;
+
+static void job_worker(gpointer data, gpointer user_data);
+
+//  jobs_get_pool()
+// Return the worker threads pool, or NULL if jobs must be run
+// synchronously.  The pool is created the first time it is needed,
+// with 'worker_threads' threads (0 disables the worker threads).
+static GThreadPool *jobs_get_pool(void)
+{
+  GError *error = NULL;
+  gint nthreads = JOBS_DEFAULT_THREADS;
+
+  if (jobs_pool_ready)
+    return jobs_pool;
+  jobs_pool_ready = TRUE;
+
+  if (settings_opt_get("worker_threads"))
+    nthreads = settings_opt_get_int("worker_threads");
+  if (nthreads <= 0)
+    return NULL;
+
+  jobs_pool = g_thread_pool_new(job_worker, NULL, nthreads, FALSE, &error);
+  if (!jobs_pool) {
+    scr_LogPrint(LPRINT_LOGNORM, "Cannot create worker threads: %s",
+                 error ? error->message : "unknown error");
+    if (error)
+      g_error_free(error);
+  }
+  return jobs_pool;
+}
+
+//  jobs_deinit()
+// Destroy the worker threads pool.  The jobs which haven't started yet are
+// dropped, and we wait for the running jobs, except the detached ones
+// (see job_submit_detached()) which are abandoned.
+// Pending completion functions are not called.
+void jobs_deinit(void)
+{
+  if (!jobs_pool)
+    return;
+
+  g_mutex_lock(&jobs_lock);
+  jobs_stopping = TRUE;
+  while (jobs_running)
+    g_cond_wait(&jobs_cond, &jobs_lock);
+  g_mutex_unlock(&jobs_lock);
+
+  g_thread_pool_free(jobs_pool, TRUE, FALSE);
+  jobs_pool = NULL;
+}
+
+static void job_deliver(job_t *job)
+{
+  if (job->done)
+    job->done(job->data);
+  g_free(job->queue);
+  g_free(job);
+}
+
+//  jobs_flush(queue)
+// Deliver the finished jobs at the head of the queue.
+static void jobs_flush(const gchar *queue)
+{
+  GQueue *q;
+  job_t *job;
+
+  while (jobs_queues && (q = g_hash_table_lookup(jobs_queues, queue))) {
+    job = g_queue_peek_head(q);
+    if (!job->finished)
+      return;
+    g_queue_pop_head(q);
+    if (g_queue_is_empty(q))
+      g_hash_table_remove(jobs_queues, queue);
+    // Note: the completion function may submit new jobs.
+    job_deliver(job);
+  }
+}
+
+//  job_complete(job)
+// Mark the job as finished.  The completion function is called
+// once all the previous jobs of the same queue have been delivered.
+static void job_complete(job_t *job)
+{
+  gchar *queue;
+
+  job->finished = TRUE;
+
+  if (!job->queue) {
+    job_deliver(job);
+    return;
+  }
+
+  queue = g_strdup(job->queue);
+  jobs_flush(queue);
+  g_free(queue);
+}
+
+static gboolean job_complete_cb(gpointer data)
+{
+  job_complete(data);
+  return FALSE;
+}
+
+static void job_worker(gpointer data, gpointer user_data)
+{
+  job_t *job = data;
+
+  if (!g_private_get(&jobs_thread_ready)) {
+    mcabber_block_signals();
+    g_private_set(&jobs_thread_ready, GINT_TO_POINTER(1));
+  }
+
+  g_mutex_lock(&jobs_lock);
+  if (jobs_stopping) {
+    g_mutex_unlock(&jobs_lock);
+    return;
+  }
+  if (!job->detached)
+    jobs_running++;
+  g_mutex_unlock(&jobs_lock);
+
+  job->func(job->data);
+
+  if (!job->detached) {
+    g_mutex_lock(&jobs_lock);
+    if (!--jobs_running)
+      g_cond_signal(&jobs_cond);
+    g_mutex_unlock(&jobs_lock);
+  }
+  // Back to the main loop
+  g_idle_add(job_complete_cb, job);
+}
+
+static void job_push(job_t *job)
+{
+  GThreadPool *pool = jobs_get_pool();
+  GError *error = NULL;
+
+  if (!pool) {
+    job->func(job->data);
+    job_complete(job);
+    return;
+  }
+
+  // If no thread can be spawned, the job stays in the pool queue
+  // until a thread becomes available.
+  g_thread_pool_push(pool, job, &error);
+  if (error) {
+    scr_LogPrint(LPRINT_DEBUG, "Worker threads: %s", error->message);
+    g_error_free(error);
+  }
+}
+
+//  job_submit(queue, func, done, data)
+// Run func(data) in a worker thread, then done(data) in the main loop.
+// Jobs submitted with the same queue name are delivered (i.e. their
+// completion function is called) in the order they were submitted.
+// func can be NULL; this can be used to run done(data) after all the
+// pending jobs of the queue.  If the worker threads are disabled, the
+// job is run synchronously.
+void job_submit(const char *queue, job_func_t func, job_done_t done,
+                gpointer data)
+{
+  job_t *job = g_new0(job_t, 1);
+
+  job->func = func;
+  job->done = done;
+  job->data = data;
+
+  if (queue) {
+    GQueue *q;
+
+    if (!jobs_queues)
+      jobs_queues = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify)g_queue_free);
+    job->queue = g_utf8_strdown(queue, -1);
+    q = g_hash_table_lookup(jobs_queues, job->queue);
+    if (!q) {
+      q = g_queue_new();
+      g_hash_table_insert(jobs_queues, g_strdup(job->queue), q);
+    }
+    g_queue_push_tail(q, job);
+  }
+
+  if (!func) {
+    job_complete(job);
+    return;
+  }
+  job_push(job);
+}
+
+//  job_submit_detached(func, done, data)
+// Like job_submit() without queue, for long computations which cannot be
+// interrupted: mcabber doesn't wait for a detached job when it exits.
+void job_submit_detached(job_func_t func, job_done_t done, gpointer data)
+{
+  job_t *job = g_new0(job_t, 1);
+
+  job->func = func;
+  job->done = done;
+  job->data = data;
+  job->detached = TRUE;
+  job_push(job);
+}
+
+//  job_queue_pending(queue)
+// Return TRUE if some jobs of the queue haven't been delivered yet.
+gboolean job_queue_pending(const char *queue)
+{
+  gchar *q;
+  gboolean pending;
+
+  if (!jobs_queues || !queue)
+    return FALSE;
+
+  q = g_utf8_strdown(queue, -1);
+  pending = (g_hash_table_lookup(jobs_queues, q) != NULL);
+  g_free(q);
+  return pending;
+}
+
+/* vim: set expandtab cindent cinoptions=>2\:2(0 sw=2 ts=2:  For Vim users... */
@@ -0,0 +1,21 @@
+#ifndef __MCABBER_JOBS_H__
+#define __MCABBER_JOBS_H__ 1
+
+#include <glib.h>
+
+// A job function is run in a worker thread; it must not use the UI,
+// the roster or the connection.
+typedef void (*job_func_t)(gpointer data);
+// A job completion function is run in the main loop.
+typedef void (*job_done_t)(gpointer data);
+
+void     jobs_deinit(void);
+void     job_submit(const char *queue, job_func_t func, job_done_t done,
+                    gpointer data);
+void     job_submit_detached(job_func_t func, job_done_t done,
+                             gpointer data);
+gboolean job_queue_pending(const char *queue);
+
+#endif /* __MCABBER_JOBS_H__ */
+
+/* vim: set expandtab cindent cinoptions=>2\:2(0 sw=2 ts=2:  For Vim users... */
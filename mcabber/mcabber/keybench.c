@@ -0,0 +1,99 @@
+/*
+ * keybench.c   -- Key sequence decoding benchmark
+ *
+ * Copyright (C) 2026 The mcabber authors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This program decodes a stream of escape key sequences with the key
+ * sequences trie, the way scr_getch() does (one lookup per input byte),
+ * and measures the throughput.  It is not installed.
+ *
+ * Usage: keybench [-n sequences]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "screen.h"
+#include "screen_internal.h"
+
+// Escape sequences (without ESC), most of them sent by usual terminals
+static const char *sequences[] = {
+  "[A", "[B", "[C", "[D", "OA", "OB", "OC", "OD",
+  "[1;5A", "[1;5B", "[1;5C", "[1;5D", "[1;2A", "[1;2B",
+  "[5~", "[6~", "[3~", "[2~", "[5;5~", "[6;5~", "[3;5~",
+  "O5A", "O5D", "[5^", "[6^", "[8@", "[200~", "[201~",
+  "x", "[99~", "[1;9Z", "O9",   // Unknown sequences
+};
+
+int main(int argc, char **argv)
+{
+  guint nseq = 5000000, nmatch = 0, nlookups = 0;
+  gsize nbytes = 0;
+  guint i, len, mkeycode;
+  gint value, match;
+  char buf[16];
+  const char *seq;
+  gint64 start;
+  double t;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:")) != -1) {
+    switch (c) {
+    case 'n':
+      nseq = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n sequences]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (!nseq) {
+    fprintf(stderr, "Usage: %s [-n sequences]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // Register the key sequences and build the trie
+  scr_match_keyseq("", &mkeycode, &value);
+
+  start = g_get_monotonic_time();
+  for (i = 0; i < nseq; i++) {
+    seq = sequences[i % G_N_ELEMENTS(sequences)];
+    // Feed the sequence one byte at a time, until it is decoded
+    match = 0;
+    for (len = 0; seq[len] && !match; len++) {
+      buf[len] = seq[len];
+      buf[len+1] = 0;
+      match = scr_match_keyseq(buf, &mkeycode, &value);
+      nlookups++;
+    }
+    nbytes += len;
+    if (match > 0)
+      nmatch++;
+  }
+  t = (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC;
+
+  printf("%u sequences (%u matches), %u lookups, %lu bytes in %.3fs\n",
+         nseq, nmatch, nlookups, (unsigned long)nbytes, t);
+  printf("%.1f ns/sequence, %.1f ns/lookup, %.2f MB/s\n",
+         t * 1e9 / nseq, t * 1e9 / nlookups, nbytes / t / 1e6);
+  return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab cindent cinoptions=>2\:2(0 sw=2 ts=2:  For Vim users... */
@@ -15,6 +15,7 @@
 void scr_print_logwindow(const char *string);
 void scr_log_print(unsigned int flag, const char *fmt, ...) G_GNUC_PRINTF (2, 3);
 void scr_do_update(void);
+void scr_log_capture(GString *buffer, gboolean hide);
 
 // For backward compatibility:
 #define scr_LogPrint    scr_log_print
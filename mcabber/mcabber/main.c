@@ -29,6 +29,7 @@
 #include <config.h>
 #include <poll.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "caps.h"
 #include "screen.h"
@@ -37,11 +38,13 @@
 #include "commands.h"
 #include "histolog.h"
 #include "hooks.h"
+#include "jobs.h"
 #include "utils.h"
 #include "pgp.h"
 #include "otr.h"
 #include "xmpp.h"
 #include "help.h"
+#include "highlight.h"
 #include "events.h"
 #include "compl.h"
 
@@ -65,6 +68,10 @@
 void sigwinch_resize(void);
 static bool sigwinch;
 #endif
+// Signals handled in the main loop (see sig_pipe_cb())
+static volatile sig_atomic_t sigusr1, sigterm;
+static int  sig_pipe[2] = { -1, -1 };
+static bool sig_deferred;  // TRUE when sig_pipe_cb() is installed
 
 static bool terminate_ui;
 GMainContext *main_context;
@@ -89,6 +96,10 @@ static void mcabber_terminate(const char *msg)
 #endif
   xmpp_disconnect();
   scr_terminate_curses();
+  // If the signals aren't deferred, we can be called from a signal handler
+  // which might have interrupted a trace log write: the log isn't flushed.
+  if (sig_deferred)
+    ut_deinit_debug();
 
   // Restore term settings, if needed.
   if (backup_termios)
@@ -100,6 +111,64 @@ static void mcabber_terminate(const char *msg)
   exit(EXIT_SUCCESS);
 }
 
+static const char *sig_term_message(int signum)
+{
+  if (signum == SIGINT)
+    return "Killed by SIGINT";
+  if (signum == SIGHUP)
+    return "Killed by SIGHUP";
+  return "Killed by SIGTERM";
+}
+
+//  sig_wakeup()
+// Wake the main loop up (async-signal-safe).
+static void sig_wakeup(void)
+{
+  int saved_errno = errno;
+  if (sig_pipe[1] != -1 && write(sig_pipe[1], "", 1) < 0)
+    ; // The pipe is full, the main loop will wake up anyway
+  errno = saved_errno;
+}
+
+//  sig_pipe_cb()
+// Process the signals caught by sig_handler() from the main loop.
+static gboolean sig_pipe_cb(GIOChannel *channel, GIOCondition condition,
+                            gpointer data)
+{
+  char buf[16];
+
+  while (read(sig_pipe[0], buf, sizeof(buf)) > 0)
+    ;
+  if (sigterm)
+    mcabber_terminate(sig_term_message(sigterm));
+  if (sigusr1) {
+    // Flush (and reopen) the trace log
+    sigusr1 = FALSE;
+    ut_flush_log(TRUE);
+  }
+  return TRUE;
+}
+
+//  mcabber_block_signals()
+// Block the signals handled by mcabber in the calling thread.  This should
+// be called by the worker threads, so that the signals are delivered to
+// the main thread.
+void mcabber_block_signals(void)
+{
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGHUP);
+  sigaddset(&set, SIGCHLD);
+  sigaddset(&set, SIGUSR1);
+#ifdef USE_SIGWINCH
+  sigaddset(&set, SIGWINCH);
+#endif
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
 void sig_handler(int signum)
 {
   if (signum == SIGCHLD) {
@@ -118,16 +187,22 @@ void sig_handler(int signum)
       }
     } while (pid > 0);
     signal(SIGCHLD, sig_handler);
-  } else if (signum == SIGTERM) {
-    mcabber_terminate("Killed by SIGTERM");
-  } else if (signum == SIGINT) {
-    mcabber_terminate("Killed by SIGINT");
-  } else if (signum == SIGHUP) {
-    mcabber_terminate("Killed by SIGHUP");
+  } else if (signum == SIGTERM || signum == SIGINT || signum == SIGHUP) {
+    // Once the main loop is running, we must not clean up from the signal
+    // handler (locks could be held).  sig_pipe_cb() will do it.
+    if (sig_deferred) {
+      sigterm = signum;
+      sig_wakeup();
+    } else {
+      mcabber_terminate(sig_term_message(signum));
+    }
 #ifdef USE_SIGWINCH
   } else if (signum == SIGWINCH) {
     sigwinch = TRUE;
 #endif
+  } else if (signum == SIGUSR1) {
+    sigusr1 = TRUE;
+    sig_wakeup();
   } else {
     scr_LogPrint(LPRINT_LOGNORM, "Caught signal: %d", signum);
   }
@@ -367,6 +442,9 @@ static gboolean keyboard_activity(void)
     scr_process_key(kcode);
     scr_getch(&kcode);
   }
+  scr_input_flush();
+  // Don't delay the echo of the user input
+  scr_frame_force();
   scr_check_auto_away(FALSE);
 
   return TRUE;
@@ -395,6 +473,16 @@ int main(int argc, char **argv)
 
   credits();
 
+  if (!pipe(sig_pipe)) {
+    int i;
+    for (i = 0; i < 2; i++) {
+      fcntl(sig_pipe[i], F_SETFL, O_NONBLOCK);
+      fcntl(sig_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+  } else {
+    sig_pipe[0] = sig_pipe[1] = -1;
+  }
+
   signal(SIGTERM, sig_handler);
   signal(SIGINT,  sig_handler);
   signal(SIGHUP,  sig_handler);
@@ -402,6 +490,7 @@ int main(int argc, char **argv)
 #ifdef USE_SIGWINCH
   signal(SIGWINCH, sig_handler);
 #endif
+  signal(SIGUSR1, sig_handler);
   signal(SIGPIPE, SIG_IGN);
 
   /* Parse command line options */
@@ -444,6 +533,7 @@ int main(int argc, char **argv)
   scr_init_locale_charset();
   ut_init_debug();
   help_init();
+  hl_init();
 
   /* Parsing config file... */
   ret = cfg_read_file(configFile, TRUE);
@@ -539,8 +629,8 @@ int main(int argc, char **argv)
   }
 
   // Initial drawing
-  scr_draw_roster();
-  scr_do_update();
+  scr_frame_force();
+  scr_frame_render();
 
   { // add keypress processing source
     GSource *mc_source = g_source_new(&mcabber_source_funcs,
@@ -552,6 +642,14 @@ int main(int argc, char **argv)
     g_source_add_poll(mc_source, mc_pollfd);
     g_source_attach(mc_source, main_context);
 
+    // From now on, the signals are processed in the main loop
+    if (sig_pipe[0] != -1) {
+      GIOChannel *channel = g_io_channel_unix_new(sig_pipe[0]);
+      g_io_add_watch(channel, G_IO_IN, sig_pipe_cb, NULL);
+      g_io_channel_unref(channel);
+      sig_deferred = TRUE;
+    }
+
     scr_LogPrint(LPRINT_DEBUG, "Entering into main loop...");
 
     while(!terminate_ui) {
@@ -563,8 +661,7 @@ int main(int argc, char **argv)
         sigwinch = FALSE;
       }
 #endif
-      scr_draw_roster();
-      scr_do_update();
+      scr_frame_render();
     }
 
     g_source_destroy(mc_source);
@@ -582,6 +679,9 @@ int main(int argc, char **argv)
   otr_terminate();
 #endif
   xmpp_disconnect();
+  xmpp_msg_dedup_free();
+  jobs_deinit();
+  hl_deinit();
 #ifdef HAVE_GPGME
   gpg_terminate();
 #endif
@@ -595,6 +695,7 @@ int main(int argc, char **argv)
   /* Save pending message state */
   hlog_save_state();
   caps_free();
+  ut_deinit_debug();
   settings_free();
 
   printf("\n\nThanks for using mcabber!\n");
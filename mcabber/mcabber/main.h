@@ -4,6 +4,7 @@
 extern GMainContext *main_context;
 
 void mcabber_set_terminate_ui(void);
+void mcabber_block_signals(void);
 char *mcabber_version(void);
 
 #endif
@@ -26,10 +26,47 @@
 #include "modules.h"
 #include "screen.h"
 #include "utils.h"
+#include "jobs.h"
+
+// Maximum number of undelivered jobs per module
+#define MODULE_JOBS_MAX   64
 
 // Registry of loaded modules
 GSList *loaded_modules = NULL;
 
+typedef enum {
+  MJOB_QUEUED,
+  MJOB_RUNNING,
+  MJOB_FINISHED,
+  MJOB_CANCELLED
+} module_job_state_t;
+
+// Background jobs of a module
+// The counters (and the job states) are protected by module_jobs_lock.
+typedef struct {
+  GList  *jobs;         // Undelivered jobs (main loop only)
+  guint   queued;
+  guint   running;
+  guint   done;         // Delivered jobs (main loop only)
+  gint64  usecs;        // Time spent in the job functions
+} module_jobs_t;
+
+typedef struct {
+  module_jobs_t      *owner;
+  GList              *link;     // Link in owner->jobs
+  module_job_state_t  state;
+  module_job_func_t   func;
+  module_job_done_t   done;
+  gpointer            data;
+  GDestroyNotify      destroy;
+} module_job_t;
+
+// Hash table of module_jobs_t, by module name.  The entries are kept
+// when the module is unloaded, as cancelled jobs can still refer to them.
+static GHashTable *module_jobs;
+static GMutex      module_jobs_lock;
+static GCond       module_jobs_cond;
+
 const gchar *mcabber_branch = MCABBER_BRANCH;
 const guint mcabber_api_version = MCABBER_API_VERSION;
 
@@ -237,6 +274,9 @@ const gchar *module_unload(const gchar *arg, gboolean manual, gboolean force)
 
   info = module->info;
 
+  // The module code must not be used by the worker threads anymore
+  module_jobs_cancel(module->name);
+
   // Run uninitialization routine
   if (info && info->uninit)
     info->uninit();
@@ -399,11 +439,166 @@ void module_info_print(const gchar *name)
     if (info->description)
       scr_LogPrint(LPRINT_NORMAL, " Description: %s", info->description);
   }
+
+  if (module_jobs) {
+    module_jobs_t *mj = g_hash_table_lookup(module_jobs, module->name);
+    if (mj) {
+      g_mutex_lock(&module_jobs_lock);
+      scr_LogPrint(LPRINT_NORMAL, " Jobs: %u queued, %u running, %u done "
+                   "(%.3fs)", mj->queued, mj->running, mj->done,
+                   mj->usecs / 1e6);
+      g_mutex_unlock(&module_jobs_lock);
+    }
+  }
   scr_setmsgflag_if_needed(SPECIAL_BUFFER_STATUS_ID, TRUE);
   scr_setattentionflag_if_needed(SPECIAL_BUFFER_STATUS_ID, TRUE,
                                  ROSTER_UI_PRIO_STATUS_WIN_MESSAGE, prio_max);
 }
 
+// Worker thread side of the module jobs (see job_submit())
+static void module_job_run(gpointer data)
+{
+  module_job_t *job = data;
+  module_jobs_t *mj = job->owner;
+  gint64 start;
+
+  g_mutex_lock(&module_jobs_lock);
+  if (job->state != MJOB_QUEUED) {
+    g_mutex_unlock(&module_jobs_lock);
+    return;
+  }
+  job->state = MJOB_RUNNING;
+  mj->queued--;
+  mj->running++;
+  g_mutex_unlock(&module_jobs_lock);
+
+  start = g_get_monotonic_time();
+  job->func(job->data);
+
+  g_mutex_lock(&module_jobs_lock);
+  mj->usecs += g_get_monotonic_time() - start;
+  mj->running--;
+  job->state = MJOB_FINISHED;
+  g_cond_broadcast(&module_jobs_cond);
+  g_mutex_unlock(&module_jobs_lock);
+}
+
+static void module_job_deliver(gpointer data)
+{
+  module_job_t *job = data;
+  module_jobs_t *mj = job->owner;
+  gboolean cancelled;
+
+  g_mutex_lock(&module_jobs_lock);
+  cancelled = (job->state == MJOB_CANCELLED);
+  g_mutex_unlock(&module_jobs_lock);
+
+  if (!cancelled) {
+    mj->jobs = g_list_delete_link(mj->jobs, job->link);
+    mj->done++;
+    if (job->done)
+      job->done(job->data);
+    if (job->destroy)
+      job->destroy(job->data);
+  }
+  g_free(job);
+}
+
+//  module_job_submit(modulename, func, done, data, destroy)
+// Run func(data) in a worker thread of the shared pool, then done(data)
+// and destroy(data) in the main loop.  func and done can be NULL.
+// modulename must be the name of the loaded module submitting the job;
+// the jobs of a module are cancelled before it is unloaded.
+// Returns FALSE if the job cannot be queued (unknown module, or too many
+// pending jobs); in this case nothing is called.
+// If the worker threads are disabled, the job is run synchronously.
+gboolean module_job_submit(const gchar *name, module_job_func_t func,
+                           module_job_done_t done, gpointer data,
+                           GDestroyNotify destroy)
+{
+  module_jobs_t *mj;
+  module_job_t *job;
+
+  if (!name || !g_slist_find_custom(loaded_modules, name,
+                                    module_list_comparator))
+    return FALSE;
+
+  if (!module_jobs)
+    module_jobs = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                        g_free, g_free);
+  mj = g_hash_table_lookup(module_jobs, name);
+  if (!mj) {
+    mj = g_new0(module_jobs_t, 1);
+    g_hash_table_insert(module_jobs, g_strdup(name), mj);
+  }
+
+  if (g_list_length(mj->jobs) >= MODULE_JOBS_MAX)
+    return FALSE;
+
+  job = g_new0(module_job_t, 1);
+  job->owner   = mj;
+  job->func    = func;
+  job->done    = done;
+  job->data    = data;
+  job->destroy = destroy;
+
+  mj->jobs = g_list_prepend(mj->jobs, job);
+  job->link = mj->jobs;
+
+  g_mutex_lock(&module_jobs_lock);
+  if (func) {
+    job->state = MJOB_QUEUED;
+    mj->queued++;
+  } else {
+    job->state = MJOB_FINISHED;
+  }
+  g_mutex_unlock(&module_jobs_lock);
+
+  job_submit(NULL, func ? module_job_run : NULL, module_job_deliver, job);
+  return TRUE;
+}
+
+//  module_jobs_cancel(modulename)
+// Cancel the pending jobs of the module: the queued jobs will not be run,
+// and no completion function will be called.  Waits for the running jobs.
+// The destroy functions are called before returning.
+void module_jobs_cancel(const gchar *name)
+{
+  module_jobs_t *mj;
+  GList *jobs, *el;
+
+  if (!module_jobs || !name)
+    return;
+  mj = g_hash_table_lookup(module_jobs, name);
+  if (!mj || !mj->jobs)
+    return;
+
+  g_mutex_lock(&module_jobs_lock);
+  for (el = mj->jobs; el; el = el->next) {
+    module_job_t *job = el->data;
+    if (job->state == MJOB_QUEUED)
+      job->state = MJOB_CANCELLED;
+  }
+  mj->queued = 0;
+  while (mj->running)
+    g_cond_wait(&module_jobs_cond, &module_jobs_lock);
+  for (el = mj->jobs; el; el = el->next) {
+    module_job_t *job = el->data;
+    job->state = MJOB_CANCELLED;
+  }
+  g_mutex_unlock(&module_jobs_lock);
+
+  // The cancelled jobs are freed by module_job_deliver()
+  jobs = mj->jobs;
+  mj->jobs = NULL;
+  for (el = jobs; el; el = el->next) {
+    module_job_t *job = el->data;
+    if (job->destroy)
+      job->destroy(job->data);
+  }
+  g_list_free(jobs);
+}
+
 //  modules_init()
 // Initializes module system.
 void modules_init(void)
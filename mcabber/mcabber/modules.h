@@ -38,6 +38,18 @@ struct module_info_struct {
 const gchar *module_load(const gchar *name, gboolean manual, gboolean force);
 const gchar *module_unload(const gchar *name, gboolean manual, gboolean force);
 
+// Background jobs
+// The job function is run in a worker thread, it must not use the UI,
+// the roster or the connection.  The completion function and the destroy
+// function are run in the main loop.
+typedef void (*module_job_func_t)(gpointer data);
+typedef void (*module_job_done_t)(gpointer data);
+
+gboolean module_job_submit(const gchar *name, module_job_func_t func,
+                           module_job_done_t done, gpointer data,
+                           GDestroyNotify destroy);
+void module_jobs_cancel(const gchar *name);
+
 // Grey zone (these symbols are semi-private and are exposed only for compatibility modules)
 
 // Information about loaded module
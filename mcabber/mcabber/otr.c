@@ -23,6 +23,7 @@
 #ifdef HAVE_LIBOTR
 
 #include "hbuf.h"
+#include "jobs.h"
 #include "logprint.h"
 #include "nohtml.h"
 #include "otr.h"
@@ -40,9 +41,22 @@ static char *keyfile = NULL;
 static char *fprfile = NULL;
 static char *tagfile = NULL;
 static guint otr_timer_source = 0;
+static guint otr_fpr_source = 0;
 
 static int otr_is_enabled = FALSE;
 
+// Private key generation (done in a worker thread)
+typedef struct {
+  void *newkey;
+  gcry_error_t err;
+} otr_keygen_t;
+
+static otr_keygen_t *otr_keygen = NULL;
+// Buddies whose OTR session is waiting for our private key
+static GSList *otr_keygen_buddies = NULL;
+// Buddy of the current libotr call (used by cb_create_privkey)
+static const char *otr_current_buddy = NULL;
+
 static OtrlPolicy cb_policy             (void *opdata, ConnContext *ctx);
 static void       cb_create_privkey     (void *opdata,
                                          const char *accountname,
@@ -110,6 +124,7 @@ static OtrlMessageAppOps ops =
 static void otr_message_disconnect(ConnContext *ctx);
 static ConnContext *otr_get_context(const char *buddy);
 static void otr_startstop(const char *buddy, int start);
+static void otr_fpr_flush(void);
 
 static char *otr_get_dir(void);
 
@@ -169,6 +184,12 @@ void otr_terminate(void)
     if (ctx->msgstate == OTRL_MSGSTATE_ENCRYPTED)
       otr_message_disconnect(ctx);
 
+  // Write pending fingerprint changes
+  otr_fpr_flush();
+
+  g_slist_free_full(otr_keygen_buddies, g_free);
+  otr_keygen_buddies = NULL;
+
   g_free(account);
   account = NULL;
 
@@ -181,7 +202,11 @@ void otr_terminate(void)
 #if defined(HAVE_GNUTLS) && !defined(HAVE_OPENSSL) // TODO: broken now
   if (!settings_opt_get_int("ssl"))
 #endif
-  otrl_userstate_free(userstate);
+  // A running key generation cannot be interrupted, and the pending key
+  // belongs to the userstate.  In this case the userstate is leaked.
+  if (!otr_keygen)
+    otrl_userstate_free(userstate);
+  otr_keygen = NULL;
 
   userstate = NULL;
   g_free(keyfile);
@@ -439,10 +464,12 @@ int otr_receive(char **otr_data, const char *buddy, int *free_msg)
   if (!ctx)
     return 0;
 
+  otr_current_buddy = ctx->username;
   ignore_message = otrl_message_receiving(userstate, &ops, NULL,
                                           ctx->accountname, ctx->protocol,
                                           ctx->username, *otr_data,
                                           &newmessage, &tlvs, NULL, NULL, NULL);
+  otr_current_buddy = NULL;
 
   tlv = otrl_tlv_find(tlvs, OTRL_TLV_DISCONNECTED);
   if (tlv) {
@@ -489,6 +516,7 @@ char *otr_send(const char *msg, const char *buddy, int *encryption_status)
   if (!buddy || !msg || !msg[0])
     return NULL;
 
+  otr_current_buddy = ctx->username;
   if (ctx->msgstate == OTRL_MSGSTATE_PLAINTEXT)
     err = otrl_message_sending(userstate, &ops, NULL, ctx->accountname,
                                // INSTAG XXX
@@ -502,6 +530,7 @@ char *otr_send(const char *msg, const char *buddy, int *encryption_status)
                                msg, NULL, &newmessage, OTRL_FRAGMENT_SEND_SKIP,
                                NULL, NULL, NULL);
   }
+  otr_current_buddy = NULL;
 
   if (err)
     return NULL; /* something went wrong, don't send the plain-message! */
@@ -697,29 +726,106 @@ static OtrlPolicy cb_policy(void *opdata, ConnContext *ctx)
   return OTRL_POLICY_MANUAL & ~OTRL_POLICY_ALLOW_V1;
 }
 
+/* Remember that the session with the current buddy has to be restarted
+ * when the private key is ready. */
+static void otr_keygen_add_buddy(void)
+{
+  if (otr_current_buddy &&
+      !g_slist_find_custom(otr_keygen_buddies, otr_current_buddy,
+                           (GCompareFunc)g_strcmp0))
+    otr_keygen_buddies = g_slist_append(otr_keygen_buddies,
+                                        g_strdup(otr_current_buddy));
+}
+
+/* Worker thread part of the private key generation. */
+static void otr_keygen_calculate(gpointer data)
+{
+  otr_keygen_t *kg = data;
+
+  kg->err = otrl_privkey_generate_calculate(kg->newkey);
+}
+
+/* Main loop part of the private key generation: store the new key and
+ * restart the OTR sessions that were waiting for it. */
+static void otr_keygen_finish(gpointer data)
+{
+  otr_keygen_t *kg = data;
+  GSList *buddies, *el;
+  gcry_error_t err;
+  char *root;
+
+  if (kg != otr_keygen) {
+    // otr_terminate() has been called in the meantime
+    g_free(kg);
+    return;
+  }
+  otr_keygen = NULL;
+
+  err = kg->err;
+  if (!err)
+    err = otrl_privkey_generate_finish(userstate, kg->newkey, keyfile);
+  else
+    otrl_privkey_generate_cancelled(userstate, kg->newkey);
+  g_free(kg);
+
+  buddies = otr_keygen_buddies;
+  otr_keygen_buddies = NULL;
+
+  if (err) {
+    root = otr_get_dir();
+    scr_LogPrint(LPRINT_LOGNORM, "OTR key generation failed! Please mkdir "
+                 "%s if you want to use otr encryption.", root);
+    g_free(root);
+    g_slist_free_full(buddies, g_free);
+    return;
+  }
+
+  scr_LogPrint(LPRINT_LOGNORM, "OTR key generated.");
+  for (el = buddies; el; el = g_slist_next(el)) {
+    scr_WriteIncomingMessage(el->data, "OTR: key generated, restarting the "
+                             "session", 0, HBB_PREFIX_INFO, 0);
+    otr_establish(el->data);
+  }
+  g_slist_free_full(buddies, g_free);
+}
+
 /* Create a private key for the given accountname/protocol if
- * desired. */
+ * desired.
+ * The key is generated in a worker thread; the OTR session that needed
+ * it (if any) is restarted when the key is ready. */
 static void cb_create_privkey(void *opdata, const char *accountname,
                               const char *protocol)
 {
   gcry_error_t e;
+  void *newkey = NULL;
   char *root;
 
-  scr_LogPrint(LPRINT_LOGNORM,
-               "Generating new OTR key for %s. This may take a while...",
-               accountname);
-  scr_do_update();
-
-  e = otrl_privkey_generate(userstate, keyfile, accountname, protocol);
+  e = otrl_privkey_generate_start(userstate, accountname, protocol, &newkey);
+  if (gcry_err_code(e) == GPG_ERR_EEXIST) {
+    // Key generation already in progress
+    otr_keygen_add_buddy();
+    return;
+  }
 
   if (e) {
     root = otr_get_dir();
     scr_LogPrint(LPRINT_LOGNORM, "OTR key generation failed! Please mkdir "
                  "%s if you want to use otr encryption.", root);
     g_free(root);
+    return;
   }
-  else
-    scr_LogPrint(LPRINT_LOGNORM, "OTR key generated.");
+
+  scr_LogPrint(LPRINT_LOGNORM,
+               "Generating new OTR key for %s in the background. "
+               "This may take a while...", accountname);
+
+  otr_keygen = g_new0(otr_keygen_t, 1);
+  otr_keygen->newkey = newkey;
+  job_submit_detached(otr_keygen_calculate, otr_keygen_finish, otr_keygen);
+
+  // If the worker threads are disabled, the key is already there.
+  if (otr_keygen)
+    otr_keygen_add_buddy();
 }
 
 /* Report whether you think the given user is online.  Return 1 if
@@ -768,12 +874,34 @@ static void cb_new_fingerprint(void *opdata, OtrlUserState us,
   g_free(sbuf);
 }
 
-/* The list of known fingerprints has changed.  Write them to disk. */
-static void cb_write_fingerprints(void *opdata)
+//  otr_fpr_flush()
+// Write the fingerprints file now if there are pending changes.
+static void otr_fpr_flush(void)
 {
+  if (!otr_fpr_source)
+    return;
+  g_source_remove(otr_fpr_source);
+  otr_fpr_source = 0;
   otrl_privkey_write_fingerprints(userstate, fprfile);
 }
 
+static gboolean otr_fpr_flush_cb(gpointer data)
+{
+  otr_fpr_source = 0;
+  if (userstate)
+    otrl_privkey_write_fingerprints(userstate, fprfile);
+  return FALSE;
+}
+
+/* The list of known fingerprints has changed.  Write them to disk.
+ * Several changes can happen while a message is processed, so the file
+ * is written once, when the main loop is idle. */
+static void cb_write_fingerprints(void *opdata)
+{
+  if (!otr_fpr_source)
+    otr_fpr_source = g_idle_add(otr_fpr_flush_cb, NULL);
+}
+
 /* A ConnContext has entered a secure state. */
 static void cb_gone_secure(void *opdata, ConnContext *context)
 {
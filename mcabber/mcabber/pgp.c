@@ -23,27 +23,64 @@
 #ifdef HAVE_GPGME
 
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 #include <locale.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <glib.h>
 
 #include "pgp.h"
+#include "jobs.h"
 #include "settings.h"
 #include "utils.h"
 #include "logprint.h"
 
 #define MIN_GPGME_VERSION "1.1.0"
 
+// Maximum number of entries in the signature verification cache
+#define GPG_VERIFY_CACHE_MAX  256
+
 static struct gpg_struct
 {
   int   enabled;
   int   version1;
   char *private_key;
   char *passphrase;
+  char *home;           // GnuPG home directory (keyrings)
 } gpg;
 
+// Signature verification cache
+// Contacts send the same signed status message with every presence
+// (each resource, priority changes, reconnections...), so we remember
+// the results of the last verifications.
+typedef struct {
+  char *keyid;
+  gpgme_sigsum_t sigsum;
+} gpg_verified_t;
+
+// The cache is emptied when one of these files is modified.
+static const char *gpg_keyring_files[] = {
+  "pubring.kbx", "pubring.gpg", "trustdb.gpg"
+};
+#define GPG_KEYRING_NFILES  G_N_ELEMENTS(gpg_keyring_files)
+
+static struct {
+  GHashTable *table;    // digest(signature, text) -> gpg_verified_t
+  struct {
+    gchar  *path;
+    time_t  mtime;
+    off_t   size;
+    ino_t   ino;
+  } files[GPG_KEYRING_NFILES];  // Keyring state when the cache was filled
+  time_t checked;       // Last time the files have been checked
+  guint hits, misses;
+} gpg_vcache;
+
+// The passphrase can be read by the worker threads (passphrase callback)
+G_LOCK_DEFINE_STATIC(gpg_passphrase);
+
 
 //  gpg_init(priv_key, passphrase)
 // Initialize the GPG sub-systems.  This function must be invoked early.
@@ -87,6 +124,15 @@ int gpg_init(const char *priv_key, const char *passphrase)
     if (err) return -1;
   }
 
+  // Remember where the keyrings are, to notice their modifications
+  g_free(gpg.home);
+  if (gpg_home)
+    gpg.home = expand_filename(gpg_home);
+  else if (g_getenv("GNUPGHOME"))
+    gpg.home = g_strdup(g_getenv("GNUPGHOME"));
+  else
+    gpg.home = g_build_filename(g_get_home_dir(), ".gnupg", NULL);
+
   // Store private data.
   gpg_set_private_key(priv_key);
   gpg_set_passphrase(passphrase);
@@ -128,15 +174,28 @@ int gpg_is_version1(void)
 // Destroy data and free memory.
 void gpg_terminate(void)
 {
+  guint i;
+
   gpg.enabled = 0;
   gpg_set_passphrase(NULL);
   gpg_set_private_key(NULL);
+  if (gpg_vcache.table)
+    g_hash_table_destroy(gpg_vcache.table);
+  gpg_vcache.table = NULL;
+  for (i = 0; i < GPG_KEYRING_NFILES; i++) {
+    g_free(gpg_vcache.files[i].path);
+    gpg_vcache.files[i].path = NULL;
+  }
+  gpg_vcache.checked = 0;
+  g_free(gpg.home);
+  gpg.home = NULL;
 }
 
 //  gpg_set_passphrase(passphrase)
 // Set the current passphrase (use NULL to erase it).
 void gpg_set_passphrase(const char *passphrase)
 {
+  G_LOCK(gpg_passphrase);
   // Remove current passphrase
   if (gpg.passphrase) {
     ssize_t len = strlen(gpg.passphrase);
@@ -150,6 +209,7 @@ void gpg_set_passphrase(const char *passphrase)
   } else {
     gpg.passphrase = NULL;
   }
+  G_UNLOCK(gpg_passphrase);
 }
 
 //  gpg_set_private_key(keyid)
@@ -211,9 +271,12 @@ static gpgme_error_t passphrase_cb(void *hook, const char *uid_hint,
                        const char *passphrase_info, int prev_was_bad, int fd)
 {
   ssize_t len;
+  gpgme_error_t err = 0;
 
+  G_LOCK(gpg_passphrase);
   // Abort if we do not have the password.
   if (!gpg.passphrase) {
+    G_UNLOCK(gpg_passphrase);
     ignore((void*)write(fd, "\n", 1)); // We have an error anyway, thus it does
                                        // not matter if we fail again.
     return gpg_error(GPG_ERR_CANCELED);
@@ -221,21 +284,153 @@ static gpgme_error_t passphrase_cb(void *hook, const char *uid_hint,
 
   // Write the passphrase to the file descriptor.
   len = strlen(gpg.passphrase);
-  if (write(fd, gpg.passphrase, len) != len)
-    return gpg_error(GPG_ERR_CANCELED);
-  if (write(fd, "\n", 1) != 1)
-    return gpg_error(GPG_ERR_CANCELED);
+  if (write(fd, gpg.passphrase, len) != len ||
+      write(fd, "\n", 1) != 1)
+    err = gpg_error(GPG_ERR_CANCELED);
+  G_UNLOCK(gpg_passphrase);
 
-  return 0; // Success
+  return err; // 0 is success
 }
 
-//  gpg_verify(gpg_data, text, *sigsum)
-// Verify that gpg_data is a correct signature for text.
-// Return the key id (or fingerprint), and set *sigsum to
-// the gpgme signature summary value.
+//  gpg_error_add(errors, fmt...)
+// Append an error message to the errors list.
+// The GPGME operations can be run in worker threads, so they can't
+// display their errors directly.
+static void gpg_error_add(GSList **errors, const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  *errors = g_slist_append(*errors, g_strdup_vprintf(fmt, ap));
+  va_end(ap);
+}
+
+//  gpg_errors_print(errors)
+// Display and free the error messages list.
+static void gpg_errors_print(GSList *errors)
+{
+  GSList *el;
+
+  for (el = errors; el; el = g_slist_next(el))
+    scr_LogPrint(LPRINT_LOGNORM|LPRINT_NOTUTF8, "%s", (char*)el->data);
+  g_slist_free_full(errors, g_free);
+}
+
+//  gpg_keyring_changed()
+// Return TRUE if the public keyring or the trust database has been
+// modified since the last call.  The files are checked at most once
+// per second.
+static gboolean gpg_keyring_changed(void)
+{
+  time_t now = time(NULL);
+  gboolean changed = FALSE;
+  guint i;
+
+  if (!gpg.home || now == gpg_vcache.checked)
+    return FALSE;
+  gpg_vcache.checked = now;
+
+  for (i = 0; i < GPG_KEYRING_NFILES; i++) {
+    struct stat buf;
+
+    if (!gpg_vcache.files[i].path)
+      gpg_vcache.files[i].path = g_build_filename(gpg.home,
+                                                  gpg_keyring_files[i], NULL);
+    if (stat(gpg_vcache.files[i].path, &buf))
+      memset(&buf, 0, sizeof(buf));
+    if (buf.st_mtime != gpg_vcache.files[i].mtime ||
+        buf.st_size  != gpg_vcache.files[i].size  ||
+        buf.st_ino   != gpg_vcache.files[i].ino) {
+      gpg_vcache.files[i].mtime = buf.st_mtime;
+      gpg_vcache.files[i].size  = buf.st_size;
+      gpg_vcache.files[i].ino   = buf.st_ino;
+      changed = TRUE;
+    }
+  }
+  return changed;
+}
+
+static void gpg_verified_free(gpg_verified_t *v)
+{
+  g_free(v->keyid);
+  g_free(v);
+}
+
+//  gpg_vcache_digest(signature, text)
+// Return the cache key for the signature of text.
 // The returned string must be freed with g_free() after use.
-char *gpg_verify(const char *gpg_data, const char *text,
-                 gpgme_sigsum_t *sigsum)
+static gchar *gpg_vcache_digest(const char *signature, const char *text)
+{
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+  gchar *digest;
+
+  // Include the trailing null byte as a separator
+  g_checksum_update(checksum, (const guchar*)signature, strlen(signature)+1);
+  g_checksum_update(checksum, (const guchar*)text, strlen(text));
+  digest = g_strdup(g_checksum_get_string(checksum));
+  g_checksum_free(checksum);
+  return digest;
+}
+
+//  gpg_vcache_lookup(digest)
+// Return the cached verification result, or NULL.
+// The cache is emptied if the keyring has been modified.
+// This function must be called from the main thread.
+static const gpg_verified_t *gpg_vcache_lookup(const gchar *digest)
+{
+  gpg_verified_t *v = NULL;
+
+  if (gpg_keyring_changed() && gpg_vcache.table) {
+    scr_LogPrint(LPRINT_DEBUG, "PGP: keyring modified, %u cached signature "
+                 "verifications dropped.", g_hash_table_size(gpg_vcache.table));
+    g_hash_table_remove_all(gpg_vcache.table);
+  } else if (gpg_vcache.table) {
+    v = g_hash_table_lookup(gpg_vcache.table, digest);
+  }
+
+  if (v)
+    gpg_vcache.hits++;
+  else
+    gpg_vcache.misses++;
+  return v;
+}
+
+//  gpg_vcache_store(digest, keyid, sigsum)
+// Store a verification result.
+// This function must be called from the main thread.
+static void gpg_vcache_store(const gchar *digest, const char *keyid,
+                             gpgme_sigsum_t sigsum)
+{
+  gpg_verified_t *v;
+
+  if (!gpg_vcache.table)
+    gpg_vcache.table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify)gpg_verified_free);
+  else if (g_hash_table_size(gpg_vcache.table) >= GPG_VERIFY_CACHE_MAX) {
+    scr_LogPrint(LPRINT_DEBUG, "PGP: signature verification cache full "
+                 "(%u hits, %u misses), emptied.", gpg_vcache.hits,
+                 gpg_vcache.misses);
+    g_hash_table_remove_all(gpg_vcache.table);
+  }
+
+  v = g_new(gpg_verified_t, 1);
+  v->keyid = g_strdup(keyid);
+  v->sigsum = sigsum;
+  g_hash_table_replace(gpg_vcache.table, g_strdup(digest), v);
+}
+
+//  gpg_verify_cache_stats(*hits, *misses)
+// Get the signature verification cache statistics.
+void gpg_verify_cache_stats(guint *hits, guint *misses)
+{
+  if (hits)
+    *hits = gpg_vcache.hits;
+  if (misses)
+    *misses = gpg_vcache.misses;
+}
+
+static char *_gpg_verify(const char *gpg_data, const char *text,
+                         gpgme_sigsum_t *sigsum, GSList **errors)
 {
   gpgme_ctx_t ctx;
   gpgme_data_t data_sign, data_text;
@@ -249,13 +444,9 @@ char *gpg_verify(const char *gpg_data, const char *text,
   // Reset the summary.
   *sigsum = 0;
 
-  if (!gpg.enabled)
-    return NULL;
-
   err = gpgme_new(&ctx);
   if (err) {
-    scr_LogPrint(LPRINT_LOGNORM|LPRINT_NOTUTF8,
-                 "GPGME error: %s", gpgme_strerror(err));
+    gpg_error_add(errors, "GPGME error: %s", gpgme_strerror(err));
     return NULL;
   }
 
@@ -300,17 +491,50 @@ char *gpg_verify(const char *gpg_data, const char *text,
     gpgme_data_release(data_sign);
   }
   if (err)
-    scr_LogPrint(LPRINT_LOGNORM|LPRINT_NOTUTF8,
-                 "GPGME verification error: %s", gpgme_strerror(err));
+    gpg_error_add(errors, "GPGME verification error: %s",
+                  gpgme_strerror(err));
   gpgme_release(ctx);
   g_free(data);
   return verified_key;
 }
 
-//  gpg_sign(gpg_data)
-// Return a signature of gpg_data (or NULL).
+//  gpg_verify(gpg_data, text, *sigsum)
+// Verify that gpg_data is a correct signature for text.
+// Return the key id (or fingerprint), and set *sigsum to
+// the gpgme signature summary value.
 // The returned string must be freed with g_free() after use.
-char *gpg_sign(const char *gpg_data)
+char *gpg_verify(const char *gpg_data, const char *text,
+                 gpgme_sigsum_t *sigsum)
+{
+  GSList *errors = NULL;
+  const gpg_verified_t *v;
+  gchar *digest;
+  char *verified_key;
+
+  if (!gpg.enabled) {
+    *sigsum = 0;
+    return NULL;
+  }
+
+  digest = gpg_vcache_digest(gpg_data, text);
+  v = gpg_vcache_lookup(digest);
+  if (v) {
+    g_free(digest);
+    *sigsum = v->sigsum;
+    return g_strdup(v->keyid);
+  }
+
+  verified_key = _gpg_verify(gpg_data, text, sigsum, &errors);
+  // Failed verifications are only cached if GPGME didn't complain
+  if (!errors)
+    gpg_vcache_store(digest, verified_key, *sigsum);
+  g_free(digest);
+  gpg_errors_print(errors);
+  return verified_key;
+}
+
+static char *_gpg_sign(const char *gpg_data, const char *private_key,
+                       GSList **errors)
 {
   gpgme_ctx_t ctx;
   gpgme_data_t in, out;
@@ -319,13 +543,12 @@ char *gpg_sign(const char *gpg_data)
   gpgme_key_t key;
   gpgme_error_t err;
 
-  if (!gpg.enabled || !gpg.private_key)
+  if (!private_key)
     return NULL;
 
   err = gpgme_new(&ctx);
   if (err) {
-    scr_LogPrint(LPRINT_LOGNORM|LPRINT_NOTUTF8,
-                 "GPGME error: %s", gpgme_strerror(err));
+    gpg_error_add(errors, "GPGME error: %s", gpgme_strerror(err));
     return NULL;
   }
 
@@ -340,9 +563,9 @@ char *gpg_sign(const char *gpg_data)
       gpgme_set_passphrase_cb(ctx, passphrase_cb, 0);
   }
 
-  err = gpgme_get_key(ctx, gpg.private_key, &key, 1);
+  err = gpgme_get_key(ctx, private_key, &key, 1);
   if (err || !key) {
-    scr_LogPrint(LPRINT_LOGNORM, "GPGME error: private key not found");
+    gpg_error_add(errors, "GPGME error: private key not found");
     gpgme_release(ctx);
     return NULL;
   }
@@ -371,16 +594,27 @@ char *gpg_sign(const char *gpg_data)
     gpgme_data_release(in);
   }
   if (err && err != GPG_ERR_CANCELED)
-    scr_LogPrint(LPRINT_LOGNORM|LPRINT_NOTUTF8,
-                 "GPGME signature error: %s", gpgme_strerror(err));
+    gpg_error_add(errors, "GPGME signature error: %s", gpgme_strerror(err));
   gpgme_release(ctx);
   return signed_data;
 }
 
-//  gpg_decrypt(gpg_data)
-// Return decrypted gpg_data (or NULL).
+//  gpg_sign(gpg_data)
+// Return a signature of gpg_data (or NULL).
 // The returned string must be freed with g_free() after use.
-char *gpg_decrypt(const char *gpg_data)
+char *gpg_sign(const char *gpg_data)
+{
+  GSList *errors = NULL;
+  char *signed_data;
+
+  if (!gpg.enabled)
+    return NULL;
+  signed_data = _gpg_sign(gpg_data, gpg.private_key, &errors);
+  gpg_errors_print(errors);
+  return signed_data;
+}
+
+static char *_gpg_decrypt(const char *gpg_data, GSList **errors)
 {
   gpgme_ctx_t ctx;
   gpgme_data_t in, out;
@@ -391,13 +625,9 @@ char *gpg_decrypt(const char *gpg_data)
   const char prefix[] = "-----BEGIN PGP MESSAGE-----\n\n";
   const char suffix[] = "\n-----END PGP MESSAGE-----\n";
 
-  if (!gpg.enabled)
-    return NULL;
-
   err = gpgme_new(&ctx);
   if (err) {
-    scr_LogPrint(LPRINT_LOGNORM|LPRINT_NOTUTF8,
-                 "GPGME error: %s", gpgme_strerror(err));
+    gpg_error_add(errors, "GPGME error: %s", gpgme_strerror(err));
     return NULL;
   }
 
@@ -436,17 +666,29 @@ char *gpg_decrypt(const char *gpg_data)
     gpgme_data_release(in);
   }
   if (err && err != GPG_ERR_CANCELED)
-    scr_LogPrint(LPRINT_LOGNORM|LPRINT_NOTUTF8,
-                 "GPGME decryption error: %s", gpgme_strerror(err));
+    gpg_error_add(errors, "GPGME decryption error: %s", gpgme_strerror(err));
   gpgme_release(ctx);
   g_free(data);
   return decrypted_data;
 }
 
-//  gpg_encrypt(gpg_data, keyids[], n)
-// Return encrypted gpg_data with the n keys from the keyids array (or NULL).
+//  gpg_decrypt(gpg_data)
+// Return decrypted gpg_data (or NULL).
 // The returned string must be freed with g_free() after use.
-char *gpg_encrypt(const char *gpg_data, const char *keyids[], size_t nkeys)
+char *gpg_decrypt(const char *gpg_data)
+{
+  GSList *errors = NULL;
+  char *decrypted_data;
+
+  if (!gpg.enabled)
+    return NULL;
+  decrypted_data = _gpg_decrypt(gpg_data, &errors);
+  gpg_errors_print(errors);
+  return decrypted_data;
+}
+
+static char *_gpg_encrypt(const char *gpg_data, const char *keyids[],
+                          size_t nkeys, GSList **errors)
 {
   gpgme_ctx_t ctx;
   gpgme_data_t in, out;
@@ -456,17 +698,13 @@ char *gpg_encrypt(const char *gpg_data, const char *keyids[], size_t nkeys)
   gpgme_error_t err;
   unsigned i;
 
-  if (!gpg.enabled)
-    return NULL;
-
   if (!keyids || !nkeys) {
     return NULL;
   }
 
   err = gpgme_new(&ctx);
   if (err) {
-    scr_LogPrint(LPRINT_LOGNORM|LPRINT_NOTUTF8,
-                 "GPGME error: %s", gpgme_strerror(err));
+    gpg_error_add(errors, "GPGME error: %s", gpgme_strerror(err));
     return NULL;
   }
 
@@ -483,8 +721,8 @@ char *gpg_encrypt(const char *gpg_data, const char *keyids[], size_t nkeys)
   for (i = 0; i < nkeys; i++) {
     err = gpgme_get_key(ctx, keyids[i], &keys[i], 0);
     if (err || !keys[i]) {
-      scr_LogPrint(LPRINT_LOGNORM, "GPGME encryption error: cannot use key %s",
-                   keyids[i]);
+      gpg_error_add(errors, "GPGME encryption error: cannot use key %s",
+                    keyids[i]);
       // We need to have err not null to ensure we won't try to encrypt
       // without this key.
       if (!err) err = GPG_ERR_UNKNOWN_ERRNO;
@@ -514,8 +752,8 @@ char *gpg_encrypt(const char *gpg_data, const char *keyids[], size_t nkeys)
     }
 
     if (err && err != GPG_ERR_CANCELED) {
-      scr_LogPrint(LPRINT_LOGNORM|LPRINT_NOTUTF8,
-                   "GPGME encryption error: %s", gpgme_strerror(err));
+      gpg_error_add(errors, "GPGME encryption error: %s",
+                    gpgme_strerror(err));
     }
   }
 
@@ -529,6 +767,137 @@ char *gpg_encrypt(const char *gpg_data, const char *keyids[], size_t nkeys)
   return edata;
 }
 
+//  gpg_encrypt(gpg_data, keyids[], n)
+// Return encrypted gpg_data with the n keys from the keyids array (or NULL).
+// The returned string must be freed with g_free() after use.
+char *gpg_encrypt(const char *gpg_data, const char *keyids[], size_t nkeys)
+{
+  GSList *errors = NULL;
+  char *edata;
+
+  if (!gpg.enabled)
+    return NULL;
+  edata = _gpg_encrypt(gpg_data, keyids, nkeys, &errors);
+  gpg_errors_print(errors);
+  return edata;
+}
+
+
+typedef struct {
+  guint         ops;
+  gboolean      enabled;    // gpg.enabled when the job was submitted
+  char         *input;
+  char         *signature;
+  char         *sign_key;
+  char        **keyids;
+  size_t        nkeys;
+  gpg_job_cb_t  cb;
+  gpointer      userdata;
+  gpg_result_t  result;
+  GSList       *errors;
+  gchar        *vdigest;    // Verification cache key (VERIFY only jobs)
+} gpg_job_t;
+
+//  gpg_job_run(job)
+// Worker thread part of a GPG job.
+static void gpg_job_run(gpointer data)
+{
+  gpg_job_t *job = data;
+  const char *text = job->input;
+
+  // The gpg state must not be read from a worker thread
+  if (!job->enabled)
+    return;
+
+  if (job->ops & GPG_JOB_DECRYPT) {
+    job->result.output = _gpg_decrypt(job->input, &job->errors);
+    text = job->result.output;
+  }
+  if ((job->ops & GPG_JOB_VERIFY) && job->signature && text)
+    job->result.keyid = _gpg_verify(job->signature, text,
+                                    &job->result.sigsum, &job->errors);
+  if (job->ops & GPG_JOB_SIGN)
+    job->result.output = _gpg_sign(job->input, job->sign_key, &job->errors);
+  else if (job->ops & GPG_JOB_ENCRYPT)
+    job->result.output = _gpg_encrypt(job->input, (const char **)job->keyids,
+                                      job->nkeys, &job->errors);
+}
+
+//  gpg_job_done(job)
+// Main loop part of a GPG job.
+static void gpg_job_done(gpointer data)
+{
+  gpg_job_t *job = data;
+
+  if (job->vdigest && !job->errors)
+    gpg_vcache_store(job->vdigest, job->result.keyid, job->result.sigsum);
+  gpg_errors_print(job->errors);
+  if (job->cb)
+    job->cb(&job->result, job->userdata);
+
+  g_free(job->result.output);
+  g_free(job->result.keyid);
+  g_free(job->input);
+  g_free(job->signature);
+  g_free(job->sign_key);
+  g_strfreev(job->keyids);
+  g_free(job->vdigest);
+  g_free(job);
+}
+
+//  gpg_job_submit(queue, ops, input, signature, keyids[], n, cb, userdata)
+// Run the GPG operations ops (GPG_JOB_* flags) in a worker thread, and
+// call cb(result, userdata) from the main loop when they're done.
+// The input is the encrypted data (GPG_JOB_DECRYPT) or the text to
+// sign/encrypt/verify.  When both GPG_JOB_DECRYPT and GPG_JOB_VERIFY
+// are set, the signature is checked against the decrypted text (if the
+// decryption succeeds).
+// keyids/n are the encryption keys (GPG_JOB_ENCRYPT only).
+// The callbacks of the jobs with the same queue name are called in
+// submission order (see job_submit()).
+// The result strings are freed after the callback has returned.
+void gpg_job_submit(const char *queue, guint ops, const char *input,
+                    const char *signature, const char *keyids[], size_t n,
+                    gpg_job_cb_t cb, gpointer userdata)
+{
+  gpg_job_t *job = g_new0(gpg_job_t, 1);
+
+  job->ops = ops;
+  job->enabled = gpg.enabled;
+  job->input = g_strdup(input);
+  job->signature = g_strdup(signature);
+  job->cb = cb;
+  job->userdata = userdata;
+
+  if (ops == GPG_JOB_VERIFY && signature && input && job->enabled) {
+    // Check the verification cache
+    const gpg_verified_t *v;
+    gchar *digest = gpg_vcache_digest(signature, input);
+
+    v = gpg_vcache_lookup(digest);
+    if (v) {
+      g_free(digest);
+      job->result.keyid = g_strdup(v->keyid);
+      job->result.sigsum = v->sigsum;
+      // No need for a worker thread, but we keep the queue order
+      job_submit(queue, NULL, gpg_job_done, job);
+      return;
+    }
+    job->vdigest = digest;
+  } else if (ops & GPG_JOB_SIGN) {
+    // The private key can be changed before the job is run
+    job->sign_key = g_strdup(gpg.private_key);
+  } else if (ops & GPG_JOB_ENCRYPT) {
+    size_t i;
+    job->keyids = g_new0(char *, n+1);
+    for (i = 0; i < n; i++)
+      job->keyids[i] = g_strdup(keyids[i]);
+    job->nkeys = n;
+  }
+
+  job_submit(queue, gpg_job_run, gpg_job_done, job);
+}
+
 //  gpg_test_passphrase()
 // Test the current gpg.passphrase with gpg.private_key.
 // If the test doesn't succeed, the passphrase is cleared and a non-null
@@ -1,6 +1,7 @@
 #ifndef __MCABBER_PGP_H__
 #define __MCABBER_PGP_H__ 1
 
+#include <glib.h>
 #include <mcabber/config.h>
 
 #ifdef HAVE_GPGME
@@ -16,12 +17,31 @@ void  gpg_set_private_key(const char *priv_keyid);
 const char *gpg_get_private_key_id(void);
 char *gpg_verify(const char *gpg_data, const char *text,
                  gpgme_sigsum_t *sigsum);
+void  gpg_verify_cache_stats(guint *hits, guint *misses);
 char *gpg_sign(const char *gpg_data);
 char *gpg_decrypt(const char *gpg_data);
 char *gpg_encrypt(const char *gpg_data, const char *keyid[], size_t n);
 
 int   gpg_test_passphrase(void);
 
+// Asynchronous GPG operations (run in a worker thread)
+#define GPG_JOB_DECRYPT     (1U<<0)
+#define GPG_JOB_VERIFY      (1U<<1)
+#define GPG_JOB_SIGN        (1U<<2)
+#define GPG_JOB_ENCRYPT     (1U<<3)
+
+typedef struct {
+  char *output;         // Decrypted, signed or encrypted data (or NULL)
+  char *keyid;          // Key id of a verified signature (or NULL)
+  gpgme_sigsum_t sigsum;
+} gpg_result_t;
+
+typedef void (*gpg_job_cb_t)(const gpg_result_t *result, gpointer userdata);
+
+void  gpg_job_submit(const char *queue, guint ops, const char *input,
+                     const char *signature, const char *keyids[], size_t n,
+                     gpg_job_cb_t cb, gpointer userdata);
+
 #endif /* HAVE_GPGME */
 
 int gpg_enabled(void);
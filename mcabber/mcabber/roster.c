@@ -22,6 +22,7 @@
 #include "roster.h"
 #include "utils.h"
 #include "hooks.h"
+#include "compl.h"
 
 extern void hlog_save_state(void);
 
@@ -110,6 +111,10 @@ typedef struct {
   guint ui_prio;  // Boolean, positive if "attention" is requested
   guint unread;
 
+  // Changed each time the item (or, for a group, one of its members) is
+  // modified; the UI uses it to know when a roster line must be redrawn.
+  guint revision;
+
   // list: user -> points to his group; group -> points to its users list
   GSList *list;
 } roster_t;
@@ -128,6 +133,8 @@ GList *alternate_buddy;
 GList *last_activity_buddy;
 
 static roster_t roster_special;
+static guint roster_revision;
+static guint buddylist_generation;
 
 static int  unread_jid_del(const char *jid);
 
@@ -143,6 +150,16 @@ void roster_init(void)
   roster_special.type = ROSTER_TYPE_SPECIAL;
 }
 
+//  roster_touch(roster_item)
+// Give a new revision number to the roster item, and to its group as the
+// group line depends on its members.
+static void roster_touch(roster_t *rost)
+{
+  rost->revision = ++roster_revision;
+  if (rost->list && !(rost->type & (ROSTER_TYPE_GROUP|ROSTER_TYPE_SPECIAL)))
+    ((roster_t *)rost->list->data)->revision = ++roster_revision;
+}
+
 /* ### Resources functions ### */
 
 static inline void free_resource_data(res_t *p_res)
@@ -231,6 +248,7 @@ static res_t *get_or_add_resource(roster_t *rost, const char *resname, gchar pri
   nres->prio = prio;
   rost->resource = g_slist_insert_sorted(rost->resource, nres,
                                          (GCompareFunc)&resource_compare_prio);
+  compl_invalidate(COMPL_RESOURCE);
   return nres;
 }
 
@@ -265,6 +283,7 @@ static void del_resource(roster_t *rost, const char *resname)
   // Free allocations and delete resource node
   free_resource_data(p_res);
   rost->resource = g_slist_delete_link(rost->resource, p_res_elt);
+  compl_invalidate(COMPL_RESOURCE);
   return;
 }
 
@@ -356,9 +375,11 @@ GSList *roster_add_group(const char *name)
     roster_grp = g_new0(roster_t, 1);
     roster_grp->name = g_strdup(name);
     roster_grp->type = ROSTER_TYPE_GROUP;
+    roster_touch(roster_grp);
     // #3 Insert (sorted)
     groups = g_slist_insert_sorted(groups, roster_grp,
             (GCompareFunc)&roster_compare_name);
+    compl_invalidate(COMPL_GROUPNAME);
     p_group = roster_find(name, namesearch, ROSTER_TYPE_GROUP);
   }
   return p_group;
@@ -395,6 +416,7 @@ GSList *roster_add_user(const char *jid, const char *name, const char *group,
     // That's an update
     roster_usr = slist->data;
     roster_usr->subscription = esub;
+    roster_touch(roster_usr);
     if (onserver >= 0)
       buddy_setonserverflag(slist->data, onserver);
     if (name)
@@ -432,9 +454,11 @@ GSList *roster_add_user(const char *jid, const char *name, const char *group,
   roster_usr->list = slist;    // (my_group SList element)
   if (onserver == 1)
     roster_usr->on_server = TRUE;
+  roster_touch(roster_usr);
   // #4 Insert node (sorted)
   my_group->list = g_slist_insert_sorted(my_group->list, roster_usr,
                                          (GCompareFunc)&roster_compare_name);
+  compl_invalidate(COMPL_JID);
   buddylist_defer_build();
   return roster_find(jid, jidsearch, type);
 }
@@ -461,6 +485,7 @@ void roster_del_user(const char *jid)
     unread_jid_add(roster_usr->jid);
 
   sl_group = roster_usr->list;
+  roster_touch((roster_t *)sl_group->data);
 
   // Let's free roster_usr memory (jid, name, status message...)
   free_roster_user_data(roster_usr);
@@ -469,6 +494,9 @@ void roster_del_user(const char *jid)
   sl_group_listptr = &((roster_t *)(sl_group->data))->list;
   *sl_group_listptr = g_slist_delete_link(*sl_group_listptr, sl_user);
 
+  compl_invalidate(COMPL_JID);
+  compl_invalidate(COMPL_RESOURCE);
+
   // We need to rebuild the list
   if (current_buddy)
     buddylist_defer_build();
@@ -511,6 +539,10 @@ void roster_free(void)
     g_free(roster_grp);
     sl_grp = g_slist_next(sl_grp);
   }
+  compl_invalidate(COMPL_JID);
+  compl_invalidate(COMPL_GROUPNAME);
+  compl_invalidate(COMPL_RESOURCE);
+
   // Free groups list
   if (groups) {
     g_slist_free(groups);
@@ -544,6 +576,7 @@ void roster_setstatus(const char *jid, const char *resname, gchar prio,
   if (!resname) return;
 
   roster_usr = (roster_t *)sl_user->data;
+  roster_touch(roster_usr);
 
   // New or updated resource
   p_res = get_or_add_resource(roster_usr, resname, prio);
@@ -592,6 +625,7 @@ void roster_setflags(const char *jid, guint flags, guint value)
     roster_usr->flags |= flags;
   else
     roster_usr->flags &= ~flags;
+  roster_touch(roster_usr);
 }
 
 //  roster_unread_check()
@@ -640,6 +674,7 @@ void roster_msg_setflag(const char *jid, guint special, guint value)
     //if (!sl_user) return;
     //roster_usr = (roster_t *)sl_user->data;
     roster_usr = &roster_special;
+    roster_touch(roster_usr);
     if (value) {
       if (!(roster_usr->flags & ROSTER_FLAG_MSG))
         unread_list_modified = TRUE;
@@ -672,6 +707,7 @@ void roster_msg_setflag(const char *jid, guint special, guint value)
 
   roster_usr = (roster_t *)sl_user->data;
   roster_grp = (roster_t *)roster_usr->list->data;
+  roster_touch(roster_usr);
   if (value) {
     if (!(roster_usr->flags & ROSTER_FLAG_MSG))
       unread_list_modified = TRUE;
@@ -745,6 +781,7 @@ void roster_msg_update_unread(const char *jid, gboolean increment)
     roster_usr->unread++;
   else
     roster_usr->unread = 0;
+  roster_touch(roster_usr);
 }
 
 //  roster_setuiprio(jid, special, prio_value, action)
@@ -776,6 +813,7 @@ void roster_setuiprio(const char *jid, guint special, guint value,
     newval = value;
 
   roster_usr->ui_prio = newval;
+  roster_touch(roster_usr);
   unread_list = g_slist_sort(unread_list,
                              (GCompareFunc)&_roster_compare_uiprio);
   roster_unread_check();
@@ -837,6 +875,7 @@ void roster_settype(const char *jid, guint type)
 
   roster_usr = (roster_t *)sl_user->data;
   roster_usr->type = type;
+  roster_touch(roster_usr);
 }
 
 enum imstatus roster_getstatus(const char *jid, const char *resname)
@@ -928,6 +967,7 @@ void roster_unsubscribed(const char *jid)
 
   roster_usr = (roster_t *)sl_user->data;
   free_all_resources(&roster_usr->resource);
+  roster_touch(roster_usr);
 }
 
 
@@ -970,6 +1010,13 @@ guchar buddylist_get_filter(void)
   return display_filter;
 }
 
+//  buddylist_get_generation()
+// Return a number which changes each time the buddylist is rebuilt.
+guint buddylist_get_generation(void)
+{
+  return buddylist_generation;
+}
+
 void buddylist_defer_build(void)
 {
   _rebuild_buddylist = TRUE;
@@ -989,6 +1036,7 @@ void buddylist_build(void)
   if (_rebuild_buddylist == FALSE)
     return;
   _rebuild_buddylist = FALSE;
+  buddylist_generation++;
 
   // We need to remember which buddy is selected.
   if (current_buddy)
@@ -1075,6 +1123,7 @@ void buddy_hide_group(gpointer rosterdata, int hide)
     roster_usr->flags ^= ROSTER_FLAG_HIDE;
   else                              // FALSE  (don't hide)
     roster_usr->flags &= ~ROSTER_FLAG_HIDE;
+  roster_touch(roster_usr);
 }
 
 const char *buddy_getjid(gpointer rosterdata)
@@ -1107,6 +1156,7 @@ void buddy_setgroup(gpointer rosterdata, char *newgroupname)
   my_newgroup = (roster_t *)sl_newgroup->data;
 
   // Remove the buddy from current group
+  roster_touch(roster_usr);
   sl_group = &((roster_t *)((GSList*)roster_usr->list)->data)->list;
   *sl_group = g_slist_remove(*sl_group, rosterdata);
 
@@ -1117,12 +1167,14 @@ void buddy_setgroup(gpointer rosterdata, char *newgroupname)
     g_free((gchar*)roster_grp->name);
     g_free(roster_grp);
     groups = g_slist_remove(groups, roster_grp);
+    compl_invalidate(COMPL_GROUPNAME);
   }
 
   // Add the buddy to its new group
   roster_usr->list = sl_newgroup;    // (my_newgroup SList element)
   my_newgroup->list = g_slist_insert_sorted(my_newgroup->list, roster_usr,
                                             (GCompareFunc)&roster_compare_name);
+  roster_touch(roster_usr);
 
   buddylist_defer_build();
 }
@@ -1143,6 +1195,7 @@ void buddy_setname(gpointer rosterdata, char *newname)
   }
   if (newname)
     roster_usr->name = g_strdup(newname);
+  roster_touch(roster_usr);
 
   // We need to resort the group list
   sl_group = &((roster_t *)((GSList*)roster_usr->list)->data)->list;
@@ -1188,6 +1241,7 @@ void buddy_setinsideroom(gpointer rosterdata, guint inside)
   if (!(roster_usr->type & ROSTER_TYPE_ROOM)) return;
 
   roster_usr->inside_room = inside;
+  roster_touch(roster_usr);
 }
 
 guint buddy_getinsideroom(gpointer rosterdata)
@@ -1290,6 +1344,7 @@ void buddy_settype(gpointer rosterdata, guint type)
 {
   roster_t *roster_usr = rosterdata;
   roster_usr->type = type;
+  roster_touch(roster_usr);
 }
 
 guint buddy_gettype(gpointer rosterdata)
@@ -1354,8 +1409,23 @@ void buddy_resource_setevents(gpointer rosterdata, const char *resname,
 {
   roster_t *roster_usr = rosterdata;
   res_t *p_res = get_resource(roster_usr, resname);
-  if (p_res)
+  if (p_res) {
     p_res->events = events;
+    roster_touch(roster_usr);
+  }
+}
+
+//  buddy_getevents(roster_data)
+// Return the union of the events of all the buddy's resources
+guint buddy_getevents(gpointer rosterdata)
+{
+  roster_t *roster_usr = rosterdata;
+  GSList *p;
+  guint events = ROSTER_EVENT_NONE;
+
+  for (p = roster_usr->resource; p; p = g_slist_next(p))
+    events |= ((res_t *)p->data)->events;
+  return events;
 }
 
 char *buddy_resource_getcaps(gpointer rosterdata, const char *resname)
@@ -1521,6 +1591,7 @@ void buddy_resource_setname(gpointer rosterdata, const char *resname,
     }
     if (newname)
       p_res->name = g_strdup(newname);
+    compl_invalidate(COMPL_RESOURCE);
   }
 }
 
@@ -1534,6 +1605,7 @@ void buddy_del_all_resources(gpointer rosterdata)
     res_t *r = roster_usr->resource->data;
     del_resource(roster_usr, r->name);
   }
+  roster_touch(roster_usr);
 }
 
 //  buddy_setflags()
@@ -1545,6 +1617,16 @@ void buddy_setflags(gpointer rosterdata, guint flags, guint value)
     roster_usr->flags |= flags;
   else
     roster_usr->flags &= ~flags;
+  roster_touch(roster_usr);
+}
+
+//  buddy_getrevision(roster_data)
+// Return the revision number of the roster item.  It changes each time
+// something displayed in the roster line of the item is modified.
+guint buddy_getrevision(gpointer rosterdata)
+{
+  roster_t *roster_usr = rosterdata;
+  return roster_usr->revision;
 }
 
 guint buddy_getflags(gpointer rosterdata)
@@ -1701,12 +1783,14 @@ void foreach_group_member(gpointer groupdata,
 GSList *compl_list(guint type)
 {
   GSList *list = NULL;
-  GSList *sl_roster_elt = groups;
+  GSList *sl_roster_elt;
   roster_t *roster_elt;
   GSList *sl_roster_usrelt;
   roster_t *roster_usrelt;
 
-  while (sl_roster_elt) {       // group list loop
+  // group list loop
+  for (sl_roster_elt = groups; sl_roster_elt;
+       sl_roster_elt = g_slist_next(sl_roster_elt)) {
     roster_elt = (roster_t *) sl_roster_elt->data;
 
     if (roster_elt->type & ROSTER_TYPE_SPECIAL)
@@ -1714,22 +1798,22 @@ GSList *compl_list(guint type)
 
     if (type == ROSTER_TYPE_GROUP) { // (group names)
       if (roster_elt->name && *(roster_elt->name))
-        list = g_slist_append(list, from_utf8(roster_elt->name));
+        list = g_slist_prepend(list, from_utf8(roster_elt->name));
     } else { // ROSTER_TYPE_USER (jid) (or agent, or chatroom...)
       sl_roster_usrelt = roster_elt->list;
       while (sl_roster_usrelt) {  // user list loop
         roster_usrelt = (roster_t *) sl_roster_usrelt->data;
 
         if (roster_usrelt->jid)
-          list = g_slist_append(list, from_utf8(roster_usrelt->jid));
+          list = g_slist_prepend(list, from_utf8(roster_usrelt->jid));
 
         sl_roster_usrelt = g_slist_next(sl_roster_usrelt);
       }
     }
-    sl_roster_elt = g_slist_next(sl_roster_elt);
   }
 
-  return list;
+  // The elements have been prepended
+  return g_slist_reverse(list);
 }
 
 //  unread_msg(rosterdata)
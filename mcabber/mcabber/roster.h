@@ -199,6 +199,7 @@ int     buddylist_isset_filter(void);
 int     buddylist_is_status_filtered(enum imstatus status);
 void    buddylist_set_filter(guchar);
 guchar  buddylist_get_filter(void);
+guint   buddylist_get_generation(void);
 const char *buddy_getjid(gpointer rosterdata);
 void        buddy_setname(gpointer rosterdata, char *newname);
 const char *buddy_getname(gpointer rosterdata);
@@ -234,6 +235,7 @@ void    buddy_resource_setname(gpointer rosterdata, const char *resname,
 void    buddy_resource_setevents(gpointer rosterdata, const char *resname,
                                  guint event);
 guint   buddy_resource_getevents(gpointer rosterdata, const char *resname);
+guint   buddy_getevents(gpointer rosterdata);
 void    buddy_resource_setcaps(gpointer rosterdata, const char *resname,
                                const char *caps);
 char   *buddy_resource_getcaps(gpointer rosterdata, const char *resname);
@@ -247,6 +249,7 @@ void    buddy_setflags(gpointer rosterdata, guint flags, guint value);
 guint   buddy_getflags(gpointer rosterdata);
 guint   buddy_getuiprio(gpointer rosterdata);
 guint   buddy_getunread(gpointer rosterdata);
+guint   buddy_getrevision(gpointer rosterdata);
 void    buddy_setonserverflag(gpointer rosterdata, guint onserver);
 guint   buddy_getonserverflag(gpointer rosterdata);
 GList  *buddy_search_jid(const char *jid);
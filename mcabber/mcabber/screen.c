@@ -48,6 +48,7 @@
 #endif
 
 #include "screen.h"
+#include "screen_internal.h"
 #include "utf8.h"
 #include "hbuf.h"
 #include "commands.h"
@@ -109,12 +110,30 @@ typedef struct {
   char      lock;
   char      refcount; // refcount > 0 if there are other users of this struct
                       // e.g. with symlinked history
+  guint     appended; // Number of lines appended to hbuf
+  guint     changes;  // Number of other modifications of hbuf
 } buffdata_t;
 
 typedef struct {
   WINDOW *win;
   PANEL  *panel;
   buffdata_t *bd;
+  // What is currently displayed in win (see scr_update_window())
+  struct {
+    gboolean valid;   // The window displays the end of the buffer
+    guint    rows;    // Number of buffer lines displayed
+    guint    height, width, prefixwidth;
+    guint    appended, changes; // bd counters
+    guint    gen;     // chatwin_gen value
+    gboolean readmark;
+  } shown;
+  // MUC nick colors, resolved for this window (see scr_get_nick_color())
+  struct {
+    gchar      *jid;      // Lowercase JID of the window, NULL if special
+    guint       gen;      // chatwin_gen value
+    muccol_t    type;     // Coloring mode of the room
+    GHashTable *nicks;    // Nick ("<nick>" or "*nick ") -> ccolor_t
+  } muccol;
 } winbuf_t;
 
 struct dimensions {
@@ -131,12 +150,96 @@ static int maxY, maxX;
 static int prev_chatwidth;
 static winbuf_t *statusWindow;
 static winbuf_t *currentWindow;
+
+// Incremented when all the chat windows must be fully redrawn
+// (e.g. colors have changed).
+static guint chatwin_gen;
+// Chat windows rendering statistics
+static struct {
+  guint full;         // Full window repaints
+  guint incremental;  // Updates with only the new lines drawn
+  guint lines;        // Number of buffer lines drawn
+} chatwin_stats;
+
+// Roster window lines
+// Rendered lines are cached per roster item and reused until the item
+// revision (see buddy_getrevision()) changes; only the screen lines which
+// differ from what is currently displayed are redrawn.
+typedef struct {
+  guint     revision; // Roster item revision the line was rendered from
+  guint     serial;   // Line identifier, changed each time it is rendered
+  guint     frame;    // Last roster frame the line was displayed in
+  gboolean  selected;
+  int       color;    // Background attribute
+  gchar    *text;     // Line contents (locale charset)
+} roster_row_t;
+
+typedef struct {
+  int       maxx, maxy, x_pos;
+  int       prefix_length;
+  int       show_unread;
+  enum imstatus mystatus;
+  guchar    filter;
+  guint     attn_sign;
+  guint     gen;      // rosterwin_gen value
+} roster_view_t;
+
+#define ROSTER_ROW_EMPTY  G_MAXUINT
+
+static struct {
+  gboolean      valid;  // The window displays what is described below
+  roster_view_t view;
+  GHashTable   *rows;   // Roster item -> roster_row_t
+  guint        *shown;  // Serial of the line displayed at each position
+  guint         frame;
+  guint         serial;
+  int           offset; // Index of the first displayed buddylist item
+  GList        *top;    // First displayed buddylist item
+  guint         listgen, listlen;
+  guint         rendered, drawn; // Statistics
+} rosterwin;
+// Incremented when all the roster lines must be re-rendered
+// (e.g. colors or coloring rules have changed).
+static guint rosterwin_gen;
+
+// Frame scheduler
+// Screen updates are coalesced: the current chat window, the roster and
+// the status bars are marked dirty, and the screen is rendered at most
+// 'max_frame_rate' times per second.
+static struct {
+  gint64   last;        // Time of the last frame (monotonic clock, usec)
+  guint    timer;       // Source id of the next scheduled frame
+  gboolean force;       // Render the next frame immediately
+  gboolean chat_dirty;  // The current chat window must be redrawn
+  gboolean main_status_dirty; // The main status line must be redrawn
+  gboolean chat_status_dirty; // The buddy status bar must be redrawn
+  guint    rendered;    // Number of frames rendered
+  guint    coalesced;   // Number of updates delayed to a later frame
+} frame;
 static GList  *statushbuf;
 
+// Status buffer messages
+// The status buffer is a ring of at most 'status_buffer_size' messages.
+// Its lines are only wrapped when the buffer is displayed.
+static hbuf_ring_t statusring;
+static gboolean    statusring_unwrapped;
+
+// Log timestamps, formatted once per second
+static struct {
+  time_t  t;
+  char    hms[16];    // Log window and status buffer
+  char    full[32];   // Trace log file
+} logstamp;
+
+// Log window messages capture (see scr_log_capture())
+static GString  *log_capture;
+static gboolean  log_capture_hide;
+
 static int roster_hidden;
 static int chatmode;
 static int multimode;
-static char *multiline, *multimode_subj;
+static GString *multiline;
+static char *multimode_subj;
 
 static bool Curses;
 static bool log_win_on_top;
@@ -157,6 +260,21 @@ static char   cmdhisto_backup[INPUTLINE_LENGTH+1];
 
 static int    chatstate; /* (0=active, 1=composing, 2=paused) */
 static bool   lock_chatstate;
+
+#define PASTE_BURST_KEYS  16
+
+// Pasted text
+// Printable keys received between bracketed paste markers, or after more
+// than PASTE_BURST_KEYS keys have been read at once, are collected and
+// inserted in the input line in one operation when the keys have been
+// processed (see scr_input_flush()).
+static struct {
+  gboolean enabled;   // Bracketed paste mode has been enabled
+  gboolean bracketed; // Between bracketed paste markers
+  guint    keys;      // Number of keys read in the current batch
+  gboolean dirty;     // The input line must be refreshed
+  GString *text;      // Text waiting to be inserted
+} paste;
 static time_t chatstate_timestamp;
 static guint  chatstate_timeout_id = 0;
 
@@ -178,6 +296,18 @@ typedef struct {
 GSList *keyseqlist;
 static void add_keyseq(char *seqstr, guint mkeycode, gint value);
 
+// Key sequences trie (built from keyseqlist, see match_keyseq())
+typedef struct keyseq_node_s {
+  unsigned char c;
+  keyseq_t *match;              // Key sequence ending at this node
+  struct keyseq_node_s *child;  // First child node
+  struct keyseq_node_s *next;   // Next sibling node
+} keyseq_node_t;
+
+static keyseq_node_t *keyseqtrie; // First node of the first level
+static gboolean keyseqtrie_stale;
+static void keyseq_trie_free(keyseq_node_t *node);
+
 static void scr_write_in_window(const char *winId, const char *text,
                                 time_t timestamp, unsigned int prefix_flags,
                                 int force_show, unsigned mucnicklen,
@@ -220,6 +350,33 @@ typedef struct {
 
 static GSList *rostercolrules = NULL;
 
+// Compiled roster coloring rules
+// The rules are compiled into an array (by order of precedence), and the
+// rules without any wildcard are indexed by JID.  The results are cached
+// per JID and status until the rules are modified.
+#define ROSTERCOLOR_STATUSES    "_ofdnai?Cx"
+#define ROSTERCOLOR_CACHE_MAX   8192
+
+typedef struct {
+  guint         statusmask;
+  GPatternSpec *pattern;  // NULL if the rule matches a single JID
+  int           next;     // Next rule for the same single JID, or -1
+  int           color;
+} rostercolor_rule_t;
+
+typedef struct {
+  guint known;            // Statuses for which the result is known
+  guint matched;          // Statuses for which a rule matches
+  int   color[sizeof(ROSTERCOLOR_STATUSES)-1];
+} rostercolor_result_t;
+
+static struct {
+  rostercolor_rule_t *rules;
+  guint       count;
+  GHashTable *literals;   // JID -> index+1 of the first rule for this JID
+  GHashTable *results;    // JID -> rostercolor_result_t
+} rostercolmatcher;
+
 static GHashTable *muccolors = NULL, *nickcolors = NULL;
 
 typedef struct {
@@ -230,6 +387,8 @@ typedef struct {
 static int nickcolcount = 0;
 static ccolor_t ** nickcols = NULL;
 static muccol_t glob_muccol = MC_OFF;
+// Used in the windows nick color tables for uncolored nicks
+static ccolor_t no_nick_color;
 
 /* Functions */
 
@@ -319,6 +478,7 @@ void scr_muc_color(const char *muc, muccol_t type)
     }
   }
   // Need to redraw?
+  chatwin_gen++;
   if (chatmode &&
       ((buddy_search_jid(muc) == current_buddy) || !strcmp(muc, "*")))
     scr_update_buddy_window();
@@ -365,6 +525,8 @@ void scr_muc_nick_color(const char *nick, const char *color)
       need_update = TRUE;
     }
   }
+  if (need_update)
+    chatwin_gen++;
   if (need_update && chatmode &&
       (buddy_gettype(BUDDATA(current_buddy)) & ROSTER_TYPE_ROOM))
     scr_update_buddy_window();
@@ -379,6 +541,141 @@ static void free_rostercolrule(rostercolor_t *col)
   g_free(col);
 }
 
+static guint rostercolor_statusmask(const char *status)
+{
+  guint i, mask = 0;
+
+  if (!strcmp(status, "*"))
+    return ~0U;
+  for (i = 0; ROSTERCOLOR_STATUSES[i]; i++)
+    if (strchr(status, ROSTERCOLOR_STATUSES[i]))
+      mask |= 1U << i;
+  return mask;
+}
+
+static void rostercolor_compile(void)
+{
+  GSList *head;
+  guint i;
+
+  rostercolmatcher.count = g_slist_length(rostercolrules);
+  rostercolmatcher.rules = g_new0(rostercolor_rule_t, rostercolmatcher.count);
+  // Keys belong to the rules list, which is not modified before the
+  // matcher is reset.
+  rostercolmatcher.literals = g_hash_table_new(g_str_hash, g_str_equal);
+  rostercolmatcher.results = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   g_free, g_free);
+
+  for (i = 0, head = rostercolrules; head; i++, head = g_slist_next(head)) {
+    rostercolor_t *rc = head->data;
+    rostercolor_rule_t *rule = &rostercolmatcher.rules[i];
+
+    rule->statusmask = rostercolor_statusmask(rc->status);
+    rule->color = compose_color(rc->color);
+    rule->next = -1;
+    if (strpbrk(rc->wildcard, "*?")) {
+      rule->pattern = rc->compiled;
+    } else {
+      gpointer first = g_hash_table_lookup(rostercolmatcher.literals,
+                                           rc->wildcard);
+      if (first) {
+        int j = GPOINTER_TO_INT(first) - 1;
+        while (rostercolmatcher.rules[j].next != -1)
+          j = rostercolmatcher.rules[j].next;
+        rostercolmatcher.rules[j].next = i;
+      } else {
+        g_hash_table_insert(rostercolmatcher.literals, rc->wildcard,
+                            GINT_TO_POINTER(i + 1));
+      }
+    }
+  }
+}
+
+static void rostercolor_reset(void)
+{
+  if (!rostercolmatcher.results)
+    return;
+  g_hash_table_destroy(rostercolmatcher.results);
+  g_hash_table_destroy(rostercolmatcher.literals);
+  g_free(rostercolmatcher.rules);
+  memset(&rostercolmatcher, 0, sizeof(rostercolmatcher));
+}
+
+//  rostercolor_lookup(bjid, status, color)
+// Look for the first roster coloring rule matching the JID and status.
+// Return TRUE and set color if there is one.
+static gboolean rostercolor_lookup(const char *bjid, char status, int *color)
+{
+  const char *p;
+  rostercolor_result_t *res;
+  guint bit, idx, i, limit;
+  gpointer first;
+  int best = -1;
+  gsize len;
+
+  if (!rostercolrules || !bjid || !status)
+    return FALSE;
+  p = strchr(ROSTERCOLOR_STATUSES, status);
+  if (!p)
+    return FALSE;
+  idx = p - ROSTERCOLOR_STATUSES;
+  bit = 1U << idx;
+
+  if (!rostercolmatcher.results)
+    rostercolor_compile();
+
+  res = g_hash_table_lookup(rostercolmatcher.results, bjid);
+  if (!res) {
+    if (g_hash_table_size(rostercolmatcher.results) >= ROSTERCOLOR_CACHE_MAX)
+      g_hash_table_remove_all(rostercolmatcher.results);
+    res = g_new0(rostercolor_result_t, 1);
+    g_hash_table_insert(rostercolmatcher.results, g_strdup(bjid), res);
+  }
+
+  if (!(res->known & bit)) {
+    // Rules for this very JID
+    first = g_hash_table_lookup(rostercolmatcher.literals, bjid);
+    if (first) {
+      int j;
+      for (j = GPOINTER_TO_INT(first) - 1; j != -1;
+           j = rostercolmatcher.rules[j].next)
+        if (rostercolmatcher.rules[j].statusmask & bit) {
+          best = j;
+          break;
+        }
+    }
+    // Wildcard rules with a higher precedence
+    limit = (best == -1) ? rostercolmatcher.count : (guint)best;
+    len = strlen(bjid);
+    for (i = 0; i < limit; i++) {
+      rostercolor_rule_t *rule = &rostercolmatcher.rules[i];
+      if (rule->pattern && (rule->statusmask & bit) &&
+          g_pattern_match(rule->pattern, len, bjid, NULL)) {
+        best = i;
+        break;
+      }
+    }
+    res->known |= bit;
+    if (best != -1) {
+      res->matched |= bit;
+      res->color[idx] = rostercolmatcher.rules[best].color;
+    }
+  }
+
+  if (!(res->matched & bit))
+    return FALSE;
+  *color = res->color[idx];
+  return TRUE;
+}
+
+// Called when the roster coloring rules have been modified
+static void rostercolrules_changed(void)
+{
+  rostercolor_reset();
+  rosterwin_gen++;
+  scr_update_roster();
+}
+
 // Removes all roster coloring rules
 void scr_roster_clear_color(void)
 {
@@ -388,7 +685,7 @@ void scr_roster_clear_color(void)
   }
   g_slist_free(rostercolrules);
   rostercolrules = NULL;
-  scr_update_roster();
+  rostercolrules_changed();
 }
 
 // Adds, modifies or removes roster coloring rule
@@ -414,7 +711,7 @@ bool scr_roster_color(const char *status, const char *wildcard,
     if (found) {
       free_rostercolrule(found->data);
       rostercolrules = g_slist_delete_link(rostercolrules, found);
-      scr_update_roster();
+      rostercolrules_changed();
       return TRUE;
     } else {
       scr_LogPrint(LPRINT_NORMAL, "No such color rule, nothing removed");
@@ -438,7 +735,7 @@ bool scr_roster_color(const char *status, const char *wildcard,
       rc->color = cl;
       rostercolrules = g_slist_prepend(rostercolrules, rc);
     }
-    scr_update_roster();
+    rostercolrules_changed();
     return TRUE;
   }
 }
@@ -594,6 +891,8 @@ static void parse_colors(void)
   }
 
   colors_stalled = FALSE;
+  chatwin_gen++;
+  rosterwin_gen++;
 }
 
 static void init_keycodes(void)
@@ -666,6 +965,10 @@ static void init_keycodes(void)
   // Konsole Linux
   add_keyseq("[1~", MKEY_EQUIV, KEY_HOME); // Home
   add_keyseq("[4~", MKEY_EQUIV, KEY_END);  // End
+
+  // Bracketed paste
+  add_keyseq("[200~", MKEY_PASTE_START, 0);
+  add_keyseq("[201~", MKEY_PASTE_END, 0);
 }
 
 //  scr_init_bindings()
@@ -809,6 +1112,14 @@ void scr_init_curses(void)
   init_keycodes();
 
   initscr();
+  // Bracketed paste mode: the terminal encloses pasted text in
+  // ESC[200~ / ESC[201~ sequences.
+  paste.enabled = (!settings_opt_get("bracketed_paste") ||
+                   settings_opt_get_int("bracketed_paste"));
+  if (paste.enabled) {
+    fputs("\033[?2004h", stdout);
+    fflush(stdout);
+  }
   raw();
   noecho();
   nonl();
@@ -868,9 +1179,29 @@ void scr_init_curses(void)
 void scr_terminate_curses(void)
 {
   if (!Curses) return;
+  if (frame.timer) {
+    g_source_remove(frame.timer);
+    frame.timer = 0;
+  }
+  scr_LogPrint(LPRINT_DEBUG, "Screen: %u frames rendered, %u updates "
+               "coalesced.", frame.rendered, frame.coalesced);
+  scr_LogPrint(LPRINT_DEBUG, "Chat windows: %u full repaints, %u incremental "
+               "updates, %u lines drawn.", chatwin_stats.full,
+               chatwin_stats.incremental, chatwin_stats.lines);
+  scr_LogPrint(LPRINT_DEBUG, "Roster: %u lines rendered, %u lines drawn.",
+               rosterwin.rendered, rosterwin.drawn);
   clear();
   refresh();
   endwin();
+  if (paste.enabled) {
+    fputs("\033[?2004l", stdout);
+    fflush(stdout);
+    paste.enabled = FALSE;
+  }
+  // The trie will be rebuilt if it is needed again
+  keyseq_trie_free(keyseqtrie);
+  keyseqtrie = NULL;
+  keyseqtrie_stale = TRUE;
   Curses = FALSE;
   return;
 }
@@ -902,19 +1233,19 @@ static int timepreflengths[] = {
 
 static const char *gettprefix(void)
 {
-  guint n = settings_opt_get_int("time_prefix");
+  guint n = settings_opt_slot_int(OPT_SLOT_TIME_PREFIX);
   return timeprefixes[(n < 3 ? n : 0)];
 }
 
 static const char *getspectprefix(void)
 {
-  guint n = settings_opt_get_int("time_prefix");
+  guint n = settings_opt_slot_int(OPT_SLOT_TIME_PREFIX);
   return spectimeprefixes[(n < 3 ? n : 0)];
 }
 
 guint scr_getprefixwidth(void)
 {
-  guint n = settings_opt_get_int("time_prefix");
+  guint n = settings_opt_slot_int(OPT_SLOT_TIME_PREFIX);
   return timepreflengths[(n < 3 ? n : 0)];
 }
 
@@ -935,24 +1266,80 @@ guint scr_getlogwinheight(void)
   return Log_Win_Height;
 }
 
+//  scr_log_timestamp(timestamp)
+// Format the log timestamps (see logstamp), unless it has already been done
+// for this second.
+static void scr_log_timestamp(time_t timestamp)
+{
+  struct tm *tm;
+
+  if (logstamp.t == timestamp && logstamp.hms[0])
+    return;
+  logstamp.t = timestamp;
+  tm = localtime(&timestamp);
+  strftime(logstamp.hms, sizeof(logstamp.hms), "[%H:%M:%S]", tm);
+  strftime(logstamp.full, sizeof(logstamp.full), "[%Y-%m-%d %H:%M:%S]", tm);
+}
+
 //  scr_print_logwindow(string)
 // Display the string in the log window.
 // Note: The string must be in the user's locale!
 void scr_print_logwindow(const char *string)
 {
-  time_t timestamp;
-  char strtimestamp[64];
-
-  timestamp = time(NULL);
-  strftime(strtimestamp, 48, "[%H:%M:%S]", localtime(&timestamp));
+  scr_log_timestamp(time(NULL));
   if (Curses) {
-    wprintw(logWnd, "\n%s %s", strtimestamp, string);
+    wprintw(logWnd, "\n%s %s", logstamp.hms, string);
     update_panels();
   } else {
-    printf("%s %s\n", strtimestamp, string);
+    printf("%s %s\n", logstamp.hms, string);
   }
 }
 
+//  scr_status_buffer_size()
+// Return the maximum number of messages in the status buffer
+// (0 means unlimited).
+static guint scr_status_buffer_size(void)
+{
+  int size = settings_opt_slot_int(OPT_SLOT_STATUS_BUFFER_SIZE);
+  return size > 0 ? size : 0U;
+}
+
+//  scr_status_add_line(p_hbuf, text, timestamp, width, trim)
+// Add a message to the status buffer, and evict the oldest messages if
+// trim is TRUE.
+// Returns the number of evicted messages.
+static guint scr_status_add_line(GList **p_hbuf, const char *text,
+                                 time_t timestamp, guint width, int trim)
+{
+  guint size, evicted = 0U;
+
+  if (!width)
+    statusring_unwrapped = TRUE;
+  hbuf_ring_add_line(&statusring, p_hbuf, text, timestamp,
+                     HBB_PREFIX_SPECIAL, width);
+
+  size = scr_status_buffer_size();
+  if (trim && size)
+    evicted = hbuf_ring_trim(&statusring, p_hbuf, size);
+
+  // statushbuf must not point to an evicted line; the first line of the
+  // ring is never removed by hbuf_rebuild().
+  if (p_hbuf != &statushbuf)
+    statushbuf = statusring.head;
+  return evicted;
+}
+
+//  scr_log_capture(buffer, hide)
+// Append the messages printed to the log window to the buffer, one per
+// line, until scr_log_capture() is called with a NULL buffer.
+// If hide is TRUE, these messages are not displayed (they are still
+// written to the trace log).
+void scr_log_capture(GString *buffer, gboolean hide)
+{
+  log_capture = buffer;
+  log_capture_hide = (buffer && hide);
+}
+
 //  scr_log_print(...)
 // Display a message in the log window and in the status buffer.
 // Add the message to the tracelog file if the log flag is set.
@@ -960,7 +1347,6 @@ void scr_print_logwindow(const char *string)
 void scr_log_print(unsigned int flag, const char *fmt, ...)
 {
   time_t timestamp;
-  char strtimestamp[64];
   char *buffer, *btext;
   char *convbuf1 = NULL, *convbuf2 = NULL;
   va_list ap;
@@ -968,16 +1354,29 @@ void scr_log_print(unsigned int flag, const char *fmt, ...)
   if (!(flag & ~LPRINT_NOTUTF8)) return; // Shouldn't happen
 
   timestamp = time(NULL);
-  strftime(strtimestamp, 48, "[%H:%M:%S]", localtime(&timestamp));
+  scr_log_timestamp(timestamp);
   va_start(ap, fmt);
   btext = g_strdup_vprintf(fmt, ap);
   va_end(ap);
 
+  if (log_capture && (flag & LPRINT_NORMAL)) {
+    if (flag & LPRINT_NOTUTF8) {
+      char *utf8 = to_utf8(btext);
+      g_string_append(log_capture, utf8 ? utf8 : btext);
+      g_free(utf8);
+    } else {
+      g_string_append(log_capture, btext);
+    }
+    g_string_append_c(log_capture, '\n');
+    if (log_capture_hide)
+      flag &= ~LPRINT_NORMAL;
+  }
+
   if (flag & LPRINT_NORMAL) {
     char *buffer_locale;
     char *buf_specialwindow;
 
-    buffer = g_strdup_printf("%s %s", strtimestamp, btext);
+    buffer = g_strdup_printf("%s %s", logstamp.hms, btext);
 
     // Convert buffer to current locale for wprintw()
     if (!(flag & LPRINT_NOTUTF8))
@@ -987,7 +1386,7 @@ void scr_log_print(unsigned int flag, const char *fmt, ...)
 
     if (!buffer_locale) {
       wprintw(logWnd,
-              "\n%s*Error: cannot convert string to locale.", strtimestamp);
+              "\n%s*Error: cannot convert string to locale.", logstamp.hms);
       update_panels();
       g_free(buffer);
       g_free(btext);
@@ -1008,8 +1407,8 @@ void scr_log_print(unsigned int flag, const char *fmt, ...)
     } else {
       printf("%s\n", buffer_locale);
       // ncurses are not initialized yet, so we call directly hbuf routine
-      hbuf_add_line(&statushbuf, buf_specialwindow, timestamp,
-        HBB_PREFIX_SPECIAL, 0, 0, 0, NULL);
+      scr_status_add_line(&statushbuf, buf_specialwindow, timestamp, 0,
+                          TRUE);
     }
 
     g_free(convbuf1);
@@ -1018,8 +1417,7 @@ void scr_log_print(unsigned int flag, const char *fmt, ...)
   }
 
   if (flag & (LPRINT_LOG|LPRINT_DEBUG)) {
-    strftime(strtimestamp, 23, "[%Y-%m-%d %H:%M:%S]", localtime(&timestamp));
-    buffer = g_strdup_printf("%s %s\n", strtimestamp, btext);
+    buffer = g_strdup_printf("%s %s\n", logstamp.full, btext);
     ut_write_log(flag, buffer);
     g_free(buffer);
   }
@@ -1083,6 +1481,7 @@ static winbuf_t *scr_new_buddy(const char *title, int dont_show)
     tmp->bd = g_new0(buffdata_t, 1);
     return tmp;
   }
+  tmp->muccol.jid = g_utf8_strdown(title, -1);
 
   id = hlog_get_log_jid(title);
   if (id) {
@@ -1172,6 +1571,213 @@ size_t scr_line_prefix(hbb_line *line, char *pref, guint preflen)
   return timepreflen;
 }
 
+//  scr_get_nick_color(win_entry, nick)
+// Return the color of the MUC nick ("<nick>" or "*nick ") in the window,
+// or NULL if it should not be colored.
+// The room coloring mode and the nick colors are resolved once per window,
+// until the coloring settings are modified (chatwin_gen).
+static ccolor_t *scr_get_nick_color(winbuf_t *win_entry, const char *nick)
+{
+  nickcolor_t *actual = NULL;
+  ccolor_t *color;
+
+  if (!win_entry->muccol.nicks ||
+      win_entry->muccol.gen != chatwin_gen) {
+    muccol_t *typetmp;
+
+    if (win_entry->muccol.nicks)
+      g_hash_table_remove_all(win_entry->muccol.nicks);
+    else
+      win_entry->muccol.nicks = g_hash_table_new_full(g_str_hash,
+                                                      g_str_equal,
+                                                      g_free, NULL);
+    win_entry->muccol.gen = chatwin_gen;
+    win_entry->muccol.type = glob_muccol;
+    if (muccolors && win_entry->muccol.jid) {
+      typetmp = g_hash_table_lookup(muccolors, win_entry->muccol.jid);
+      if (typetmp)
+        win_entry->muccol.type = *typetmp;
+    }
+  }
+
+  color = g_hash_table_lookup(win_entry->muccol.nicks, nick);
+  if (color)
+    return (color == &no_nick_color) ? NULL : color;
+
+  // Need to generate a color for the specified nick?
+  if ((win_entry->muccol.type == MC_ALL) && (!nickcolors ||
+      !g_hash_table_lookup(nickcolors, nick))) {
+    char *snick, *mnick;
+    nickcolor_t *nc;
+    const char *p = nick;
+    unsigned int nicksum = 0;
+    snick = g_strdup(nick);
+    mnick = g_strdup(nick);
+    nc = g_new(nickcolor_t, 1);
+    ensure_string_htable(&nickcolors, NULL);
+    while (*p)
+      nicksum += *p++;
+    nc->color = nickcols[nicksum % nickcolcount];
+    nc->manual = FALSE;
+    *snick = '<';
+    snick[strlen(snick)-1] = '>';
+    *mnick = '*';
+    mnick[strlen(mnick)-1] = ' ';
+    // Insert them
+    g_hash_table_insert(nickcolors, snick, nc);
+    g_hash_table_insert(nickcolors, mnick, nc);
+  }
+  if (nickcolors)
+    actual = g_hash_table_lookup(nickcolors, nick);
+  if (actual && ((win_entry->muccol.type == MC_ALL) || (actual->manual)))
+    color = actual->color;
+  g_hash_table_insert(win_entry->muccol.nicks, g_strdup(nick),
+                      color ? color : &no_nick_color);
+  return color;
+}
+
+//  scr_draw_chat_line(win_entry, line, winy, prefixwidth)
+// Display a buffer line (prefix, MUC nick and text) at row winy of the
+// chat window.
+static void scr_draw_chat_line(winbuf_t *win_entry, hbb_line *line, int winy,
+                               guint prefixwidth)
+{
+  char pref[96];
+  int color, timelen;
+
+  prefixwidth = MIN(prefixwidth, sizeof pref);
+  wmove(win_entry->win, winy, 0);
+  chatwin_stats.lines++;
+
+  if (line->flags & HBB_PREFIX_HLIGHT_OUT)
+    color = COLOR_MSGOUT;
+  else if (line->flags & HBB_PREFIX_HLIGHT)
+    color = COLOR_MSGHL;
+  else if (line->flags & HBB_PREFIX_INFO)
+    color = COLOR_INFO;
+  else if (line->flags & HBB_PREFIX_IN)
+    color = COLOR_MSGIN;
+  else
+    color = COLOR_GENERAL;
+
+  if (color != COLOR_GENERAL)
+    wbkgdset(win_entry->win, get_color(color));
+
+  // Generate the prefix area and display it
+
+  timelen = scr_line_prefix(line, pref, prefixwidth);
+  if (timelen && line->flags & HBB_PREFIX_DELAYED) {
+    char tmp;
+
+    tmp = pref[timelen];
+    pref[timelen] = '\0';
+    wbkgdset(win_entry->win, get_color(COLOR_TIMESTAMP));
+    wprintw(win_entry->win, "%s", pref);
+    pref[timelen] = tmp;
+    wbkgdset(win_entry->win, get_color(color));
+    wprintw(win_entry->win, "%s", pref+timelen);
+  } else
+    wprintw(win_entry->win, "%s", pref);
+
+  // Make sure we are at the right position
+  wmove(win_entry->win, winy, prefixwidth-1);
+
+  // The MUC nick - overwrite with proper color
+  if (line->mucnicklen) {
+    char tmp;
+    ccolor_t *nickcolor;
+
+    // Store the char after the nick
+    tmp = line->text[line->mucnicklen];
+    // Terminate the string after the nick
+    line->text[line->mucnicklen] = '\0';
+    nickcolor = scr_get_nick_color(win_entry, line->text);
+    if (nickcolor && (line->flags & HBB_PREFIX_IN) &&
+       (!(line->flags & HBB_PREFIX_HLIGHT_OUT)))
+      wbkgdset(win_entry->win, compose_color(nickcolor));
+    wprintw(win_entry->win, "%s", line->text);
+    // Return the char
+    line->text[line->mucnicklen] = tmp;
+    // Return the color back
+    wbkgdset(win_entry->win, get_color(color));
+  }
+
+  // Display text line
+  wprintw(win_entry->win, "%s", line->text+line->mucnicklen);
+  wclrtoeol(win_entry->win);
+
+  // Restore default ("general") color
+  if (color != COLOR_GENERAL)
+    wbkgdset(win_entry->win, get_color(COLOR_GENERAL));
+}
+
+//  scr_update_window_append(win_entry, prefixwidth)
+// Update the window when lines have only been appended to the buffer
+// since the last display of its end: scroll the window and draw the new
+// lines.  Return FALSE if a full repaint is needed.
+static gboolean scr_update_window_append(winbuf_t *win_entry,
+                                         guint prefixwidth)
+{
+  buffdata_t *bd = win_entry->bd;
+  guint i, rows, height = CHAT_WIN_HEIGHT;
+  guint nlines = bd->appended - win_entry->shown.appended;
+  hbb_line **lines;
+  GList *head;
+
+  if (!win_entry->shown.valid || !nlines || nlines >= height ||
+      bd->top || bd->lock || win_entry->shown.readmark ||
+      win_entry->shown.changes != bd->changes ||
+      win_entry->shown.gen != chatwin_gen ||
+      win_entry->shown.height != height ||
+      win_entry->shown.width != scr_gettextwidth() ||
+      win_entry->shown.prefixwidth != prefixwidth)
+    return FALSE;
+
+  // Find the first new line
+  bd->hbuf = g_list_last(bd->hbuf);
+  head = bd->hbuf;
+  for (i = 1; head && i < nlines; i++)
+    head = g_list_previous(head);
+  if (!head)
+    return FALSE;
+
+  lines = hbuf_get_lines(head, nlines);
+  // A read mark needs a full repaint
+  for (i = 0; i < nlines; i++) {
+    if (!lines[i] || (lines[i]->flags & HBB_PREFIX_READMARK))
+      break;
+  }
+  if (i < nlines) {
+    for (i = 0; i < nlines; i++) {
+      if (lines[i]) {
+        g_free(lines[i]->text);
+        g_free(lines[i]);
+      }
+    }
+    g_free(lines);
+    return FALSE;
+  }
+
+  rows = win_entry->shown.rows + nlines;
+  if (rows > height) {
+    scrollok(win_entry->win, TRUE);
+    wscrl(win_entry->win, rows - height);
+    scrollok(win_entry->win, FALSE);
+    rows = height;
+  }
+  for (i = 0; i < nlines; i++) {
+    scr_draw_chat_line(win_entry, lines[i], rows - nlines + i, prefixwidth);
+    g_free(lines[i]->text);
+    g_free(lines[i]);
+  }
+  g_free(lines);
+
+  win_entry->shown.rows = rows;
+  win_entry->shown.appended = bd->appended;
+  chatwin_stats.incremental++;
+  return TRUE;
+}
+
 //  scr_update_window()
 // (Re-)Display the given chat window.
 static void scr_update_window(winbuf_t *win_entry)
@@ -1181,24 +1787,42 @@ static void scr_update_window(winbuf_t *win_entry)
   char pref[96];
   hbb_line **lines, *line;
   GList *hbuf_head;
-  int color = COLOR_GENERAL;
   bool readmark = FALSE;
+  bool has_readmark = FALSE;
   bool skipline = FALSE;
   int autolock;
+  guint rows = 0;
+
+  autolock = settings_opt_slot_int(OPT_SLOT_BUFFER_SMART_SCROLLING);
 
-  autolock = settings_opt_get_int("buffer_smart_scrolling");
+  if (win_entry == currentWindow)
+    frame.chat_dirty = FALSE;
 
   prefixwidth = scr_getprefixwidth();
   prefixwidth = MIN(prefixwidth, sizeof pref);
 
+  // Wrap the status buffer lines added while it was hidden
+  if (win_entry == statusWindow && statusring_unwrapped) {
+    win_entry->bd->top = hbuf_previous_persistent(win_entry->bd->top);
+    hbuf_rebuild(&win_entry->bd->hbuf, scr_gettextwidth());
+    win_entry->bd->changes++;
+    statusring_unwrapped = FALSE;
+  }
+
   // Should the window be empty?
   if (win_entry->bd->cleared) {
+    win_entry->shown.valid = FALSE;
     werase(win_entry->win);
     if (autolock && win_entry->bd->lock)
       scr_buffer_scroll_lock(0);
     return;
   }
 
+  // Only draw the new lines if we can
+  if (scr_update_window_append(win_entry, prefixwidth))
+    return;
+  chatwin_stats.full++;
+
   // win_entry->bd->top is the top message of the screen.  If it set to NULL,
   // we are displaying the last messages.
 
@@ -1230,6 +1854,7 @@ static void scr_update_window(winbuf_t *win_entry)
       line = *(lines+n);
       if (line) {
         if (line->flags & HBB_PREFIX_READMARK) {
+          has_readmark = TRUE;
           // If this is not the last line, we'll display a mark
           if (n+1 < CHAT_WIN_HEIGHT && *(lines+n+1)) {
             readmark = TRUE;
@@ -1247,109 +1872,15 @@ static void scr_update_window(winbuf_t *win_entry)
 
   // Display the lines
   for (n = 0 ; n < CHAT_WIN_HEIGHT; n++) {
-    int timelen;
     int winy = n + mark_offset;
     wmove(win_entry->win, winy, 0);
     line = *(lines+n);
     if (line) {
+      rows++;
       if (skipline)
         goto scr_update_window_skipline;
 
-      if (line->flags & HBB_PREFIX_HLIGHT_OUT)
-        color = COLOR_MSGOUT;
-      else if (line->flags & HBB_PREFIX_HLIGHT)
-        color = COLOR_MSGHL;
-      else if (line->flags & HBB_PREFIX_INFO)
-        color = COLOR_INFO;
-      else if (line->flags & HBB_PREFIX_IN)
-        color = COLOR_MSGIN;
-      else
-        color = COLOR_GENERAL;
-
-      if (color != COLOR_GENERAL)
-        wbkgdset(win_entry->win, get_color(color));
-
-      // Generate the prefix area and display it
-
-      timelen = scr_line_prefix(line, pref, prefixwidth);
-      if (timelen && line->flags & HBB_PREFIX_DELAYED) {
-        char tmp;
-
-        tmp = pref[timelen];
-        pref[timelen] = '\0';
-        wbkgdset(win_entry->win, get_color(COLOR_TIMESTAMP));
-        wprintw(win_entry->win, "%s", pref);
-        pref[timelen] = tmp;
-        wbkgdset(win_entry->win, get_color(color));
-        wprintw(win_entry->win, "%s", pref+timelen);
-      } else
-        wprintw(win_entry->win, "%s", pref);
-
-      // Make sure we are at the right position
-      wmove(win_entry->win, winy, prefixwidth-1);
-
-      // The MUC nick - overwrite with proper color
-      if (line->mucnicklen) {
-        char *mucjid;
-        char tmp;
-        nickcolor_t *actual = NULL;
-        muccol_t type, *typetmp;
-
-        // Store the char after the nick
-        tmp = line->text[line->mucnicklen];
-        type = glob_muccol;
-        // Terminate the string after the nick
-        line->text[line->mucnicklen] = '\0';
-        mucjid = g_utf8_strdown(CURRENT_JID, -1);
-        if (muccolors) {
-          typetmp = g_hash_table_lookup(muccolors, mucjid);
-          if (typetmp)
-            type = *typetmp;
-        }
-        g_free(mucjid);
-        // Need to generate a color for the specified nick?
-        if ((type == MC_ALL) && (!nickcolors ||
-            !g_hash_table_lookup(nickcolors, line->text))) {
-          char *snick, *mnick;
-          nickcolor_t *nc;
-          const char *p = line->text;
-          unsigned int nicksum = 0;
-          snick = g_strdup(line->text);
-          mnick = g_strdup(line->text);
-          nc = g_new(nickcolor_t, 1);
-          ensure_string_htable(&nickcolors, NULL);
-          while (*p)
-            nicksum += *p++;
-          nc->color = nickcols[nicksum % nickcolcount];
-          nc->manual = FALSE;
-          *snick = '<';
-          snick[strlen(snick)-1] = '>';
-          *mnick = '*';
-          mnick[strlen(mnick)-1] = ' ';
-          // Insert them
-          g_hash_table_insert(nickcolors, snick, nc);
-          g_hash_table_insert(nickcolors, mnick, nc);
-        }
-        if (nickcolors)
-          actual = g_hash_table_lookup(nickcolors, line->text);
-        if (actual && ((type == MC_ALL) || (actual->manual))
-            && (line->flags & HBB_PREFIX_IN) &&
-           (!(line->flags & HBB_PREFIX_HLIGHT_OUT)))
-          wbkgdset(win_entry->win, compose_color(actual->color));
-        wprintw(win_entry->win, "%s", line->text);
-        // Return the char
-        line->text[line->mucnicklen] = tmp;
-        // Return the color back
-        wbkgdset(win_entry->win, get_color(color));
-      }
-
-      // Display text line
-      wprintw(win_entry->win, "%s", line->text+line->mucnicklen);
-      wclrtoeol(win_entry->win);
-
-      // Restore default ("general") color
-      if (color != COLOR_GENERAL)
-        wbkgdset(win_entry->win, get_color(COLOR_GENERAL));
+      scr_draw_chat_line(win_entry, line, winy, prefixwidth);
 
 scr_update_window_skipline:
       skipline = FALSE;
@@ -1390,6 +1921,17 @@ scr_update_window_skipline:
   }
 
   g_free(lines);
+
+  // Remember what is displayed
+  win_entry->shown.valid = !win_entry->bd->top;
+  win_entry->shown.rows = rows;
+  win_entry->shown.height = CHAT_WIN_HEIGHT;
+  win_entry->shown.width = scr_gettextwidth();
+  win_entry->shown.prefixwidth = prefixwidth;
+  win_entry->shown.appended = win_entry->bd->appended;
+  win_entry->shown.changes = win_entry->bd->changes;
+  win_entry->shown.gen = chatwin_gen;
+  win_entry->shown.readmark = has_readmark;
 }
 
 static winbuf_t *scr_create_window(const char *winId, int special, int dont_show)
@@ -1534,8 +2076,36 @@ static void scr_write_in_window(const char *winId, const char *text,
     g_free(nicklocaltmp);
     g_free(nicktmp);
   }
-  hbuf_add_line(&win_entry->bd->hbuf, text_locale, timestamp, prefix_flags,
-                scr_gettextwidth(), num_history_blocks, mucnicklen, xep184);
+  {
+    GList *oldlast = g_list_last(win_entry->bd->hbuf);
+    GList *el;
+    guint nlines = 0;
+
+    if (special) {
+      // The status buffer lines are wrapped when it is displayed
+      // (see scr_update_window()).  Old messages are not evicted
+      // while the top line is set.
+      if (scr_status_add_line(&win_entry->bd->hbuf, text_locale, timestamp,
+                              dont_show ? 0 : scr_gettextwidth(),
+                              !win_entry->bd->lock && !win_entry->bd->top) &&
+          statusring.messages < CHAT_WIN_HEIGHT)
+        win_entry->bd->changes++;
+    } else {
+      hbuf_add_line(&win_entry->bd->hbuf, text_locale, timestamp,
+                    prefix_flags, scr_gettextwidth(), num_history_blocks,
+                    mucnicklen, xep184);
+    }
+
+    // Count the new lines (we don't need more than the window height)
+    for (el = g_list_last(win_entry->bd->hbuf); el && el != oldlast;
+         el = g_list_previous(el))
+      if (++nlines > CHAT_WIN_HEIGHT)
+        break;
+    if (!oldlast || !el)
+      win_entry->bd->changes++;
+    else
+      win_entry->bd->appended += nlines;
+  }
   g_free(text_locale);
 
   if (win_entry->bd->cleared) {
@@ -1559,14 +2129,24 @@ static void scr_write_in_window(const char *winId, const char *text,
       setmsgflg = TRUE;
     else
       // If this is an outgoing message, remove the readmark
-      if (!special && (prefix_flags & (HBB_PREFIX_OUT|HBB_PREFIX_HLIGHT_OUT)))
+      if (!special && (prefix_flags & (HBB_PREFIX_OUT|HBB_PREFIX_HLIGHT_OUT))) {
         hbuf_set_readmark(win_entry->bd->hbuf, FALSE);
+        // Removing a mark which isn't displayed doesn't need a repaint
+        if (win_entry->shown.readmark || win_entry->bd->refcount)
+          win_entry->bd->changes++;
+      }
     // Show and refresh the window
-    top_panel(win_entry->panel);
-    scr_update_window(win_entry);
-    top_panel(inputPanel);
-    update_panels();
-  } else if (settings_opt_get_int("clear_unread_on_carbon") &&
+    // The current window is redrawn with the next frame, so that a flood
+    // of messages doesn't cause a repaint for every single line.
+    if (win_entry == currentWindow) {
+      frame.chat_dirty = TRUE;
+    } else {
+      top_panel(win_entry->panel);
+      scr_update_window(win_entry);
+      top_panel(inputPanel);
+      update_panels();
+    }
+  } else if (settings_opt_slot_int(OPT_SLOT_CLEAR_UNREAD_ON_CARBON) &&
              prefix_flags & HBB_PREFIX_OUT &&
              prefix_flags & HBB_PREFIX_CARBON) {
     clearmsgflg = TRUE;
@@ -1615,20 +2195,18 @@ void scr_init_settings(void)
 
 static unsigned int attention_sign(void)
 {
-  const char *as = settings_opt_get("attention_char");
+  const char *as = settings_opt_slot_str(OPT_SLOT_ATTENTION_CHAR);
   if (!as)
       return DEFAULT_ATTENTION_CHAR;
   return get_char(as);
 }
 
-//  scr_update_main_status(forceupdate)
+//  scr_draw_main_status()
 // Redraw the main (bottom) status line.
-// You can set forceupdate to FALSE in order to optimize screen refresh
-// if you call top_panel()/update_panels() later.
-void scr_update_main_status(int forceupdate)
+static void scr_draw_main_status(void)
 {
   char *sm = from_utf8(xmpp_getstatusmsg());
-  const char *info = settings_opt_get("info");
+  const char *info = settings_opt_slot_str(OPT_SLOT_INFO);
   guint prio = 0;
   gpointer unread_ptr;
   guint unreadchar;
@@ -1660,13 +2238,19 @@ void scr_update_main_status(int forceupdate)
   } else
     mvwprintw(mainstatusWnd, 0, 0, "%lc[%c] %s", unreadchar,
               imstatus2char[xmpp_getstatus()], (sm ? sm : ""));
-  if (forceupdate) {
-    top_panel(inputPanel);
-    update_panels();
-  }
   g_free(sm);
 }
 
+//  scr_update_main_status(forceupdate)
+// Mark the main (bottom) status line dirty; it will be redrawn with the
+// next frame.  Set forceupdate to TRUE to render that frame without delay.
+void scr_update_main_status(int forceupdate)
+{
+  frame.main_status_dirty = TRUE;
+  if (forceupdate)
+    frame.force = TRUE;
+}
+
 //  scr_draw_main_window()
 // Set fullinit to TRUE to also create panels.  Set it to FALSE for a resize.
 //
@@ -1777,6 +2361,7 @@ void scr_draw_main_window(unsigned int fullinit)
 
     werase(chatWnd);
   }
+  rosterwin.valid = FALSE;
 
   /* Draw/init windows */
 
@@ -1869,6 +2454,7 @@ static void resize_win_buffer(gpointer key, gpointer value, gpointer data)
   wresize(wbp->win, dim->l, dim->c);
   mvwin(wbp->win, chat_y_pos, chat_x_pos);
   werase(wbp->win);
+  wbp->shown.valid = FALSE;
   // If a panel exists, replace the old window with the new
   if (wbp->panel)
     replace_panel(wbp->panel, wbp->win);
@@ -1876,8 +2462,10 @@ static void resize_win_buffer(gpointer key, gpointer value, gpointer data)
   wbp->bd->top = hbuf_previous_persistent(wbp->bd->top);
 
   new_chatwidth = maxX - Roster_Width - scr_getprefixwidth();
-  if (new_chatwidth != prev_chatwidth)
+  if (new_chatwidth != prev_chatwidth) {
     hbuf_rebuild(&wbp->bd->hbuf, new_chatwidth);
+    wbp->bd->changes++;
+  }
 }
 
 //  scr_resize()
@@ -1930,9 +2518,21 @@ void sigwinch_resize(void)
 #endif
 
 //  scr_update_chat_status(forceupdate)
-// Redraw the buddy status bar.
-// Set forceupdate to TRUE if update_panels() must be called.
+// Mark the buddy status bar dirty; it will be redrawn with the next frame.
+// Set forceupdate to TRUE to render that frame without delay.
 void scr_update_chat_status(int forceupdate)
+{
+  // Usually we need to update the bottom status line too,
+  // at least to refresh the pending message flag.
+  frame.main_status_dirty = TRUE;
+  frame.chat_status_dirty = TRUE;
+  if (forceupdate)
+    frame.force = TRUE;
+}
+
+//  scr_draw_chat_status()
+// Redraw the buddy status bar.
+static void scr_draw_chat_status(void)
 {
   unsigned short btype, isgrp, ismuc, isspe;
   const char *btypetext = "Unknown";
@@ -1943,19 +2543,11 @@ void scr_update_chat_status(int forceupdate)
   char status;
   char *buf, *buf_locale;
 
-  // Usually we need to update the bottom status line too,
-  // at least to refresh the pending message flag.
-  scr_update_main_status(FALSE);
-
   // Clear the line
   werase(chatstatusWnd);
 
-  if (!current_buddy) {
-    if (forceupdate) {
-      update_panels();
-    }
+  if (!current_buddy)
     return;
-  }
 
   fullname = buddy_getname(BUDDATA(current_buddy));
   btype = buddy_gettype(BUDDATA(current_buddy));
@@ -1997,9 +2589,6 @@ void scr_update_chat_status(int forceupdate)
     buf_locale = from_utf8(fullname);
     mvwprintw(chatstatusWnd, 0, 5, "%s: %s", btypetext, buf_locale);
     g_free(buf_locale);
-    if (forceupdate) {
-      update_panels();
-    }
     return;
   }
 
@@ -2076,11 +2665,6 @@ void scr_update_chat_status(int forceupdate)
     if (eventchar)
       mvwprintw(chatstatusWnd, 0, maxX-3, "[%c]", eventchar);
   }
-
-
-  if (forceupdate) {
-    update_panels();
-  }
 }
 
 void increment_if_buddy_not_filtered(gpointer rosterdata, void *param)
@@ -2090,22 +2674,215 @@ void increment_if_buddy_not_filtered(gpointer rosterdata, void *param)
     *p=*p+1;
 }
 
+static void free_roster_row(roster_row_t *row)
+{
+  g_free(row->text);
+  g_free(row);
+}
+
+//  scr_render_roster_row(rosterdata, selected, row)
+// Build the roster line of the given roster item.
+static void scr_render_roster_row(gpointer rosterdata, gboolean selected,
+                                  roster_row_t *row)
+{
+  const roster_view_t *view = &rosterwin.view;
+  char *name, *rline, *unread;
+  guint status, pending;
+  unsigned short bflags, btype;
+  unsigned short ismsg, isgrp, ismuc, ishid, isspe;
+  guint isurg;
+  char space[2] = " ";
+
+  if (view->prefix_length == 6)
+    space[0] = '\0';
+
+  bflags = buddy_getflags(rosterdata);
+  btype = buddy_gettype(rosterdata);
+
+  ismsg = bflags & ROSTER_FLAG_MSG;
+  ishid = bflags & ROSTER_FLAG_HIDE;
+  isgrp = btype  & ROSTER_TYPE_GROUP;
+  ismuc = btype  & ROSTER_TYPE_ROOM;
+  isspe = btype  & ROSTER_TYPE_SPECIAL;
+  isurg = buddy_getuiprio(rosterdata);
+
+  status = '?';
+  pending = ' ';
+
+  if (!ismuc) {
+    // There is currently no chat state support for MUC
+    guint events = buddy_getevents(rosterdata);
+    if (events & ROSTER_EVENT_COMPOSING)
+      pending = '+';
+    else if (events & ROSTER_EVENT_PAUSED)
+      pending = '.';
+  }
+
+  // Display message notice if there is a message flag, but not
+  // for unfolded groups.
+  if (ismsg && (!isgrp || ishid)) {
+    pending = '#';
+  }
+
+  if (ismuc) {
+    if (buddy_getinsideroom(rosterdata))
+      status = 'C';
+    else
+      status = 'x';
+  } else if (view->mystatus != offline) {
+    enum imstatus budstate;
+    budstate = buddy_getstatus(rosterdata, NULL);
+    if (budstate < imstatus_size)
+      status = imstatus2char[budstate];
+  }
+  if (selected) {
+    if (pending == '#')
+      row->color = get_color(COLOR_ROSTERSELNMSG);
+    else
+      row->color = get_color(COLOR_ROSTERSEL);
+  } else {
+    if (pending == '#')
+      row->color = get_color(COLOR_ROSTERNMSG);
+    else {
+      int color = get_color(COLOR_ROSTER);
+      if ((!isspe) && (!isgrp)) // Look for color rules
+        rostercolor_lookup(buddy_getjid(rosterdata), status, &color);
+      row->color = color;
+    }
+  }
+
+  name = g_new0(char, 4*Roster_Width);
+  unread = g_new0(char, Roster_Width+1);
+  rline = g_new0(char, 4*Roster_Width+1);
+
+  if (Roster_Width > view->prefix_length) {
+    g_utf8_strncpy(name, buddy_getname(rosterdata),
+                   Roster_Width-view->prefix_length);
+    if (view->show_unread) {
+      guint unread_count = buddy_getunread(rosterdata);
+      glong name_length = g_utf8_strlen(name, 4*Roster_Width);
+      if (unread_count > 0 &&
+          Roster_Width > view->prefix_length + name_length) {
+        snprintf(unread, Roster_Width-(view->prefix_length+name_length)+1,
+                 " (%u)", unread_count);
+      }
+    }
+  }
+
+  if (pending == '#') {
+    // Attention sign?
+    if ((ismuc && isurg >= ui_attn_sign_prio_level_muc) ||
+        (!ismuc && isurg >= ui_attn_sign_prio_level))
+      pending = view->attn_sign;
+  }
+
+  if (isgrp) {
+    if (ishid) {
+      int group_count = 0;
+      foreach_group_member(rosterdata, increment_if_buddy_not_filtered,
+                           &group_count);
+      snprintf(rline, 4*Roster_Width, "%s%lc+++ %s (%i)", space, pending,
+               name, group_count);
+      /* Do not display the item count if there isn't enough space */
+      if (g_utf8_strlen(rline, 4*Roster_Width) >= Roster_Width)
+        snprintf(rline, 4*Roster_Width, "%s%lc+++ %s", space, pending, name);
+    }
+    else
+      snprintf(rline, 4*Roster_Width, "%s%lc--- %s", space, pending, name);
+  } else if (isspe) {
+    snprintf(rline, 4*Roster_Width, "%s%lc%s", space, pending, name);
+  } else {
+    char sepleft  = '[';
+    char sepright = ']';
+    if (btype & ROSTER_TYPE_USER) {
+      guint subtype = buddy_getsubscription(rosterdata);
+      if (status == '_' && !(subtype & sub_to))
+        status = '?';
+      if (!(subtype & sub_from)) {
+        sepleft  = '{';
+        sepright = '}';
+      }
+    }
+    snprintf(rline, 4*Roster_Width, "%s%lc%c%c%c %s%s",
+             space, pending, sepleft, status, sepright, name, unread);
+  }
+
+  g_free(row->text);
+  row->text = from_utf8(rline);
+  row->revision = buddy_getrevision(rosterdata);
+  row->selected = selected;
+  row->serial = ++rosterwin.serial;
+  if (row->serial == ROSTER_ROW_EMPTY)
+    row->serial = ++rosterwin.serial;
+  rosterwin.rendered++;
+
+  g_free(rline);
+  g_free(unread);
+  g_free(name);
+}
+
+//  scr_get_roster_row(rosterdata, selected)
+// Return the (cached) roster line of the given roster item.
+static roster_row_t *scr_get_roster_row(gpointer rosterdata, gboolean selected)
+{
+  roster_row_t *row = g_hash_table_lookup(rosterwin.rows, rosterdata);
+
+  if (!row) {
+    row = g_new0(roster_row_t, 1);
+    g_hash_table_insert(rosterwin.rows, rosterdata, row);
+  } else if (row->revision == buddy_getrevision(rosterdata) &&
+             row->selected == selected) {
+    row->frame = rosterwin.frame;
+    return row;
+  }
+  scr_render_roster_row(rosterdata, selected, row);
+  row->frame = rosterwin.frame;
+  return row;
+}
+
+static gboolean roster_row_expired(gpointer key, gpointer value,
+                                   gpointer user_data)
+{
+  return ((roster_row_t *)value)->frame != rosterwin.frame;
+}
+
+//  scr_draw_roster_row(y, row)
+// Draw a roster line at position y in the roster window.
+// If row is NULL, the line is cleared.
+static void scr_draw_roster_row(int y, roster_row_t *row)
+{
+  const roster_view_t *view = &rosterwin.view;
+  int n;
+
+  if (row && row->selected)
+    wbkgdset(rosterWnd, row->color); // Color the whole line
+  else
+    wbkgdset(rosterWnd, get_color(COLOR_GENERAL));
+  wmove(rosterWnd, y, view->x_pos);
+  for (n = 0; n < view->maxx; n++)
+    waddch(rosterWnd, ' ');
+
+  rosterwin.shown[y] = row ? row->serial : ROSTER_ROW_EMPTY;
+  rosterwin.drawn++;
+  if (!row)
+    return;
+
+  wbkgdset(rosterWnd, row->color);
+  mvwprintw(rosterWnd, y, view->x_pos, "%s", row->text);
+  // If the line was too long, the next one has been overwritten
+  if (getcury(rosterWnd) > y && y+1 < view->maxy)
+    rosterwin.shown[y+1] = 0;
+}
+
 //  scr_draw_roster()
 // Display the buddylist (not really the roster) on the screen
 void scr_draw_roster(void)
 {
-  static int offset = 0;
-  char *name, *rline, *unread;
+  roster_view_t view;
   int maxx, maxy;
   GList *buddy;
-  int i, n;
-  int rOffset;
+  int i, offset;
   int cursor_backup;
-  guint status, pending;
-  enum imstatus currentstatus = xmpp_getstatus();
-  int x_pos;
-  int prefix_length;
-  char space[2] = " ";
 
   // We can reset update_roster
   if (_update_roster == FALSE)
@@ -2120,37 +2897,91 @@ void scr_draw_roster(void)
   cursor_backup = curs_set(0);
 
   if (!buddylist)
-    offset = 0;
+    rosterwin.offset = 0;
   else
     scr_update_chat_status(FALSE);
 
-  // Cleanup of roster window
-  wbkgdset(rosterWnd, get_color(COLOR_GENERAL)); // clear background color
-  werase(rosterWnd);
+  // Leave now if buddylist is empty or the roster is hidden
+  if (!buddylist || !Roster_Width) {
+    // Cleanup of roster window
+    wbkgdset(rosterWnd, get_color(COLOR_GENERAL)); // clear background color
+    werase(rosterWnd);
+    if (Roster_Width) {
+      int line_x_pos = roster_win_on_right ? 0 : Roster_Width-1;
+      // Redraw the vertical line (not very good...)
+      for (i=0 ; i < CHAT_WIN_HEIGHT ; i++)
+        mvwaddch(rosterWnd, i, line_x_pos, ACS_VLINE);
+    }
+    rosterwin.valid = FALSE;
+    update_panels();
+    curs_set(cursor_backup);
+    return;
+  }
 
-  if (Roster_Width) {
+  // Check whether the cached lines can still be used
+  memset(&view, 0, sizeof(view));
+  view.maxx = maxx;
+  view.maxy = maxy;
+  view.x_pos = roster_win_on_right ? 1 : 0; // 1 char offset (vertical line)
+  if (settings_opt_slot_int(OPT_SLOT_ROSTER_NO_LEADING_SPACE) == 1)
+    view.prefix_length = 6;
+  else
+    view.prefix_length = 7;
+  view.show_unread = settings_opt_slot_int(OPT_SLOT_ROSTER_SHOW_UNREAD_COUNT);
+  view.mystatus = xmpp_getstatus();
+  view.filter = buddylist_get_filter();
+  view.attn_sign = attention_sign();
+  view.gen = rosterwin_gen;
+
+  if (!rosterwin.valid || memcmp(&view, &rosterwin.view, sizeof(view))) {
     int line_x_pos = roster_win_on_right ? 0 : Roster_Width-1;
+
+    if (rosterwin.rows)
+      g_hash_table_remove_all(rosterwin.rows);
+    else
+      rosterwin.rows = g_hash_table_new_full(NULL, NULL, NULL,
+                                             (GDestroyNotify)free_roster_row);
+    g_free(rosterwin.shown);
+    rosterwin.shown = g_new0(guint, maxy);
+    rosterwin.view = view;
+    rosterwin.valid = TRUE;
+
+    // Cleanup of roster window
+    wbkgdset(rosterWnd, get_color(COLOR_GENERAL)); // clear background color
+    werase(rosterWnd);
     // Redraw the vertical line (not very good...)
     for (i=0 ; i < CHAT_WIN_HEIGHT ; i++)
       mvwaddch(rosterWnd, i, line_x_pos, ACS_VLINE);
   }
 
-  // Leave now if buddylist is empty or the roster is hidden
-  if (!buddylist || !Roster_Width) {
-    update_panels();
-    curs_set(cursor_backup);
-    return;
+  if (rosterwin.listgen != buddylist_get_generation() || !rosterwin.top) {
+    rosterwin.listgen = buddylist_get_generation();
+    rosterwin.listlen = g_list_length(buddylist);
+    rosterwin.top = NULL;
   }
+  offset = rosterwin.offset;
 
   // Update offset if necessary
   // a) Try to show as many buddylist items as possible
-  i = g_list_length(buddylist) - maxy;
+  i = rosterwin.listlen - maxy;
   if (i < 0)
     i = 0;
   if (i < offset)
     offset = i;
   // b) Make sure the current_buddy is visible
-  i = g_list_position(buddylist, current_buddy);
+  i = -1;
+  if (rosterwin.top && offset == rosterwin.offset) {
+    // Look for it in the displayed items first
+    int n;
+    for (n = 0, buddy = rosterwin.top; n < maxy && buddy;
+         n++, buddy = g_list_next(buddy))
+      if (buddy == current_buddy) {
+        i = offset + n;
+        break;
+      }
+  }
+  if (i == -1)
+    i = g_list_position(buddylist, current_buddy);
   if (i == -1) { // This is bad
     scr_LogPrint(LPRINT_NORMAL, "Doh! Can't find current selected buddy!!");
     curs_set(cursor_backup);
@@ -2160,174 +2991,27 @@ void scr_draw_roster(void)
   } else if (i+1 > offset + maxy) {
     offset = i + 1 - maxy;
   }
+  if (!rosterwin.top || offset != rosterwin.offset)
+    rosterwin.top = g_list_nth(buddylist, offset);
+  rosterwin.offset = offset;
 
-  if (roster_win_on_right)
-    x_pos = 1; // 1 char offset (vertical line)
-  else
-    x_pos = 0;
-
-  if (settings_opt_get_int("roster_no_leading_space") == 1) {
-    space[0] = '\0';
-    prefix_length = 6;
-  } else {
-    prefix_length = 7;
-  }
-
-  name = g_new0(char, 4*Roster_Width);
-  unread = g_new0(char, Roster_Width+1);;
-  rline = g_new0(char, 4*Roster_Width+1);
-
-  buddy = buddylist;
-  rOffset = offset;
-
-  for (i=0; i<maxy && buddy; buddy = g_list_next(buddy)) {
-    unsigned short bflags, btype;
-    unsigned short ismsg, isgrp, ismuc, ishid, isspe;
-    guint isurg;
-    gchar *rline_locale;
-
-    bflags = buddy_getflags(BUDDATA(buddy));
-    btype = buddy_gettype(BUDDATA(buddy));
-
-    ismsg = bflags & ROSTER_FLAG_MSG;
-    ishid = bflags & ROSTER_FLAG_HIDE;
-    isgrp = btype  & ROSTER_TYPE_GROUP;
-    ismuc = btype  & ROSTER_TYPE_ROOM;
-    isspe = btype  & ROSTER_TYPE_SPECIAL;
-    isurg = buddy_getuiprio(BUDDATA(buddy));
-
-    if (rOffset > 0) {
-      rOffset--;
-      continue;
-    }
-
-    status = '?';
-    pending = ' ';
-
-    if (!ismuc) {
-      // There is currently no chat state support for MUC
-      GSList *resources = buddy_getresources(BUDDATA(buddy));
-      GSList *p_res;
-
-      for (p_res = resources ; p_res ; p_res = g_slist_next(p_res)) {
-        guint events = buddy_resource_getevents(BUDDATA(buddy),
-                                                p_res ? p_res->data : "");
-        if ((events & ROSTER_EVENT_PAUSED) && pending != '+')
-          pending = '.';
-        if (events & ROSTER_EVENT_COMPOSING)
-          pending = '+';
-        g_free(p_res->data);
-      }
-      g_slist_free(resources);
-    }
-
-    // Display message notice if there is a message flag, but not
-    // for unfolded groups.
-    if (ismsg && (!isgrp || ishid)) {
-      pending = '#';
-    }
-
-    if (ismuc) {
-      if (buddy_getinsideroom(BUDDATA(buddy)))
-        status = 'C';
-      else
-        status = 'x';
-    } else if (currentstatus != offline) {
-      enum imstatus budstate;
-      budstate = buddy_getstatus(BUDDATA(buddy), NULL);
-      if (budstate < imstatus_size)
-        status = imstatus2char[budstate];
-    }
-    if (buddy == current_buddy) {
-      if (pending == '#')
-        wbkgdset(rosterWnd, get_color(COLOR_ROSTERSELNMSG));
-      else
-        wbkgdset(rosterWnd, get_color(COLOR_ROSTERSEL));
-      // The 3 following lines aim at coloring the whole line
-      wmove(rosterWnd, i, x_pos);
-      for (n = 0; n < maxx; n++)
-        waddch(rosterWnd, ' ');
-    } else {
-      if (pending == '#')
-        wbkgdset(rosterWnd, get_color(COLOR_ROSTERNMSG));
-      else {
-        int color = get_color(COLOR_ROSTER);
-        if ((!isspe) && (!isgrp)) { // Look for color rules
-          GSList *head;
-          const char *bjid = buddy_getjid(BUDDATA(buddy));
-          for (head = rostercolrules; head; head = g_slist_next(head)) {
-            rostercolor_t *rc = head->data;
-            if (g_pattern_match_string(rc->compiled, bjid) &&
-                (!strcmp("*", rc->status) || strchr(rc->status, status))) {
-              color = compose_color(rc->color);
-              break;
-            }
-          }
-        }
-        wbkgdset(rosterWnd, color);
-      }
-    }
-
-    name[0] = 0;
-    unread[0] = 0;
-    if (Roster_Width > prefix_length) {
-      g_utf8_strncpy(name, buddy_getname(BUDDATA(buddy)), Roster_Width-prefix_length);
-      if (settings_opt_get_int("roster_show_unread_count")) {
-        guint unread_count = buddy_getunread(BUDDATA(buddy));
-        glong name_length = g_utf8_strlen(name, 4*Roster_Width);
-        if (unread_count > 0 && Roster_Width > prefix_length + name_length) {
-          snprintf(unread, Roster_Width-(prefix_length+name_length)+1, " (%u)", unread_count);
-        }
-      }
-    }
+  rosterwin.frame++;
 
-    if (pending == '#') {
-      // Attention sign?
-      if ((ismuc && isurg >= ui_attn_sign_prio_level_muc) ||
-          (!ismuc && isurg >= ui_attn_sign_prio_level))
-        pending = attention_sign();
-    }
+  for (i=0, buddy = rosterwin.top; i<maxy; i++) {
+    roster_row_t *row = NULL;
 
-    if (isgrp) {
-      if (ishid) {
-        int group_count = 0;
-        foreach_group_member(BUDDATA(buddy), increment_if_buddy_not_filtered,
-                             &group_count);
-        snprintf(rline, 4*Roster_Width, "%s%lc+++ %s (%i)", space, pending,
-                 name, group_count);
-        /* Do not display the item count if there isn't enough space */
-        if (g_utf8_strlen(rline, 4*Roster_Width) >= Roster_Width)
-          snprintf(rline, 4*Roster_Width, "%s%lc+++ %s", space, pending, name);
-      }
-      else
-        snprintf(rline, 4*Roster_Width, "%s%lc--- %s", space, pending, name);
-    } else if (isspe) {
-      snprintf(rline, 4*Roster_Width, "%s%lc%s", space, pending, name);
-    } else {
-      char sepleft  = '[';
-      char sepright = ']';
-      if (btype & ROSTER_TYPE_USER) {
-        guint subtype = buddy_getsubscription(BUDDATA(buddy));
-        if (status == '_' && !(subtype & sub_to))
-          status = '?';
-        if (!(subtype & sub_from)) {
-          sepleft  = '{';
-          sepright = '}';
-        }
-      }
-      snprintf(rline, 4*Roster_Width, "%s%lc%c%c%c %s%s",
-               space, pending, sepleft, status, sepright, name, unread);
+    if (buddy) {
+      row = scr_get_roster_row(BUDDATA(buddy), buddy == current_buddy);
+      buddy = g_list_next(buddy);
     }
-
-    rline_locale = from_utf8(rline);
-    mvwprintw(rosterWnd, i, x_pos, "%s", rline_locale);
-    g_free(rline_locale);
-    i++;
+    if (rosterwin.shown[i] != (row ? row->serial : ROSTER_ROW_EMPTY))
+      scr_draw_roster_row(i, row);
   }
 
-  g_free(rline);
-  g_free(unread);
-  g_free(name);
+  // Forget the lines of the items which are not displayed anymore
+  if (g_hash_table_size(rosterwin.rows) > 2 * (guint)maxy)
+    g_hash_table_foreach_remove(rosterwin.rows, roster_row_expired, NULL);
+
   top_panel(inputPanel);
   update_panels();
   curs_set(cursor_backup);
@@ -2415,6 +3099,7 @@ void scr_remove_receipt_flag(const char *bjid, gconstpointer xep184)
   winbuf_t *win_entry = scr_search_window(bjid, FALSE);
   if (win_entry && xep184) {
     hbuf_remove_receipt(win_entry->bd->hbuf, xep184);
+    win_entry->bd->changes++;
     if (chatmode && (buddy_search_jid(bjid) == current_buddy))
       scr_update_buddy_window();
   }
@@ -2931,8 +3616,10 @@ static gboolean buffer_purge(gpointer key, gpointer value, gpointer data)
 
   // Delete the current hbuf
   // unless we close the buffer *and* this is a shared bd structure
-  if (!(*p_closebuf && win_entry->bd->refcount))
+  if (!(*p_closebuf && win_entry->bd->refcount)) {
     hbuf_free(&win_entry->bd->hbuf);
+    win_entry->bd->changes++;
+  }
 
   if (*p_closebuf) {
     GSList *roster_elt;
@@ -2947,6 +3634,9 @@ static gboolean buffer_purge(gpointer key, gpointer value, gpointer data)
       g_free(win_entry->bd);
       win_entry->bd = NULL;
     }
+    if (win_entry->muccol.nicks)
+      g_hash_table_destroy(win_entry->muccol.nicks);
+    g_free(win_entry->muccol.jid);
   } else {
     win_entry->bd->cleared = FALSE;
     win_entry->bd->top = NULL;
@@ -3001,8 +3691,11 @@ void scr_buffer_purge(int closebuf, const char *jid)
     // (Special buffer)
     // Reset the current hbuf
     hbuf_free(&win_entry->bd->hbuf);
+    win_entry->bd->changes++;
     // Currently it can only be the status buffer
     statushbuf = NULL;
+    statusring.head = NULL;
+    statusring.messages = 0U;
     roster_msg_setflag(SPECIAL_BUFFER_STATUS_ID, TRUE, FALSE);
 
     win_entry->bd->cleared = FALSE;
@@ -3100,12 +3793,13 @@ void scr_buffer_readmark(gchar action)
   win_entry = scr_search_window(CURRENT_JID, isspe);
   if (!win_entry) return;
 
-  autolock = settings_opt_get_int("buffer_smart_scrolling");
+  autolock = settings_opt_slot_int(OPT_SLOT_BUFFER_SMART_SCROLLING);
   if (!win_entry->bd->lock || autolock) {
     if (action >= 0)
       hbuf_set_readmark(win_entry->bd->hbuf, action);
     else
       hbuf_remove_trailing_readmark(win_entry->bd->hbuf);
+    win_entry->bd->changes++;
   }
 }
 
@@ -3409,8 +4103,10 @@ void scr_setattentionflag_if_needed(const char *bjid, int special,
 //  0 = disabled / 1 = multimode / 2 = multimode verbatim (commands disabled)
 void scr_set_multimode(int enable, char *subject)
 {
-  g_free(multiline);
-  multiline = NULL;
+  if (multiline) {
+    g_string_free(multiline, TRUE);
+    multiline = NULL;
+  }
 
   g_free(multimode_subj);
   if (enable && subject)
@@ -3426,7 +4122,7 @@ void scr_set_multimode(int enable, char *subject)
 const char *scr_get_multiline(void)
 {
   if (multimode && multiline)
-    return multiline;
+    return multiline->str;
   return NULL;
 }
 
@@ -3451,32 +4147,29 @@ void scr_append_multiline(const char *line)
     return;
   }
   if (multiline) {
-    int len = strlen(multiline)+strlen(line)+2;
-    if (len >= HBB_BLOCKSIZE - 1) {
-      // We don't handle single messages with size > HBB_BLOCKSIZE
-      // (see hbuf)
+    if (multiline->len + strlen(line) + 1 >= HBB_MAX_MSGSIZE) {
       scr_LogPrint(LPRINT_NORMAL, "Your multi-line message is too big, "
                    "this line has not been added.");
       scr_LogPrint(LPRINT_NORMAL, "Please send this part now...");
       return;
     }
     if (num >= MULTILINE_MAX_LINE_NUMBER) {
-      // We don't allow too many lines; however the maximum is arbitrary
-      // (It should be < 1000 yet)
+      // The history log format limits the number of lines
       scr_LogPrint(LPRINT_NORMAL, "Your message has too many lines, "
                    "this one has not been added.");
       scr_LogPrint(LPRINT_NORMAL, "Please send this part now...");
       return;
     }
-    multiline = g_renew(char, multiline, len);
-    strcat(multiline, "\n");
-    strcat(multiline, line);
+    // The buffer grows geometrically, so composing a long message
+    // takes linear time.
+    g_string_append_c(multiline, '\n');
+    g_string_append(multiline, line);
     num++;
   } else {
     // First message line (we skip leading empty lines)
     num = 0;
     if (line[0]) {
-      multiline = g_strdup(line);
+      multiline = g_string_new(line);
       num++;
     } else
       return;
@@ -4065,54 +4758,45 @@ static void scr_handle_tab(gboolean fwd)
   }
 
   if (!completion_started) {
-    guint dynlist;
-    GSList *list;
+    guint n;
+    char *prefix;
 
     if (!compl_categ)
       return; // Nothing to complete
 
-    list = compl_get_category_list(compl_categ, &dynlist);
-    if (list) {
-      guint n;
-      char *prefix = g_strndup(row, ptr_inputline-row);
-      // Init completion
-      n = new_completion(prefix, list,
-                         (compl_categ == COMPL_RESOURCE ?
-                          settings_opt_get("muc_completion_suffix") : NULL));
-      g_free(prefix);
-      if (n == 0 && nrow == -1) {
-        // This is a MUC room and we can't complete from the beginning of the
-        // line.  Let's try a bit harder and complete the current word.
-        row = prev_char(ptr_inputline, inputLine);
-        while (row >= inputLine) {
-          if (iswspace(get_char(row)) || get_char(row) == '(') {
-              row = next_char((char*)row);
-              break;
-          }
-          if (row == inputLine)
+    prefix = g_strndup(row, ptr_inputline-row);
+    // Init completion
+    n = new_category_completion(compl_categ, prefix,
+                                (compl_categ == COMPL_RESOURCE ?
+                                 settings_opt_get("muc_completion_suffix") :
+                                 NULL));
+    g_free(prefix);
+    if (n == 0 && nrow == -1) {
+      // This is a MUC room and we can't complete from the beginning of the
+      // line.  Let's try a bit harder and complete the current word.
+      row = prev_char(ptr_inputline, inputLine);
+      while (row >= inputLine) {
+        if (iswspace(get_char(row)) || get_char(row) == '(') {
+            row = next_char((char*)row);
             break;
-          row = prev_char((char*)row, inputLine);
-        }
-        // There's no need to try again if row == inputLine
-        if (row > inputLine) {
-          prefix = g_strndup(row, ptr_inputline-row);
-          new_completion(prefix, list, NULL);
-          g_free(prefix);
         }
+        if (row == inputLine)
+          break;
+        row = prev_char((char*)row, inputLine);
       }
-      // Free the list if it's a dynamic one
-      if (dynlist) {
-        GSList *slp;
-        for (slp = list; slp; slp = g_slist_next(slp))
-          g_free(slp->data);
-        g_slist_free(list);
+      // There's no need to try again if row == inputLine
+      if (row > inputLine) {
+        done_completion();
+        prefix = g_strndup(row, ptr_inputline-row);
+        new_category_completion(compl_categ, prefix, NULL);
+        g_free(prefix);
       }
-      // Now complete
-      cchar = complete(fwd);
-      if (cchar)
-        scr_insert_text(cchar);
-      completion_started = TRUE;
     }
+    // Now complete
+    cchar = complete(fwd);
+    if (cchar)
+      scr_insert_text(cchar);
+    completion_started = TRUE;
   } else {      // Completion already initialized
     scr_cancel_current_completion();
     // Now complete again
@@ -4208,10 +4892,8 @@ static inline void print_checked_line(void)
 static inline void refresh_inputline(void)
 {
 #if defined(WITH_ENCHANT) || defined(WITH_ASPELL)
-  if (settings_opt_get_int("spell_enable") && (chatmode || !vi_mode)) {
-    memset(maskLine, 0, INPUTLINE_LENGTH+1);
+  if (settings_opt_slot_int(OPT_SLOT_SPELL_ENABLE) && (chatmode || !vi_mode))
     spellcheck(inputLine, maskLine);
-  }
   print_checked_line();
   wclrtoeol(inputWnd);
   if (*ptr_inputline) {
@@ -4263,6 +4945,51 @@ static void add_keyseq(char *seqstr, guint mkeycode, gint value)
   ks->mkeycode = mkeycode;
   ks->value = value;
   keyseqlist = g_slist_append(keyseqlist, ks);
+  keyseqtrie_stale = TRUE;
+}
+
+static void keyseq_trie_free(keyseq_node_t *node)
+{
+  while (node) {
+    keyseq_node_t *next = node->next;
+    keyseq_trie_free(node->child);
+    g_free(node);
+    node = next;
+  }
+}
+
+//  keyseq_trie_build()
+// (Re)build the key sequences trie from keyseqlist.
+static void keyseq_trie_build(void)
+{
+  GSList *ksl;
+
+  keyseq_trie_free(keyseqtrie);
+  keyseqtrie = NULL;
+
+  for (ksl = keyseqlist; ksl; ksl = g_slist_next(ksl)) {
+    keyseq_t *ksp = ksl->data;
+    keyseq_node_t **level = &keyseqtrie;
+    keyseq_node_t *node = NULL;
+    const char *p;
+
+    for (p = ksp->seqstr; *p; p++) {
+      for (node = *level; node && node->c != (unsigned char)*p;
+           node = node->next)
+        ;
+      if (!node) {
+        node = g_new0(keyseq_node_t, 1);
+        node->c = (unsigned char)*p;
+        node->next = *level;
+        *level = node;
+      }
+      level = &node->child;
+    }
+    // The first registered sequence wins
+    if (node && !node->match)
+      node->match = ksp;
+  }
+  keyseqtrie_stale = FALSE;
 }
 
 //  match_keyseq(iseq, &ret)
@@ -4274,37 +5001,58 @@ static void add_keyseq(char *seqstr, guint mkeycode, gint value)
 //     and *ret is set to the matching keyseq structure.
 static inline gint match_keyseq(int *iseq, keyseq_t **ret)
 {
-  GSList *ksl;
-  keyseq_t *ksp;
-  char *p, c;
+  keyseq_node_t *node = NULL, *level;
   int *i;
-  int needmore = FALSE;
 
-  for (ksl = keyseqlist; ksl; ksl = g_slist_next(ksl)) {
-    ksp = ksl->data;
-    p = ksp->seqstr;
-    i = iseq;
-    while (1) {
-      c = (unsigned char)*i;
-      if (!*p && !c) { // Match
-        (*ret) = ksp;
-        return ksp->mkeycode;
-      }
-      if (!c) {
-        // iseq is too short
-        needmore = TRUE;
-        break;
-      } else if (!*p || c != *p) {
-        // This isn't a match
-        break;
-      }
-      p++; i++;
-    }
+  if (keyseqtrie_stale)
+    keyseq_trie_build();
+
+  level = keyseqtrie;
+  for (i = iseq; (unsigned char)*i; i++) {
+    unsigned char c = (unsigned char)*i;
+    for (node = level; node && node->c != c; node = node->next)
+      ;
+    if (!node) // This isn't a match
+      return -1;
+    level = node->child;
   }
 
-  if (needmore)
-    return 0;
-  return -1;
+  if (node && node->match) { // Match
+    (*ret) = node->match;
+    return node->match->mkeycode;
+  }
+  // iseq is too short
+  return level ? 0 : -1;
+}
+
+//  scr_match_keyseq(seq, &mkeycode, &value)
+// Look up the escape key sequence "seq" (without the leading ESC), as
+// scr_getch() does when reading a key.  The default key sequences are
+// registered if needed.
+// Return value: see match_keyseq().  When "seq" matches a key sequence,
+// *mkeycode and *value are set.
+gint scr_match_keyseq(const char *seq, guint *mkeycode, gint *value)
+{
+  keyseq_t *mks = NULL;
+  int ks[MAX_KEYSEQ_LENGTH+1];
+  gint match;
+  int i;
+
+  if (!keyseqlist)
+    init_keycodes();
+
+  for (i = 0; i < MAX_KEYSEQ_LENGTH && seq[i]; i++)
+    ks[i] = (unsigned char)seq[i];
+  if (seq[i])
+    return -1;
+  ks[i] = 0;
+
+  match = match_keyseq(ks, &mks);
+  if (match > 0) {
+    *mkeycode = mks->mkeycode;
+    *value = mks->value;
+  }
+  return match;
 }
 
 static inline int match_utf8_keyseq(int *iseq)
@@ -4422,6 +5170,111 @@ void scr_do_update(void)
   doupdate();
 }
 
+static gboolean scr_frame_timeout(gpointer data)
+{
+  frame.timer = 0;
+  // The frame will be rendered by the main loop, after this iteration.
+  return FALSE;
+}
+
+//  scr_frame_render()
+// Render the pending screen updates (dirty chat window, roster, status
+// bars).  This is called by the main loop after each iteration.  If the
+// last frame is too recent, the rendering is delayed and the updates are
+// coalesced with the next ones.
+void scr_frame_render(void)
+{
+  gint64 now, interval = 0;
+  int fps;
+
+  if (!frame.force && !frame.chat_dirty && !_update_roster &&
+      !frame.main_status_dirty && !frame.chat_status_dirty) {
+    // Nothing to render; just flush what has been drawn directly.
+    scr_do_update();
+    return;
+  }
+
+  now = g_get_monotonic_time();
+
+  fps = settings_opt_slot_int(OPT_SLOT_MAX_FRAME_RATE);
+  if (fps > 0)
+    interval = G_USEC_PER_SEC / fps;
+
+  if (!frame.force && interval && now - frame.last < interval) {
+    frame.coalesced++;
+    if (!frame.timer) {
+      guint delay = (interval - (now - frame.last) + 999) / 1000;
+      frame.timer = g_timeout_add(delay, scr_frame_timeout, NULL);
+    }
+    return;
+  }
+
+  if (frame.timer) {
+    g_source_remove(frame.timer);
+    frame.timer = 0;
+  }
+  frame.force = FALSE;
+  frame.last = now;
+  frame.rendered++;
+
+  if (frame.chat_dirty) {
+    frame.chat_dirty = FALSE;
+    if (chatmode && currentWindow) {
+      top_panel(currentWindow->panel);
+      scr_update_window(currentWindow);
+    }
+  }
+  scr_draw_roster();
+  if (frame.chat_status_dirty) {
+    frame.chat_status_dirty = FALSE;
+    scr_draw_chat_status();
+  }
+  if (frame.main_status_dirty) {
+    frame.main_status_dirty = FALSE;
+    scr_draw_main_status();
+  }
+  top_panel(inputPanel);
+  update_panels();
+  scr_do_update();
+}
+
+//  scr_frame_force()
+// Render the next frame without delay (e.g. after a key press).
+void scr_frame_force(void)
+{
+  frame.force = TRUE;
+}
+
+//  scr_frame_stats(*rendered, *coalesced)
+// Get the frame scheduler counters.
+void scr_frame_stats(guint *rendered, guint *coalesced)
+{
+  if (rendered)
+    *rendered = frame.rendered;
+  if (coalesced)
+    *coalesced = frame.coalesced;
+}
+
+//  scr_chatwin_stats(*full, *incremental, *lines)
+// Get the chat windows rendering counters: full repaints, incremental
+// updates (only the new lines are drawn) and buffer lines drawn.
+void scr_chatwin_stats(guint *full, guint *incremental, guint *lines)
+{
+  if (full)
+    *full = chatwin_stats.full;
+  if (incremental)
+    *incremental = chatwin_stats.incremental;
+  if (lines)
+    *lines = chatwin_stats.lines;
+}
+
+//  scr_chatwin_invalidate()
+// Force a full repaint of the chat windows at their next update.
+void scr_chatwin_invalidate(void)
+{
+  chatwin_gen++;
+}
+
 static void bindcommand(keycode_t kcode)
 {
   gchar asciikey[16], asciicode[16];
@@ -4505,6 +5358,119 @@ static void scr_process_vi_arrow_key(int key)
     process_command(mkcmdstr("roster down"), TRUE);
 }
 
+static gboolean is_printable_key(keycode_t kcode)
+{
+  int key = kcode.value;
+
+  if (kcode.utf8)
+    return iswprint(key);
+#ifdef __CYGWIN__
+  return (isprint(key) || (key >= 161 && key <= 255)) && !is_speckey(key);
+#else
+  return isprint(key) && !is_speckey(key);
+#endif
+}
+
+static void input_chatstate_update(void)
+{
+  // Set chat state to composing (1) if the user is currently composing,
+  // i.e. not an empty line and not a command line.
+  if (inputLine[0] == 0 || inputLine[0] == COMMAND_CHAR)
+    set_chatstate(0);
+  else
+    set_chatstate(1);
+  if (chatstate)
+    time(&chatstate_timestamp);
+}
+
+//  scr_paste_insert()
+// Insert the pending pasted text at the cursor position.
+static void scr_paste_insert(void)
+{
+  gsize room;
+
+  if (!paste.text || !paste.text->len)
+    return;
+
+  room = INPUTLINE_LENGTH - strlen(inputLine) - 1;
+  if (paste.text->len > room) {
+    gsize len = room;
+    // Do not cut a multibyte character
+    if (utf8_mode)
+      while (len > 0 && (paste.text->str[len] & 0xc0) == 0x80)
+        len--;
+    g_string_truncate(paste.text, len);
+    scr_LogPrint(LPRINT_NORMAL, "Pasted text truncated, line too long.");
+  }
+  scr_insert_text(paste.text->str);
+  g_string_truncate(paste.text, 0);
+  check_offset(1);
+  paste.dirty = TRUE;
+}
+
+//  scr_paste_newline()
+// Add the current line to the multi-line message (multi-line mode is
+// entered if necessary), and clear it.
+static void scr_paste_newline(void)
+{
+  scr_paste_insert();
+  if (!multimode)
+    process_command(mkcmdstr("msay begin"), TRUE);
+  scr_append_multiline(inputLine);
+  ptr_inputline = inputLine;
+  *ptr_inputline = 0;
+  inputline_offset = 0;
+  paste.dirty = TRUE;
+}
+
+//  scr_paste_key(kcode)
+// Handle a key of a paste or typing burst.
+// Return TRUE if the key has been handled.
+static gboolean scr_paste_key(keycode_t kcode)
+{
+  int key = kcode.value;
+  char buf[8], *end;
+
+  if (kcode.mcode || (vi_mode && !chatmode) || completion_started)
+    return FALSE;
+
+  if (!kcode.utf8) {
+    if (key == 13 || key == 343 || (paste.bracketed && key == 10)) {
+      // Pasted newlines can go to the multi-line message
+      if (!settings_opt_get_int("paste_multiline"))
+        return FALSE;
+      scr_paste_newline();
+      return TRUE;
+    }
+    if (key == 9 && paste.bracketed)
+      key = ' ';   // Do not complete pasted text
+  }
+
+  if (key == 9 || !is_printable_key(kcode))
+    return FALSE;
+
+  if (!paste.text)
+    paste.text = g_string_sized_new(256);
+  end = put_char(buf, key);
+  g_string_append_len(paste.text, buf, end - buf);
+  paste.dirty = TRUE;
+  return TRUE;
+}
+
+//  scr_input_flush()
+// Insert the pending pasted text and refresh the input line.
+// This is called when the keys read at once have been processed.
+void scr_input_flush(void)
+{
+  paste.keys = 0;
+  if (!paste.dirty)
+    return;
+  scr_paste_insert();
+  paste.dirty = FALSE;
+  refresh_inputline();
+  input_chatstate_update();
+}
+
 //  scr_process_key(key)
 // Handle the pressed key, in the command line (bottom).
 void scr_process_key(keycode_t kcode)
@@ -4516,6 +5482,17 @@ void scr_process_key(keycode_t kcode)
 
   lock_chatstate = FALSE;
 
+  if (kcode.mcode == MKEY_PASTE_START || kcode.mcode == MKEY_PASTE_END) {
+    scr_paste_insert();
+    paste.bracketed = (kcode.mcode == MKEY_PASTE_START);
+    return;
+  }
+  if ((paste.bracketed || ++paste.keys > PASTE_BURST_KEYS) &&
+      scr_paste_key(kcode))
+    return;
+  // Keep the keys order
+  scr_paste_insert();
+
   switch (kcode.mcode) {
     case 0:
         // key = kcode.value;
@@ -4822,19 +5799,7 @@ void scr_process_key(keycode_t kcode)
 
 display:
   if (display_char) {
-    guint printable;
-
-    if (kcode.utf8) {
-      printable = iswprint(key);
-    } else {
-#ifdef __CYGWIN__
-      printable = (isprint(key) || (key >= 161 && key <= 255))
-                  && !is_speckey(key);
-#else
-      printable = isprint(key) && !is_speckey(key);
-#endif
-    }
-    if (printable) {
+    if (is_printable_key(kcode)) {
       char tmpLine[INPUTLINE_LENGTH+1];
 
       // Check the line isn't too long
@@ -4861,16 +5826,8 @@ display:
       inputLine[0] != COMMAND_CHAR && inputLine[0] != VI_SEARCH_COMMAND_CHAR)
     ex_or_search_mode = FALSE;
 
-  if (!lock_chatstate) {
-    // Set chat state to composing (1) if the user is currently composing,
-    // i.e. not an empty line and not a command line.
-    if (inputLine[0] == 0 || inputLine[0] == COMMAND_CHAR)
-      set_chatstate(0);
-    else
-      set_chatstate(1);
-    if (chatstate)
-      time(&chatstate_timestamp);
-  }
+  if (!lock_chatstate)
+    input_chatstate_update();
   return;
 }
 
@@ -4957,12 +5914,50 @@ void spellcheck_init(void)
   g_strfreev(langs);
 }
 
+#define SPELL_CACHE_SIZE  1024
+
+// Spell checking results of the recently checked words (LRU cache)
+typedef struct {
+  gchar   *word;
+  gboolean good;
+  GList    link;  // Link in the LRU queue
+} spell_cache_entry_t;
+
+static struct {
+  GHashTable *words;  // Word -> spell_cache_entry_t
+  GQueue      lru;    // Most recently used entries first
+} spellcache;
+
+// Last spell-checked line; maskLine is its misspelling mask
+static struct {
+  gboolean valid;
+  size_t   len;
+  char     line[INPUTLINE_LENGTH+1];
+} spellmask;
+
+static void spellcache_clear(void)
+{
+  GList *link;
+
+  while ((link = g_queue_pop_head_link(&spellcache.lru)) != NULL) {
+    spell_cache_entry_t *entry = link->data;
+    g_free(entry->word);
+    g_free(entry);
+  }
+  if (spellcache.words) {
+    g_hash_table_destroy(spellcache.words);
+    spellcache.words = NULL;
+  }
+}
+
 // Deinitialization of spellchecker
 void spellcheck_deinit(void)
 {
   g_slist_foreach (spell_checkers, (GFunc) spell_checker_free, NULL);
   g_slist_free (spell_checkers);
   spell_checkers = NULL;
+  spellcache_clear();
+  spellmask.valid = FALSE;
 }
 
 typedef struct {
@@ -4986,23 +5981,60 @@ static int spellcheckword(gconstpointer sc_ptr, gconstpointer substr_ptr)
 }
 
 #define spell_isalpha(c) (utf8_mode ? iswalpha(get_char(c)) : isalpha(*c))
+#define spell_isspace(c) (strchr(" \t\r\n", (c)) != NULL)
 
-// Spell checking function
-static void spellcheck(char *line, char *checked)
+//  spellcheck_word(str, len)
+// Return TRUE if the word is known by one of the spell checkers.
+static gboolean spellcheck_word(const char *str, int len)
 {
-  const char *start, *line_start;
+  char word[INPUTLINE_LENGTH+1];
+  spell_cache_entry_t *entry;
   spell_substring_t substr;
 
-  if (inputLine[0] == 0 || inputLine[0] == COMMAND_CHAR)
-    return;
+  memcpy(word, str, len);
+  word[len] = '\0';
 
-  // Give up early if not languages are loaded
-  if (!spell_checkers)
-    return;
+  if (!spellcache.words)
+    spellcache.words = g_hash_table_new(g_str_hash, g_str_equal);
+
+  entry = g_hash_table_lookup(spellcache.words, word);
+  if (entry) {
+    g_queue_unlink(&spellcache.lru, &entry->link);
+    g_queue_push_head_link(&spellcache.lru, &entry->link);
+    return entry->good;
+  }
+
+  if (spellcache.lru.length >= SPELL_CACHE_SIZE) {
+    // Drop the least recently used word
+    GList *link = g_queue_pop_tail_link(&spellcache.lru);
+    spell_cache_entry_t *old = link->data;
+    g_hash_table_remove(spellcache.words, old->word);
+    g_free(old->word);
+    g_free(old);
+  }
+
+  substr.str = str;
+  substr.len = len;
+  entry = g_new0(spell_cache_entry_t, 1);
+  entry->word = g_strdup(word);
+  entry->good = (g_slist_find_custom(spell_checkers, &substr,
+                                     spellcheckword) != NULL);
+  entry->link.data = entry;
+  g_hash_table_insert(spellcache.words, entry->word, entry);
+  g_queue_push_head_link(&spellcache.lru, &entry->link);
+  return entry->good;
+}
 
-  line_start = line;
+//  spellcheck_range(line_start, line, end, checked)
+// Check the words of line_start between line and end.
+// line must be the beginning of the line or follow a whitespace, and end
+// must be a whitespace or the end of the line.
+static void spellcheck_range(const char *line_start, char *line,
+                             const char *end, char *checked)
+{
+  const char *start;
 
-  while (*line) {
+  while (line < end && *line) {
 
     if (!spell_isalpha(line)) {
       line = next_char(line);
@@ -5032,12 +6064,63 @@ static void spellcheck(char *line, char *checked)
     while (spell_isalpha(line))
       line = next_char(line);
 
-    substr.str = start;
-    substr.len = line - start;
-    if (!g_slist_find_custom(spell_checkers, &substr, spellcheckword))
+    if (!spellcheck_word(start, line - start))
       memset(&checked[start - line_start], SPELLBADCHAR, line - start);
   }
 }
+
+// Spell checking function
+// The misspelling mask of the previous line is updated: only the words
+// between the first and the last modified characters are checked again.
+// Whitespace characters are used as synchronization points, as words and
+// URLs never span them.
+static void spellcheck(char *line, char *checked)
+{
+  size_t len, oldlen, prefix, suffix, maxfix, start, end;
+  const char *old = spellmask.line;
+
+  // Give up early if not languages are loaded
+  if (line[0] == 0 || line[0] == COMMAND_CHAR || !spell_checkers) {
+    memset(checked, 0, INPUTLINE_LENGTH+1);
+    spellmask.valid = FALSE;
+    return;
+  }
+
+  len = strlen(line);
+
+  if (!spellmask.valid) {
+    memset(checked, 0, INPUTLINE_LENGTH+1);
+    spellcheck_range(line, line, line + len, checked);
+  } else {
+    oldlen = spellmask.len;
+    maxfix = MIN(len, oldlen);
+    for (prefix = 0; prefix < maxfix && line[prefix] == old[prefix]; prefix++)
+      ;
+    if (prefix == len && len == oldlen)
+      return; // Unchanged
+    for (suffix = 0; suffix < maxfix - prefix &&
+         line[len-1-suffix] == old[oldlen-1-suffix]; suffix++)
+      ;
+
+    start = prefix;
+    while (start > 0 && !spell_isspace(line[start-1]))
+      start--;
+    end = len - suffix;
+    while (end < len && !spell_isspace(line[end]))
+      end++;
+
+    // Move the mask of the unmodified end of the line
+    memmove(checked + end, checked + end + oldlen - len, len - end);
+    if (len < oldlen)
+      memset(checked + len, 0, oldlen - len);
+    memset(checked + start, 0, end - start);
+    spellcheck_range(line, line + start, line + end, checked);
+  }
+
+  memcpy(spellmask.line, line, len + 1);
+  spellmask.len = len;
+  spellmask.valid = TRUE;
+}
 #endif
 
 static void open_chat_window(void)
@@ -31,9 +31,11 @@ void spellcheck_deinit(void);
 #define INPUTLINE_LENGTH  1024
 
 // Only used in screen.c; this is the maximum line number
-// in a multi-line message.  Should be < 1000
-// Note: message length is limited by the HBB_BLOCKSIZE size too
-#define MULTILINE_MAX_LINE_NUMBER 299
+// in a multi-line message.  The history log format stores the number of
+// lines of a message with at most 4 digits (see write_histo_line()).
+// Note: message length is limited by HBB_MAX_MSGSIZE (512 KB) too, which
+// is usually the effective limit.
+#define MULTILINE_MAX_LINE_NUMBER 9999
 
 // When chatstates are enabled, timeout (in seconds) before "composing"
 // becomes "paused" because of user inactivity.
@@ -81,7 +83,9 @@ typedef struct {
     MKEY_CTRL_DEL,
     MKEY_CTRL_SHIFT_HOME,
     MKEY_CTRL_SHIFT_END,
-    MKEY_MOUSE
+    MKEY_MOUSE,
+    MKEY_PASTE_START,
+    MKEY_PASTE_END
   } mcode;
 } keycode_t;
 
@@ -101,6 +105,7 @@ void scr_write_outgoing_message(const char *jidto,   const char *text,
 
 void scr_getch(keycode_t *kcode);
 void scr_process_key(keycode_t kcode);
+void scr_input_flush(void);
 
 void scr_init_bindings(void);
 void scr_init_locale_charset(void);
@@ -112,6 +117,8 @@ void scr_resize(void);
 void scr_draw_main_window(unsigned int fullinit);
 void scr_draw_roster(void);
 void scr_update_roster(void);
+void scr_frame_render(void);
+void scr_frame_force(void);
 void scr_update_main_status(int forceupdate);
 void scr_update_chat_status(int forceupdate);
 void scr_roster_visibility(int status);
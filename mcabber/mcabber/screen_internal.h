@@ -0,0 +1,17 @@
+#ifndef __MCABBER_SCREEN_INTERNAL_H__
+#define __MCABBER_SCREEN_INTERNAL_H__ 1
+
+// Screen functions used by mcabber itself and by the benchmark programs.
+// This header is not installed: these functions are not part of the
+// module API.
+
+#include <glib.h>
+
+void scr_frame_stats(guint *rendered, guint *coalesced);
+void scr_chatwin_stats(guint *full, guint *incremental, guint *lines);
+void scr_chatwin_invalidate(void);
+gint scr_match_keyseq(const char *seq, guint *mkeycode, gint *value);
+
+#endif
+
+/* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -61,6 +61,53 @@ typedef struct {
   settings_guard_t guard;
 } installed_guard_t;
 
+// The order must match settings_opt_slot_id_t
+settings_opt_slot_t settings_opt_slots[OPT_SLOT_COUNT] = {
+  { "attention_char",               SETTINGS_SLOT_STRING, 0 },
+  { "beep_on_message",              SETTINGS_SLOT_BOOL,   0 },
+  { "buddy_format",                 SETTINGS_SLOT_INT,    0 },
+  { "buffer_smart_scrolling",       SETTINGS_SLOT_BOOL,   0 },
+  { "clear_unread_on_carbon",       SETTINGS_SLOT_BOOL,   0 },
+  { "event_log_files",              SETTINGS_SLOT_BOOL,   0 },
+  { "eventcmd_persistent",          SETTINGS_SLOT_BOOL,   0 },
+  { "eventcmd_use_nickname",        SETTINGS_SLOT_BOOL,   0 },
+  { "events_ignore_active_window",  SETTINGS_SLOT_BOOL,   0 },
+  { "info",                         SETTINGS_SLOT_STRING, 0 },
+  { "log_display_presence",         SETTINGS_SLOT_BOOL,   0 },
+  { "log_display_sender",           SETTINGS_SLOT_BOOL,   0 },
+  { "log_muc_conf",                 SETTINGS_SLOT_BOOL,   0 },
+  { "max_frame_rate",               SETTINGS_SLOT_INT,    25 },
+  { "muc_disable_nick_hl",          SETTINGS_SLOT_BOOL,   0 },
+  { "roster_autolock_resource",     SETTINGS_SLOT_BOOL,   0 },
+  { "roster_no_leading_space",      SETTINGS_SLOT_INT,    0 },
+  { "roster_show_unread_count",     SETTINGS_SLOT_BOOL,   0 },
+  { "show_status_in_buffer",        SETTINGS_SLOT_INT,    0 },
+  { "spell_enable",                 SETTINGS_SLOT_BOOL,   0 },
+  { "status_buffer_size",           SETTINGS_SLOT_INT,    1000 },
+  { "time_prefix",                  SETTINGS_SLOT_INT,    0 },
+  { "tracelog_max_size",            SETTINGS_SLOT_INT,    0 },
+};
+
+static GHashTable *opt_slots; // Option name -> settings_opt_slot_t
+
+//  settings_opt_slot_update(key)
+// Parse the current value of the option key, if it has a slot.
+static void settings_opt_slot_update(const gchar *key)
+{
+  settings_opt_slot_t *slot = g_hash_table_lookup(opt_slots, key);
+
+  if (!slot)
+    return;
+
+  slot->sval = g_hash_table_lookup(option, key);
+  if (!slot->sval)
+    slot->ival = slot->defval;
+  else if (slot->type == SETTINGS_SLOT_BOOL)
+    slot->ival = (atoi(slot->sval) != 0);
+  else
+    slot->ival = atoi(slot->sval);
+}
+
 #ifdef HAVE_LIBOTR
 static GHashTable *otrpolicy;
 static enum otr_policy default_policy;
@@ -81,6 +128,8 @@ static inline GHashTable *get_hash(guint type)
 
 void settings_init(void)
 {
+  guint i;
+
   option  = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, &g_free);
   alias   = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, &g_free);
   binding = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, &g_free);
@@ -91,10 +140,19 @@ void settings_init(void)
 #ifdef HAVE_LIBOTR
   otrpolicy = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, &g_free);
 #endif
+  opt_slots = g_hash_table_new(&g_str_hash, &g_str_equal);
+  for (i = 0; i < OPT_SLOT_COUNT; i++) {
+    settings_opt_slot_t *slot = &settings_opt_slots[i];
+    slot->ival = slot->defval;
+    slot->sval = NULL;
+    g_hash_table_insert(opt_slots, (gpointer)slot->key, slot);
+  }
 }
 
 void settings_free(void)
 {
+  guint i;
+
   g_hash_table_destroy(option);
   g_hash_table_destroy(alias);
   g_hash_table_destroy(binding);
@@ -105,6 +163,11 @@ void settings_free(void)
 #ifdef HAVE_LIBOTR
   g_hash_table_destroy(otrpolicy);
 #endif
+  g_hash_table_destroy(opt_slots);
+  for (i = 0; i < OPT_SLOT_COUNT; i++) {
+    settings_opt_slots[i].ival = settings_opt_slots[i].defval;
+    settings_opt_slots[i].sval = NULL;
+  }
 }
 
 //  settings_get_mcabber_config_dir()
@@ -402,6 +465,7 @@ void settings_opt_set_raw(const gchar *key, const gchar *value)
     g_hash_table_remove(option, key);
   else
     g_hash_table_insert(option, g_strdup(key), g_strdup(value));
+  settings_opt_slot_update(key);
 }
 
 void settings_set(guint type, const gchar *key, const gchar *value)
@@ -428,6 +492,9 @@ void settings_set(guint type, const gchar *key, const gchar *value)
     g_hash_table_insert(hash, g_strdup(key), dup_value);
   else
     g_hash_table_remove(option, key);
+
+  if (type == SETTINGS_TYPE_OPTION)
+    settings_opt_slot_update(key);
 }
 
 void settings_del(guint type, const gchar *key)
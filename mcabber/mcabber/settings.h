@@ -22,6 +22,54 @@
 #define settings_opt_get(k)     settings_get(SETTINGS_TYPE_OPTION, k)
 #define settings_opt_get_int(k) settings_get_int(SETTINGS_TYPE_OPTION, k)
 
+// Typed option slots
+// Some options are read very often (for each message, or each redraw).
+// Their value is parsed once, when the option is set, and can then be
+// read directly with settings_opt_slot_int() / settings_opt_slot_str().
+#define SETTINGS_SLOT_INT       1
+#define SETTINGS_SLOT_BOOL      2
+#define SETTINGS_SLOT_STRING    3
+
+typedef enum {
+  OPT_SLOT_ATTENTION_CHAR,
+  OPT_SLOT_BEEP_ON_MESSAGE,
+  OPT_SLOT_BUDDY_FORMAT,
+  OPT_SLOT_BUFFER_SMART_SCROLLING,
+  OPT_SLOT_CLEAR_UNREAD_ON_CARBON,
+  OPT_SLOT_EVENT_LOG_FILES,
+  OPT_SLOT_EVENTCMD_PERSISTENT,
+  OPT_SLOT_EVENTCMD_USE_NICKNAME,
+  OPT_SLOT_EVENTS_IGNORE_ACTIVE_WINDOW,
+  OPT_SLOT_INFO,
+  OPT_SLOT_LOG_DISPLAY_PRESENCE,
+  OPT_SLOT_LOG_DISPLAY_SENDER,
+  OPT_SLOT_LOG_MUC_CONF,
+  OPT_SLOT_MAX_FRAME_RATE,
+  OPT_SLOT_MUC_DISABLE_NICK_HL,
+  OPT_SLOT_ROSTER_AUTOLOCK_RESOURCE,
+  OPT_SLOT_ROSTER_NO_LEADING_SPACE,
+  OPT_SLOT_ROSTER_SHOW_UNREAD_COUNT,
+  OPT_SLOT_SHOW_STATUS_IN_BUFFER,
+  OPT_SLOT_SPELL_ENABLE,
+  OPT_SLOT_STATUS_BUFFER_SIZE,
+  OPT_SLOT_TIME_PREFIX,
+  OPT_SLOT_TRACELOG_MAX_SIZE,
+  OPT_SLOT_COUNT
+} settings_opt_slot_id_t;
+
+typedef struct {
+  const gchar *key;
+  guint        type;    // SETTINGS_SLOT_*
+  int          defval;  // Value of an unset int/bool option
+  int          ival;    // Current int/bool value
+  const gchar *sval;    // Current string value, NULL if unset
+} settings_opt_slot_t;
+
+extern settings_opt_slot_t settings_opt_slots[OPT_SLOT_COUNT];
+
+#define settings_opt_slot_int(id)   (settings_opt_slots[id].ival)
+#define settings_opt_slot_str(id)   (settings_opt_slots[id].sval)
+
 #define COMMAND_CHAR    (vi_mode ? ':' : '/')
 #define COMMAND_CHARSTR (vi_mode ? ":" : "/")
 #define VI_SEARCH_COMMAND_CHAR  '/'
@@ -45,6 +45,7 @@ static char idnprep[1024];
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <ctype.h>
 
 #include "utils.h"
@@ -215,41 +216,206 @@ gboolean hex_to_fingerprint(const char *hex, char *fpr, size_t fpr_len)
 }
 #endif
 
+// The trace log lines are appended to a buffer, which is written to the
+// file by a background thread (every second, or sooner when the buffer is
+// large or when an error message is logged).
+#define TRACELOG_FLUSH_SIZE   8192
+#define TRACELOG_FLUSH_DELAY  1         // Seconds
+#define TRACELOG_BUFFER_MAX   (4*1024*1024) // Lines are dropped beyond
+
+static struct {
+  GMutex    lock;     // Protects the fields below, except fd, size, wbuf
+  GMutex    wlock;    // and failing, which are protected by wlock
+  GCond     cond;
+  GThread  *thread;
+  GString  *buf;      // Pending lines
+  GString  *wbuf;     // Lines being written
+  int       fd;
+  off_t     size;     // Current size of the file
+  off_t     maxsize;  // Rotate the file when it is larger (0: never)
+  guint     dropped;
+  int       werrno;   // Last write error, reported from the main thread
+  gboolean  failing;
+  gboolean  flush;
+  gboolean  reopen;
+  gboolean  stop;
+} tracelog = { .fd = -1 };
+
+//  tracelog_open(fname)
+// Open the trace log file, and set tracelog.size.
+// Return the file descriptor, or -1 (errno is set).
+static int tracelog_open(const char *fname)
+{
+  struct stat buf;
+  int fd = open(fname, O_WRONLY|O_APPEND|O_CREAT, S_IRUSR|S_IWUSR);
+
+  if (fd == -1)
+    return -1;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  tracelog.size = (fstat(fd, &buf) ? 0 : buf.st_size);
+  return fd;
+}
+
+//  tracelog_drain()
+// Write the pending lines to the file, rotating or reopening it if needed.
+// Can be called from any thread.
+static void tracelog_drain(void)
+{
+  GString *tmp;
+  gboolean reopen;
+  off_t maxsize;
+  guint dropped;
+  int werrno = 0;
+  gsize pos;
+
+  g_mutex_lock(&tracelog.wlock);
+  g_mutex_lock(&tracelog.lock);
+  tmp = tracelog.buf;
+  tracelog.buf = tracelog.wbuf;
+  tracelog.wbuf = tmp;
+  reopen  = tracelog.reopen;
+  maxsize = tracelog.maxsize;
+  dropped = tracelog.dropped;
+  tracelog.flush = tracelog.reopen = FALSE;
+  tracelog.dropped = 0;
+  g_mutex_unlock(&tracelog.lock);
+
+  if (dropped)
+    g_string_append_printf(tracelog.wbuf,
+                           "*** %u trace log lines have been dropped\n",
+                           dropped);
+
+  if (tracelog.fd != -1 && maxsize && tracelog.size &&
+      tracelog.size + (off_t)tracelog.wbuf->len > maxsize) {
+    // Rotation: keep one old file
+    gchar *oldname = g_strdup_printf("%s.1", FName);
+    rename(FName, oldname);
+    g_free(oldname);
+    reopen = TRUE;
+  }
+  if (reopen || tracelog.fd == -1) {
+    if (tracelog.fd != -1)
+      close(tracelog.fd);
+    tracelog.fd = tracelog_open(FName);
+    if (tracelog.fd == -1)
+      werrno = errno;
+  }
+
+  for (pos = 0; tracelog.fd != -1 && pos < tracelog.wbuf->len; ) {
+    ssize_t n = write(tracelog.fd, tracelog.wbuf->str + pos,
+                      tracelog.wbuf->len - pos);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      werrno = errno;
+      break;
+    }
+    pos += n;
+    tracelog.size += n;
+  }
+  g_string_truncate(tracelog.wbuf, 0);
+
+  // Only the first error is reported
+  if (werrno && !tracelog.failing) {
+    g_mutex_lock(&tracelog.lock);
+    tracelog.werrno = werrno;
+    g_mutex_unlock(&tracelog.lock);
+  }
+  tracelog.failing = (werrno != 0);
+  g_mutex_unlock(&tracelog.wlock);
+}
+
+static gpointer tracelog_writer(gpointer data)
+{
+  mcabber_block_signals();
+
+  g_mutex_lock(&tracelog.lock);
+  while (!tracelog.stop) {
+    gint64 end = g_get_monotonic_time() +
+                 TRACELOG_FLUSH_DELAY * G_TIME_SPAN_SECOND;
+
+    while (!tracelog.stop && !tracelog.flush) {
+      if (!tracelog.buf->len) {
+        g_cond_wait(&tracelog.cond, &tracelog.lock);
+        end = g_get_monotonic_time() +
+              TRACELOG_FLUSH_DELAY * G_TIME_SPAN_SECOND;
+      } else if (!g_cond_wait_until(&tracelog.cond, &tracelog.lock, end))
+        break;  // Timeout
+    }
+    g_mutex_unlock(&tracelog.lock);
+    tracelog_drain();
+    g_mutex_lock(&tracelog.lock);
+  }
+  g_mutex_unlock(&tracelog.lock);
+  tracelog_drain();
+  return NULL;
+}
+
+//  tracelog_close()
+// Write the pending lines, stop the writer thread and close the file.
+static void tracelog_close(void)
+{
+  if (!tracelog.thread)
+    return;
+
+  g_mutex_lock(&tracelog.lock);
+  tracelog.stop = TRUE;
+  g_cond_signal(&tracelog.cond);
+  g_mutex_unlock(&tracelog.lock);
+  g_thread_join(tracelog.thread);
+  tracelog.thread = NULL;
+  tracelog.stop = FALSE;
+
+  if (tracelog.fd != -1)
+    close(tracelog.fd);
+  tracelog.fd = -1;
+  g_string_free(tracelog.buf, TRUE);
+  g_string_free(tracelog.wbuf, TRUE);
+  tracelog.buf = tracelog.wbuf = NULL;
+}
+
 static gboolean tracelog_create(void)
 {
-  FILE *fp;
   struct stat buf;
-  int err;
+  int fd, err;
   char *v;
 
-  fp = fopen(FName, "a");
-  if (!fp) {
+  tracelog_close();
+
+  fd = tracelog_open(FName);
+  if (fd == -1) {
     scr_LogPrint(LPRINT_NORMAL, "ERROR: Cannot open tracelog file: %s",
                  strerror(errno));
     return FALSE;
   }
 
-  err = fstat(fileno(fp), &buf);
+  err = fstat(fd, &buf);
   if (err || buf.st_uid != geteuid()) {
-    fclose(fp);
     if (err)
       scr_LogPrint(LPRINT_NORMAL, "ERROR: cannot stat the tracelog file: %s",
                    strerror(errno));
     else
       scr_LogPrint(LPRINT_NORMAL, "ERROR: tracelog file does not belong to you!");
+    close(fd);
     return FALSE;
   }
 
-  if (fchmod(fileno(fp), S_IRUSR|S_IWUSR)) {
+  if (fchmod(fd, S_IRUSR|S_IWUSR)) {
     scr_LogPrint(LPRINT_NORMAL, "WARNING: Cannot set tracelog file permissions: %s",
                  strerror(errno));
   }
 
+  tracelog.fd   = fd;
+  tracelog.buf  = g_string_sized_new(2 * TRACELOG_FLUSH_SIZE);
+  tracelog.wbuf = g_string_sized_new(2 * TRACELOG_FLUSH_SIZE);
+
   v = mcabber_version();
-  fprintf(fp, "New trace log started.  MCabber version %s\n"
-              "----------------------\n", v);
+  g_string_append_printf(tracelog.buf,
+                         "New trace log started.  MCabber version %s\n"
+                         "----------------------\n", v);
   g_free(v);
-  fclose(fp);
+
+  tracelog.thread = g_thread_new("tracelog", tracelog_writer, NULL);
   return TRUE;
 }
 
@@ -259,6 +425,8 @@ static gchar *tracelog_level_guard(const gchar *key, const gchar *new_value)
   int new_level = 0;
   if (new_value)
     new_level = atoi(new_value);
+  if (new_level < 1)
+    tracelog_close();
   if (DebugEnabled < 1 && new_level > 0 && FName && !tracelog_create())
     DebugEnabled = 0;
   else
@@ -275,6 +443,7 @@ static gchar *tracelog_file_guard(const gchar *key, const gchar *new_value)
     new_fname = expand_filename(new_value);
 
   if (g_strcmp0(FName, new_fname)) {
+    tracelog_close();
     g_free(FName);
     FName = new_fname;
     if (DebugEnabled > 0 && !tracelog_create()) {
@@ -297,25 +466,58 @@ void ut_init_debug(void)
   settings_set_guard("tracelog_file",  tracelog_file_guard);
 }
 
+//  ut_deinit_debug()
+// Write the pending trace log lines and close the file.
+void ut_deinit_debug(void)
+{
+  DebugEnabled = 0;
+  tracelog_close();
+}
+
+//  ut_flush_log(reopen)
+// Write the pending trace log lines now.  If reopen is TRUE, the file is
+// reopened (useful after an external log rotation).
+void ut_flush_log(gboolean reopen)
+{
+  if (!tracelog.thread)
+    return;
+  g_mutex_lock(&tracelog.lock);
+  tracelog.reopen |= reopen;
+  g_mutex_unlock(&tracelog.lock);
+  tracelog_drain();
+}
+
 void ut_write_log(unsigned int flag, const char *data)
 {
-  if (!DebugEnabled || !FName) return;
+  int werrno;
+
+  if (!DebugEnabled || !FName || !tracelog.thread) return;
 
   if (((DebugEnabled >= 2) && (flag & (LPRINT_LOG|LPRINT_DEBUG))) ||
       ((DebugEnabled == 1) && (flag & LPRINT_LOG))) {
-    FILE *fp = fopen(FName, "a+");
-    if (!fp) {
-      scr_LogPrint(LPRINT_NORMAL, "ERROR: Cannot open tracelog file: %s.",
-                   strerror(errno));
-      return;
+    g_mutex_lock(&tracelog.lock);
+    // Wake the writer up, so that it starts its timer
+    if (!tracelog.buf->len)
+      g_cond_signal(&tracelog.cond);
+    if (tracelog.buf->len < TRACELOG_BUFFER_MAX)
+      g_string_append(tracelog.buf, data);
+    else
+      tracelog.dropped++;
+    tracelog.maxsize =
+            (off_t)settings_opt_slot_int(OPT_SLOT_TRACELOG_MAX_SIZE) * 1024;
+    // Messages displayed in the log window (errors...) are written at once
+    if (!tracelog.flush && ((flag & LPRINT_NORMAL) ||
+                            tracelog.buf->len >= TRACELOG_FLUSH_SIZE)) {
+      tracelog.flush = TRUE;
+      g_cond_signal(&tracelog.cond);
     }
+    werrno = tracelog.werrno;
+    tracelog.werrno = 0;
+    g_mutex_unlock(&tracelog.lock);
 
-    // Check file permissions again (it could be a new file)
-    fchmod(fileno(fp), S_IRUSR|S_IWUSR);
-
-    if (fputs(data, fp) == EOF)
-      scr_LogPrint(LPRINT_NORMAL, "ERROR: Cannot write to tracelog file.");
-    fclose(fp);
+    if (werrno)
+      scr_LogPrint(LPRINT_NORMAL, "ERROR: Cannot write to tracelog file: %s.",
+                   strerror(werrno));
   }
 }
 
@@ -405,6 +607,48 @@ int to_iso8601(char *dststr, time_t timestamp)
   return ((ret == -1) ? -1 : 0);
 }
 
+//  from_iso8601_utc(timestamp, p_time)
+// Decode a UTC timestamp written by to_iso8601() ("YYYYMMDDThh:mm:ssZ"),
+// without any libc time conversion.
+// Return TRUE and set *p_time if the timestamp has this exact layout.
+gboolean from_iso8601_utc(const char *timestamp, time_t *p_time)
+{
+  static const char layout[] = "########T##:##:##Z";
+  int v[14], n = 0;
+  int year, mon, mday, era;
+  unsigned yoe, doy, doe;
+  const char *l, *c;
+
+  for (l = layout, c = timestamp; *l; l++, c++) {
+    if (*l == '#') {
+      if (*c < '0' || *c > '9')
+        return FALSE;
+      v[n++] = *c - '0';
+    } else if (*c != *l) {
+      return FALSE;
+    }
+  }
+
+  year = v[0]*1000 + v[1]*100 + v[2]*10 + v[3];
+  mon  = v[4]*10 + v[5];
+  mday = v[6]*10 + v[7];
+  if (mon < 1 || mon > 12 || mday < 1 || mday > 31)
+    return FALSE;
+
+  // Days since the epoch in the proleptic Gregorian calendar
+  // (years start on March 1st, so that leap days are at the end).
+  year -= (mon <= 2);
+  era = year / 400;
+  yoe = year - era * 400;
+  doy = (153 * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5 + mday - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+  *p_time = ((time_t)era * 146097 + doe - 719468) * 86400 +
+            (v[8]*10 + v[9]) * 3600 + (v[10]*10 + v[11]) * 60 +
+            v[12]*10 + v[13];
+  return TRUE;
+}
+
 //  from_iso8601(timestamp, utc)
 // This function came from the Pidgin project, gaim_str_to_time().
 // (Actually date may not be pure iso-8601)
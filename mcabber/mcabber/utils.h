@@ -28,7 +28,9 @@ gboolean hex_to_fingerprint(const char *hex, char *fpr, size_t fpr_len);
 #endif
 
 void ut_init_debug(void);
+void ut_deinit_debug(void);
 void ut_write_log(unsigned int flag, const char *data);
+void ut_flush_log(gboolean reopen);
 
 char *expand_filename(const char *fname);
 
@@ -38,6 +40,7 @@ const char *ut_get_tmpdir(void);
 
 int    to_iso8601(char *dststr, time_t timestamp);
 time_t from_iso8601(const char *timestamp, int utc);
+gboolean from_iso8601_utc(const char *timestamp, time_t *p_time);
 
 int check_jid_syntax(const char *fjid);
 
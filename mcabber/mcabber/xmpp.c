@@ -32,6 +32,7 @@
 #include "events.h"
 #include "histolog.h"
 #include "hooks.h"
+#include "jobs.h"
 #include "otr.h"
 #include "roster.h"
 #include "screen.h"
@@ -296,11 +297,194 @@ void xmpp_request(const char *fjid, enum iqreq_type reqtype)
   g_slist_free(resources);
 }
 
+//  xmpp_send_deferred(message)
+// Send a message that was waiting for the previous messages of the
+// same queue (i.e. for their encryption in a worker thread).
+static void xmpp_send_deferred(gpointer data)
+{
+  LmMessage *x = data;
+
+  if (xmpp_is_online())
+    lm_connection_send(lconnection, x, NULL);
+  lm_message_unref(x);
+}
+
+// A chat message waiting for the previous messages of its queue.
+// The message hook is run when the message is sent, so that the
+// messages are displayed in the order they have been sent.
+typedef struct {
+  LmMessage *msg;
+  char      *barejid;
+  char      *nick;
+  char      *hmsg;
+  gint       encrypted;
+  gpointer   xep184;
+} deferred_msg_t;
+
+static void xmpp_send_deferred_msg(gpointer data)
+{
+  deferred_msg_t *dm = data;
+
+  if (xmpp_is_online())
+    lm_connection_send(lconnection, dm->msg, NULL);
+  hk_message_out(dm->barejid, dm->nick, 0, dm->hmsg, dm->encrypted, FALSE,
+                 dm->xep184);
+  lm_message_unref(dm->msg);
+  g_free(dm->barejid);
+  g_free(dm->nick);
+  g_free(dm->hmsg);
+  g_free(dm);
+}
+
+//  msg_hook_text(subject, text)
+// Return the message text as given to hk_message_out().
+// The returned string must be freed with g_free() after use.
+static char *msg_hook_text(const char *subject, const char *text)
+{
+  if (subject)
+    return g_strdup_printf("[%s]\n%s", subject, text);
+  return g_strdup(text);
+}
+
+//  muc_pm_nick(fjid, barejid)
+// Return the nickname if fjid is a room occupant, or NULL.
+static const char *muc_pm_nick(const char *fjid, const char *barejid)
+{
+  if (roster_find(barejid, jidsearch, ROSTER_TYPE_ROOM))
+    return jid_get_resource_name(fjid);
+  return NULL;
+}
+
+#ifdef HAVE_GPGME
+typedef struct {
+  LmMessage *msg;
+  char      *barejid;
+  char      *nick;      // Room occupant nickname (MUC private message)
+  char      *text;
+  gboolean   force;
+  // When the job is run asynchronously and hook is set, the message hook is
+  // run with hmsg (the text as displayed) and the XEP-0184 id.
+  gboolean   hook;
+  char      *hmsg;
+  gpointer   xep184;
+  // The following pointers are only set when the job is run synchronously
+  // (i.e. when the worker threads are disabled).
+  gint      *encrypted;
+  gboolean  *delivered;
+} pgp_outmsg_t;
+
+static void pgp_send_msg_cb(const gpg_result_t *result, gpointer data)
+{
+  pgp_outmsg_t *om = data;
+  gint encrypted = 0;
+
+  if (om->delivered)
+    *om->delivered = TRUE;
+
+  if (result->output) {
+    LmMessageNode *y;
+    y = lm_message_node_add_child(om->msg->node, "x", result->output);
+    lm_message_node_set_attribute(y, "xmlns", NS_ENCRYPTED);
+    encrypted = ENCRYPTED_PGP;
+  } else if (om->force) {
+    encrypted = -1;
+  } else {
+    // Encryption is not enforced, send the message in clear text
+    LmMessageNode *body = lm_message_node_get_child(om->msg->node, "body");
+    if (body && om->text)
+      lm_message_node_set_value(body, om->text);
+  }
+
+  if (encrypted != -1 && xmpp_is_online())
+    lm_connection_send(lconnection, om->msg, NULL);
+
+  if (om->encrypted) {
+    // Synchronous job, the caller does the rest
+    *om->encrypted = encrypted;
+  } else if (encrypted == -1) {
+    scr_WriteIncomingMessage(om->barejid, "PGP encryption failed.  "
+                             "The message was not sent.", 0,
+                             HBB_PREFIX_ERR, 0);
+  } else {
+    // Now we know how the message has been sent, we can display and log it
+    if (om->hook) {
+      hk_message_out(om->barejid, om->nick, 0, om->hmsg, encrypted, FALSE,
+                     om->xep184);
+      om->xep184 = NULL;
+    }
+    if (!encrypted)
+      scr_WriteIncomingMessage(om->barejid, "PGP encryption failed.  "
+                               "The message was sent unencrypted.", 0,
+                               HBB_PREFIX_INFO, 0);
+  }
+
+  lm_message_unref(om->msg);
+  g_free(om->barejid);
+  g_free(om->nick);
+  g_free(om->text);
+  g_free(om->hmsg);
+  g_free(om->xep184);
+  g_free(om);
+}
+
+//  pgp_send_msg(queue, message, fjid, barejid, text, plaintext, subject,
+//               keyids[], n, force, *encrypted, *xep184)
+// Encrypt text in a worker thread, then send the message.
+// plaintext is the message typed by the user (text can be an OTR payload).
+// If the job cannot be run asynchronously, *encrypted is updated
+// like in xmpp_send_msg().  If not, and if encrypted isn't NULL, it is set
+// to ENCRYPTED_PENDING: the message hook (hk_message_out()) will be run
+// when the message is sent, and the XEP-0184 id is moved there.
+// Encryption errors are reported in the contact's buffer.
+static void pgp_send_msg(const char *queue, LmMessage *x, const char *fjid,
+                         const char *barejid,
+                         const char *text, const char *plaintext,
+                         const char *subject, const char *keyids[], size_t n,
+                         gboolean force,
+                         gint *encrypted, gpointer *xep184)
+{
+  pgp_outmsg_t *om = g_new0(pgp_outmsg_t, 1);
+  gboolean delivered = FALSE;
+
+  om->msg = lm_message_ref(x);
+  om->barejid = g_strdup(barejid);
+  om->text = g_strdup(text);
+  om->force = force;
+  om->encrypted = encrypted;
+  om->delivered = &delivered;
+
+  if (encrypted) {
+    om->hook = TRUE;
+    om->nick = g_strdup(muc_pm_nick(fjid, barejid));
+    om->hmsg = msg_hook_text(subject, plaintext);
+  }
+
+  gpg_job_submit(queue, GPG_JOB_ENCRYPT, text, NULL, keyids, n,
+                 &pgp_send_msg_cb, om);
+
+  if (!delivered) {
+    om->encrypted = NULL;
+    om->delivered = NULL;
+    if (encrypted) {
+      *encrypted = ENCRYPTED_PENDING;
+      if (xep184) {
+        om->xep184 = *xep184;
+        *xep184 = NULL;
+      }
+    }
+  }
+}
+#endif
+
 //  xmpp_send_msg(jid, text, type, subject,
 //                otrinject, *encrypted, type_overwrite, *xep184)
 // When encrypted is not NULL, the function set *encrypted to 1 if the
 // message has been PGP (or OTR) -encrypted.  If encryption enforcement is set
 // and encryption fails, *encrypted is set to -1.
+// If the message is PGP-encrypted in a worker thread, or if it has to wait
+// for such a message to the same contact, *encrypted is set to
+// ENCRYPTED_PENDING and hk_message_out() will be called (with *xep184, which
+// is reset) once the message has been sent.
 // otrinject should be set to FALSE (unless the message already has an OTR
 // payload, i.e. if the function is called from an otr.c routine).
 void xmpp_send_msg(const char *fjid, const char *text, int type,
@@ -322,7 +506,13 @@ void xmpp_send_msg(const char *fjid, const char *text, int type,
   LmMessageNode *event;
   struct xep0085 *xep85 = NULL;
 #endif
-  gchar *enc = NULL;
+#ifdef HAVE_GPGME
+  const char *pgp_keys[] = { NULL, NULL };
+  size_t pgp_nkeys = 0;
+  guint pgp_force = FALSE;
+#endif
+  const char *plaintext = text;
+  gchar *queue;
 
   if (encrypted)
     *encrypted = 0;
@@ -381,13 +571,12 @@ void xmpp_send_msg(const char *fjid, const char *text, int type,
         if (!key && res_pgpdata)
           key = res_pgpdata->sign_keyid;
         if (key) {
-          int nkeys = 1;
-          const char *keys[] = { key, 0 };
+          // The message will be encrypted in a worker thread
+          pgp_keys[pgp_nkeys++] = key;
           if (carbons_enabled())
-            keys[nkeys++] = gpg_get_private_key_id();
-          enc = gpg_encrypt(text, keys, nkeys);
-        }
-        if (!enc && force) {
+            pgp_keys[pgp_nkeys++] = gpg_get_private_key_id();
+          pgp_force = force;
+        } else if (force) {
           if (encrypted)
             *encrypted = -1;
           goto xmpp_send_msg_return;
@@ -401,22 +590,18 @@ void xmpp_send_msg(const char *fjid, const char *text, int type,
 
   x = lm_message_new_with_sub_type(fjid, LM_MESSAGE_TYPE_MESSAGE, subtype);
   if (text) {
-    lm_message_node_add_child(x->node, "body",
-                              enc ? "This message is PGP-encrypted." : text);
+#ifdef HAVE_GPGME
+    if (pgp_nkeys)
+      lm_message_node_add_child(x->node, "body",
+                                "This message is PGP-encrypted.");
+    else
+#endif
+      lm_message_node_add_child(x->node, "body", text);
   }
 
   if (subject)
     lm_message_node_add_child(x->node, "subject", subject);
 
-  if (enc) {
-    LmMessageNode *y;
-    y = lm_message_node_add_child(x->node, "x", enc);
-    lm_message_node_set_attribute(y, "xmlns", NS_ENCRYPTED);
-    if (encrypted)
-      *encrypted = ENCRYPTED_PGP;
-    g_free(enc);
-  }
-
 #ifdef HAVE_LIBOTR
   // We probably don't want Carbons for encrypted messages, since the other
   // resources won't be able to decrypt them.
@@ -464,8 +649,41 @@ xmpp_send_msg_no_chatstates:
   if (mystatus != invisible)
 #endif
     update_last_use();
-  lm_connection_send(lconnection, x, NULL);
+
+  // Messages to a contact are sent in order, so if a PGP-encrypted
+  // message is still being processed, the next ones have to wait.
+  queue = g_strdup_printf("send:%s", barejid);
+#ifdef HAVE_GPGME
+  if (pgp_nkeys) {
+    pgp_send_msg(queue, x, fjid, barejid, text, plaintext, subject,
+                 pgp_keys, pgp_nkeys, pgp_force, encrypted, xep184);
+    // The message isn't sent if encryption is enforced and fails
+    if (encrypted && *encrypted == -1 && xep184) {
+      g_free(*xep184);
+      *xep184 = NULL;
+    }
+  } else
+#endif
+  if (job_queue_pending(queue) && encrypted && type != ROSTER_TYPE_ROOM) {
+    // Display the message when it is sent, after the pending ones
+    deferred_msg_t *dm = g_new0(deferred_msg_t, 1);
+    dm->msg = lm_message_ref(x);
+    dm->barejid = g_strdup(barejid);
+    dm->nick = g_strdup(muc_pm_nick(fjid, barejid));
+    dm->hmsg = msg_hook_text(subject, plaintext);
+    dm->encrypted = *encrypted;
+    if (xep184) {
+      dm->xep184 = *xep184;
+      *xep184 = NULL;
+    }
+    *encrypted = ENCRYPTED_PENDING;
+    job_submit(queue, NULL, xmpp_send_deferred_msg, dm);
+  } else if (job_queue_pending(queue))
+    job_submit(queue, NULL, xmpp_send_deferred, lm_message_ref(x));
+  else
+    lm_connection_send(lconnection, x, NULL);
   lm_message_unref(x);
+  g_free(queue);
 
 xmpp_send_msg_return:
 #ifdef HAVE_LIBOTR
@@ -630,49 +848,52 @@ static bool keys_mismatch(const char *key, const char *expectedkey)
 }
 #endif
 
-//  check_signature(barejid, resourcename, xmldata, text)
-// Verify the signature (in xmldata) of "text" for the contact
-// barejid/resourcename.
-// xmldata is the 'jabber:x:signed' stanza.
-// If the key id is found, the contact's PGP data are updated.
-static void check_signature(const char *barejid, const char *rname,
-                            LmMessageNode *node, const char *text)
-{
 #ifdef HAVE_GPGME
-  const char *p, *key;
+//  get_resource_pgpdata(barejid, resourcename)
+// Return the PGP data structure of the contact resource, or NULL.
+static struct pgp_data *get_resource_pgpdata(const char *barejid,
+                                             const char *rname)
+{
   GSList *sl_buddy;
-  struct pgp_data *res_pgpdata;
-  gpgme_sigsum_t sigsum;
 
-  // All parameters must be valid
-  if (!(node && barejid && rname && text))
-    return;
-
-  if (!gpg_enabled())
-    return;
-
-  // Get the resource PGP data structure
+  if (!(barejid && rname))
+    return NULL;
   sl_buddy = roster_find(barejid, jidsearch, ROSTER_TYPE_USER);
   if (!sl_buddy)
-    return;
-  res_pgpdata = buddy_resource_pgp(sl_buddy->data, rname);
-  if (!res_pgpdata)
-    return;
+    return NULL;
+  return buddy_resource_pgp(sl_buddy->data, rname);
+}
+
+//  get_signature(xmldata)
+// Return the signature from the 'jabber:x:signed' stanza, or NULL.
+static const char *get_signature(LmMessageNode *node)
+{
+  if (!node || !node->name || strcmp(node->name, "x")) // XXX: probably useless
+    return NULL; // We expect "<x xmlns='jabber:x:signed'>"
+  return lm_message_node_get_value(node);
+}
 
-  if (!node->name || strcmp(node->name, "x")) // XXX: probably useless
-    return; // We expect "<x xmlns='jabber:x:signed'>"
+//  signature_checked(barejid, resourcename, key, sigsum)
+// Update the contact's PGP data with the result of a signature
+// verification.  The resource can have disappeared in the meantime,
+// since the verification is done in a worker thread.
+static void signature_checked(const char *barejid, const char *rname,
+                              const char *key, gpgme_sigsum_t sigsum)
+{
+  struct pgp_data *res_pgpdata;
 
-  // Get signature
-  p = lm_message_node_get_value(node);
-  if (!p)
+  if (!key)
     return;
 
-  key = gpg_verify(p, text, &sigsum);
-  if (key) {
+  res_pgpdata = get_resource_pgpdata(barejid, rname);
+  if (!res_pgpdata)
+    return;
+
+  {
     const char *expectedkey;
     char *buf;
     g_free(res_pgpdata->sign_keyid);
-    res_pgpdata->sign_keyid = (char *)key;
+    res_pgpdata->sign_keyid = g_strdup(key);
     res_pgpdata->last_sigsum = sigsum;
     if (sigsum & GPGME_SIGSUM_RED) {
       buf = g_strdup_printf("Bad signature from <%s/%s>", barejid, rname);
@@ -690,6 +911,62 @@ static void check_signature(const char *barejid, const char *rname,
       g_free(buf);
     }
   }
+}
+
+typedef struct {
+  char *barejid;
+  char *rname;
+} sigcheck_t;
+
+static void check_signature_cb(const gpg_result_t *result, gpointer data)
+{
+  sigcheck_t *sc = data;
+
+  signature_checked(sc->barejid, sc->rname, result->keyid, result->sigsum);
+  g_free(sc->barejid);
+  g_free(sc->rname);
+  g_free(sc);
+}
+#endif
+
+//  check_signature(barejid, resourcename, xmldata, text)
+// Verify the signature (in xmldata) of "text" for the contact
+// barejid/resourcename.
+// xmldata is the 'jabber:x:signed' stanza.
+// The verification is done in a worker thread; if the key id is found,
+// the contact's PGP data are updated.  The presence signatures have their
+// own queue, so that a presence flood doesn't delay the contact's messages.
+static void check_signature(const char *barejid, const char *rname,
+                            LmMessageNode *node, const char *text)
+{
+#ifdef HAVE_GPGME
+  const char *p;
+  sigcheck_t *sc;
+  gchar *queue;
+
+  // All parameters must be valid
+  if (!(node && barejid && rname && text))
+    return;
+
+  if (!gpg_enabled())
+    return;
+
+  // Get the resource PGP data structure
+  if (!get_resource_pgpdata(barejid, rname))
+    return;
+
+  // Get signature
+  p = get_signature(node);
+  if (!p)
+    return;
+
+  sc = g_new(sigcheck_t, 1);
+  sc->barejid = g_strdup(barejid);
+  sc->rname = g_strdup(rname);
+  queue = g_strdup_printf("presence:%s", barejid);
+  gpg_job_submit(queue, GPG_JOB_VERIFY, text, p, NULL, 0,
+                 &check_signature_cb, sc);
+  g_free(queue);
 #endif
 }
 
@@ -856,11 +1133,13 @@ static void connection_close_cb(LmConnection *connection,
   if (bookmarks)
     lm_message_node_unref(bookmarks);
   bookmarks = NULL;
+  xmpp_reindex_storage_bookmarks();
   // Free roster
   roster_free();
   if (rosternotes)
     lm_message_node_unref(rosternotes);
   rosternotes = NULL;
+  xmpp_reindex_storage_rosternotes();
   // Reset carbons
   carbons_reset();
   // Update display
@@ -918,33 +1197,22 @@ static void handle_state_events(const char *bjid,
 #endif
 }
 
-static void gotmessage(LmMessageSubType type, const char *from,
-                       const char *body, const char *enc,
-                       const char *subject, time_t timestamp,
-                       LmMessageNode *node_signed, gboolean carbon)
+//  gotmessage_process(type, from, body, subject, timestamp,
+//                     decrypted_pgp, carbon)
+// Process an incoming message, once its PGP part has been handled.
+static void gotmessage_process(LmMessageSubType type, const char *from,
+                               const char *body, const char *subject,
+                               time_t timestamp, gboolean decrypted_pgp,
+                               gboolean carbon)
 {
   char *bjid;
   const char *rname;
-  char *decrypted_pgp = NULL;
   char *decrypted_otr = NULL;
   int otr_msg = 0, free_msg = 0;
 
   bjid = jidtodisp(from);
   rname = jid_get_resource_name(from);
 
-#ifdef HAVE_GPGME
-  if (gpg_enabled()) {
-    if (enc) {
-      decrypted_pgp = gpg_decrypt(enc);
-      if (decrypted_pgp)
-        body = decrypted_pgp;
-    }
-    // Check signature of the unencrypted/decrypted message
-    if (node_signed)
-      check_signature(bjid, rname, node_signed, body);
-  }
-#endif
-
   // Check for unexpected groupchat messages
   // If we receive a groupchat message from a room we're not a member of,
   // this is probably a server issue and the best we can do is to send
@@ -1059,11 +1327,322 @@ static void gotmessage(LmMessageSubType type, const char *from,
 gotmessage_return:
   // Clean up and exit
   g_free(bjid);
-  g_free(decrypted_pgp);
   if (free_msg)
     g_free(decrypted_otr);
 }
 
+// Incoming message waiting for the previous messages of the same
+// contact (or for its own decryption/verification).
+typedef struct {
+  LmMessageSubType type;
+  char     *from;
+  char     *body;
+  char     *subject;
+  time_t    timestamp;
+  gboolean  carbon;
+} pending_msg_t;
+
+static void pending_msg_free(pending_msg_t *pm)
+{
+  g_free(pm->from);
+  g_free(pm->body);
+  g_free(pm->subject);
+  g_free(pm);
+}
+
+static void gotmessage_deferred(gpointer data)
+{
+  pending_msg_t *pm = data;
+
+  gotmessage_process(pm->type, pm->from, pm->body, pm->subject,
+                     pm->timestamp, FALSE, pm->carbon);
+  pending_msg_free(pm);
+}
+
+#ifdef HAVE_GPGME
+static void gotmessage_pgp_cb(const gpg_result_t *result, gpointer data)
+{
+  pending_msg_t *pm = data;
+  char *bjid = jidtodisp(pm->from);
+
+  // Check signature of the unencrypted/decrypted message
+  signature_checked(bjid, jid_get_resource_name(pm->from),
+                    result->keyid, result->sigsum);
+  g_free(bjid);
+
+  gotmessage_process(pm->type, pm->from,
+                     result->output ? result->output : pm->body,
+                     pm->subject, pm->timestamp, result->output != NULL,
+                     pm->carbon);
+  pending_msg_free(pm);
+}
+#endif
+
+static void carbon_sent_deferred(gpointer data)
+{
+  pending_msg_t *pm = data;
+
+  if (pm->body && *pm->body)
+    hk_message_out(pm->from, NULL, pm->timestamp, pm->body, 0, TRUE, NULL);
+  pending_msg_free(pm);
+}
+
+#ifdef HAVE_GPGME
+static void carbon_sent_pgp_cb(const gpg_result_t *result, gpointer data)
+{
+  pending_msg_t *pm = data;
+  const char *body = pm->body;
+  guint encrypted = 0;
+
+  if (result->output) {
+    body = result->output;
+    encrypted = ENCRYPTED_PGP;
+  }
+  if (body && *body)
+    hk_message_out(pm->from, NULL, pm->timestamp, body, encrypted, TRUE, NULL);
+  pending_msg_free(pm);
+}
+#endif
+
+//  gotcarbon_sent(barejid, body, enc, timestamp)
+// Process a carbon copy of a message we have sent from another resource.
+// Like incoming messages, it is decrypted in a worker thread.
+static void gotcarbon_sent(const char *bjid, const char *body,
+                           const char *enc, time_t timestamp)
+{
+  gchar *queue;
+  pending_msg_t *pm;
+  gboolean pgp = FALSE;
+
+#ifdef HAVE_GPGME
+  pgp = (enc && gpg_enabled());
+#endif
+
+  queue = g_strdup_printf("recv:%s", bjid);
+  if (!pgp && !job_queue_pending(queue)) {
+    g_free(queue);
+    if (body && *body)
+      hk_message_out(bjid, NULL, timestamp, body, 0, TRUE, NULL);
+    return;
+  }
+
+  pm = g_new0(pending_msg_t, 1);
+  pm->from = g_strdup(bjid);
+  pm->body = g_strdup(body);
+  pm->timestamp = timestamp;
+
+#ifdef HAVE_GPGME
+  if (pgp)
+    gpg_job_submit(queue, GPG_JOB_DECRYPT, enc, NULL, NULL, 0,
+                   &carbon_sent_pgp_cb, pm);
+  else
+#endif
+    job_submit(queue, NULL, &carbon_sent_deferred, pm);
+  g_free(queue);
+}
+
+static void gotmessage(LmMessageSubType type, const char *from,
+                       const char *body, const char *enc,
+                       const char *subject, time_t timestamp,
+                       LmMessageNode *node_signed, gboolean carbon)
+{
+  char *bjid;
+  gchar *queue;
+  pending_msg_t *pm;
+  guint pgp_ops = 0;
+#ifdef HAVE_GPGME
+  const char *signature = NULL;
+
+  if (gpg_enabled()) {
+    const char *rname = jid_get_resource_name(from);
+
+    bjid = jidtodisp(from);
+    if (enc)
+      pgp_ops |= GPG_JOB_DECRYPT;
+    if (node_signed && get_resource_pgpdata(bjid, rname)) {
+      signature = get_signature(node_signed);
+      if (signature)
+        pgp_ops |= GPG_JOB_VERIFY;
+    }
+    g_free(bjid);
+  }
+#endif
+
+  // The PGP operations are done in a worker thread; the messages from
+  // a contact are processed in the order they were received.
+  bjid = jidtodisp(from);
+  queue = g_strdup_printf("recv:%s", bjid);
+  g_free(bjid);
+
+  if (!pgp_ops && !job_queue_pending(queue)) {
+    g_free(queue);
+    gotmessage_process(type, from, body, subject, timestamp, FALSE, carbon);
+    return;
+  }
+
+  pm = g_new0(pending_msg_t, 1);
+  pm->type = type;
+  pm->from = g_strdup(from);
+  pm->body = g_strdup(body);
+  pm->subject = g_strdup(subject);
+  pm->timestamp = timestamp;
+  pm->carbon = carbon;
+
+#ifdef HAVE_GPGME
+  if (pgp_ops)
+    gpg_job_submit(queue, pgp_ops, enc ? enc : body, signature, NULL, 0,
+                   &gotmessage_pgp_cb, pm);
+  else
+#endif
+    job_submit(queue, NULL, &gotmessage_deferred, pm);
+  g_free(queue);
+}
+
+
+// Message deduplication cache
+// The same message can be received several times (MUC history replayed
+// when we rejoin a room, carbons, server resends after a reconnection...).
+// We keep, for each conversation, the keys of the last messages received
+// so that such duplicates can be dropped before they are processed.
+#define MSG_DEDUP_DEFAULT_SIZE  64
+
+typedef struct {
+  GQueue     *order;    // Keys, oldest first
+  GHashTable *keys;     // Set of keys (owned by the queue)
+  guint       suppressed; // Number of duplicates dropped
+} msg_dedup_t;
+
+static GHashTable *msg_dedup_cache;
+static guint msg_dedup_suppressed;
+
+static void msg_dedup_free(gpointer data)
+{
+  msg_dedup_t *dd = data;
+  g_hash_table_destroy(dd->keys);
+  g_queue_free_full(dd->order, g_free);
+  g_free(dd);
+}
+
+//  msg_dedup_key(from, message_node, timestamp, body)
+// Compute the deduplication key of a message.  The XEP-0359 origin-id or
+// the stanza id are used when available, otherwise we fall back to the
+// (sender, timestamp) pair for delayed messages (history replay).  The body
+// is always part of the key so that clients reusing stanza ids don't get
+// their messages dropped.
+// Return NULL if the message cannot be identified (live message without
+// id): identical lines can legitimately be sent several times.
+// The caller should g_free the result after use.
+static gchar *msg_dedup_key(const char *from, LmMessageNode *message_node,
+                            time_t timestamp, const char *body)
+{
+  LmMessageNode *x;
+  const char *id = NULL;
+  gchar *key, *digest;
+
+  // There can be several XEP-0359 elements (e.g. a stanza-id added by
+  // the server or the room before the origin-id).
+  for (x = message_node->children; x && !id; x = x->next) {
+    if (!g_strcmp0(x->name, "origin-id") &&
+        !g_strcmp0(lm_message_node_get_attribute(x, "xmlns"), NS_SID))
+      id = lm_message_node_get_attribute(x, "id");
+  }
+  if (!id)
+    id = lm_message_node_get_attribute(message_node, "id");
+
+  if (id)
+    key = g_strdup_printf("%s\n%s\n%s", from, id, body);
+  else if (timestamp)
+    key = g_strdup_printf("%s\n@%ld\n%s", from, (long)timestamp, body);
+  else
+    return NULL;
+
+  digest = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+  g_free(key);
+  return digest;
+}
+
+//  msg_is_duplicate(bjid, from, message_node, timestamp, body)
+// Return TRUE if this message has already been received recently in the
+// bjid conversation.  If it hasn't, the message is remembered.
+static gboolean msg_is_duplicate(const char *bjid, const char *from,
+                                 LmMessageNode *message_node,
+                                 time_t timestamp, const char *body)
+{
+  msg_dedup_t *dd;
+  gchar *key, *cjid;
+  gint maxsize;
+
+  maxsize = settings_opt_get_int("message_dedup_size");
+  if (maxsize < 0)
+    return FALSE;
+  if (!maxsize)
+    maxsize = MSG_DEDUP_DEFAULT_SIZE;
+
+  key = msg_dedup_key(from, message_node, timestamp, body);
+  if (!key)
+    return FALSE;
+
+  if (!msg_dedup_cache)
+    msg_dedup_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, msg_dedup_free);
+
+  cjid = g_utf8_strdown(bjid, -1);
+  dd = g_hash_table_lookup(msg_dedup_cache, cjid);
+  if (!dd) {
+    dd = g_new0(msg_dedup_t, 1);
+    dd->order = g_queue_new();
+    dd->keys = g_hash_table_new(g_str_hash, g_str_equal);
+    g_hash_table_insert(msg_dedup_cache, cjid, dd);
+  } else {
+    g_free(cjid);
+  }
+
+  if (g_hash_table_lookup(dd->keys, key)) {
+    g_free(key);
+    dd->suppressed++;
+    msg_dedup_suppressed++;
+    scr_LogPrint(LPRINT_DEBUG, "Duplicate message from <%s> dropped "
+                 "(%u duplicates suppressed).", from, msg_dedup_suppressed);
+    return TRUE;
+  }
+
+  g_queue_push_tail(dd->order, key);
+  g_hash_table_insert(dd->keys, key, key);
+  // Evict the oldest keys
+  while (g_queue_get_length(dd->order) > (guint)maxsize) {
+    gchar *oldkey = g_queue_pop_head(dd->order);
+    g_hash_table_remove(dd->keys, oldkey);
+    g_free(oldkey);
+  }
+  return FALSE;
+}
+
+//  xmpp_msg_dedup_count(bjid)
+// Return the number of duplicate messages dropped in the bjid conversation,
+// or in all the conversations if bjid is NULL.
+guint xmpp_msg_dedup_count(const char *bjid)
+{
+  msg_dedup_t *dd;
+  gchar *cjid;
+
+  if (!bjid)
+    return msg_dedup_suppressed;
+  if (!msg_dedup_cache)
+    return 0;
+  cjid = g_utf8_strdown(bjid, -1);
+  dd = g_hash_table_lookup(msg_dedup_cache, cjid);
+  g_free(cjid);
+  return dd ? dd->suppressed : 0;
+}
+
+//  xmpp_msg_dedup_free()
+// Free the message deduplication cache.
+void xmpp_msg_dedup_free(void)
+{
+  if (msg_dedup_cache)
+    g_hash_table_destroy(msg_dedup_cache);
+  msg_dedup_cache = NULL;
+}
 
 static LmHandlerResult handle_messages(LmMessageHandler *handler,
                                        LmConnection *connection,
@@ -1164,40 +1743,19 @@ static LmHandlerResult handle_messages(LmMessageHandler *handler,
       scr_LogPrint(LPRINT_DEBUG, "Received incoming carbon from <%s>", from);
 
     } else if (!g_strcmp0(carbon_name, "sent")) {
-#ifdef HAVE_GPGME
-      char *decrypted_pgp = NULL;
-#endif
-      guint encrypted = 0;
-
       g_free(bjid);
       bjid = jidtodisp(to);
 
-#ifdef HAVE_GPGME
-      if (gpg_enabled()) {
-        if (enc) {
-          decrypted_pgp = gpg_decrypt(enc);
-          if (decrypted_pgp) {
-            body = decrypted_pgp;
-            encrypted = ENCRYPTED_PGP;
-          }
-        }
-        /*
-        // Check messsage signature
-        // This won't work here, since check_signature wasn't intended
-        // to be used to check our own messages.
-        if (ns_signed)
-          check_signature(ME, NULL, ns_signed, body);
-        */
-      }
-#endif
-
-      if (body && *body)
-        hk_message_out(bjid, NULL, timestamp, body, encrypted, TRUE, NULL);
+      /*
+      // Check messsage signature
+      // This won't work here, since check_signature wasn't intended
+      // to be used to check our own messages.
+      if (ns_signed)
+        check_signature(ME, NULL, ns_signed, body);
+      */
+      gotcarbon_sent(bjid, body, enc, timestamp);
 
       scr_LogPrint(LPRINT_DEBUG, "Received outgoing carbon for <%s>", to);
-#ifdef HAVE_GPGME
-      g_free(decrypted_pgp);
-#endif
       goto handle_messages_return;
     }
   } else { // Not a Carbon
@@ -1210,9 +1768,13 @@ static LmHandlerResult handle_messages(LmMessageHandler *handler,
   }
 
   // Only process messages that have a body or a subject
+  // Messages we have already received are dropped.
   if (body || subject) {
-    gotmessage(mstype, from, body, enc, subject, timestamp,
-               ns_signed, carbons);
+    if (!body || mstype == LM_MESSAGE_SUB_TYPE_ERROR ||
+        !msg_is_duplicate(bjid, from, message_node, timestamp,
+                          enc ? enc : body))
+      gotmessage(mstype, from, body, enc, subject, timestamp,
+                 ns_signed, carbons);
   }
 
   // Handle XEP 184
@@ -1244,12 +1806,12 @@ static LmHandlerResult handle_messages(LmMessageHandler *handler,
         scr_remove_receipt_flag(bjid, id);
 
 #ifdef MODULES_ENABLE
-        {
+        if (hk_has_handlers(HOOK_ID_MDR_RECEIVED)) {
           hk_arg_t args[] = {
             { "jid", from },
             { NULL, NULL },
           };
-          hk_run_handlers("hook-mdr-received", args);
+          hk_run_handlers_id(HOOK_ID_MDR_RECEIVED, args);
         }
 #endif
       }
@@ -1971,6 +2533,22 @@ void xmpp_disconnect(void)
   lconnection = NULL;
 }
 
+#ifdef HAVE_GPGME
+static void presence_sign_cb(const gpg_result_t *result, gpointer data)
+{
+  LmMessage *m = data;
+
+  if (result->output) {
+    LmMessageNode *y;
+    y = lm_message_node_add_child(m->node, "x", result->output);
+    lm_message_node_set_attribute(y, "xmlns", NS_SIGNED);
+  }
+  if (xmpp_is_online())
+    lm_connection_send(lconnection, m, NULL);
+  lm_message_unref(m);
+}
+#endif
+
 void xmpp_setstatus(enum imstatus st, const char *recipient, const char *msg,
                   int do_not_sign)
 {
@@ -2027,18 +2605,33 @@ void xmpp_setstatus(enum imstatus st, const char *recipient, const char *msg,
     xmpp_insert_entity_capabilities(m->node, st); // Entity Caps (XEP-0115)
 #ifdef HAVE_GPGME
     if (!do_not_sign && gpg_enabled()) {
-      char *signature;
-      signature = gpg_sign(s_msg ? s_msg : "");
-      if (signature) {
-        LmMessageNode *y;
-        y = lm_message_node_add_child(m->node, "x", signature);
-        lm_message_node_set_attribute(y, "xmlns", NS_SIGNED);
-        g_free(signature);
+      if (st != offline) {
+        // The presence is signed in a worker thread and sent afterwards
+        gpg_job_submit("presence", GPG_JOB_SIGN, s_msg ? s_msg : "", NULL,
+                       NULL, 0, &presence_sign_cb, lm_message_ref(m));
+        lm_message_unref(m);
+        m = NULL;
+      } else {
+        // We're probably disconnecting, we can't wait
+        char *signature;
+        signature = gpg_sign(s_msg ? s_msg : "");
+        if (signature) {
+          LmMessageNode *y;
+          y = lm_message_node_add_child(m->node, "x", signature);
+          lm_message_node_set_attribute(y, "xmlns", NS_SIGNED);
+          g_free(signature);
+        }
       }
     }
 #endif
-    lm_connection_send(lconnection, m, NULL);
-    lm_message_unref(m);
+    if (m) {
+      // Keep the presence packets in order, unless we're leaving
+      if (st != offline && job_queue_pending("presence"))
+        job_submit("presence", NULL, &xmpp_send_deferred, lm_message_ref(m));
+      else
+        lm_connection_send(lconnection, m, NULL);
+      lm_message_unref(m);
+    }
   }
 
   // If we didn't change our _global_ status, we are done
@@ -2122,25 +2715,108 @@ void send_storage(LmMessageNode *store)
 }
 
 
+// Bookmarks and roster notes indexes
+// These hash tables map case-folded bare JIDs to the matching nodes of the
+// bookmarks and rosternotes storage trees, so that per-room and per-contact
+// queries don't have to walk the storage.
+static GHashTable *bookmarks_index;
+static GHashTable *rosternotes_index;
+
+//  storage_index_add(index, node, tagname, replace)
+// Add node to the index if it is a "tagname" item with a jid attribute.
+// If replace is FALSE, an existing entry for the same jid is kept.
+static void storage_index_add(GHashTable *index, LmMessageNode *node,
+                              const char *tagname, gboolean replace)
+{
+  const char *fjid;
+  gchar *key;
+
+  if (!index || !node->name || strcmp(node->name, tagname))
+    return;
+  fjid = lm_message_node_get_attribute(node, "jid");
+  if (!fjid)
+    return;
+
+  key = g_utf8_strdown(fjid, -1);
+  if (!replace && g_hash_table_lookup(index, key)) {
+    g_free(key);
+    return;
+  }
+  g_hash_table_replace(index, key, node);
+}
+
+//  storage_index_build(index, store, tagname)
+// (Re)build the index of the "tagname" children of the store node.
+// If store is NULL, the index is emptied.
+static void storage_index_build(GHashTable **index, LmMessageNode *store,
+                                const char *tagname)
+{
+  LmMessageNode *x;
+
+  if (*index)
+    g_hash_table_remove_all(*index);
+  else
+    *index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  if (!store)
+    return;
+
+  for (x = store->children ; x; x = x->next)
+    storage_index_add(*index, x, tagname, FALSE);
+}
+
+static LmMessageNode *storage_index_lookup(GHashTable *index, const char *bjid)
+{
+  LmMessageNode *node;
+  gchar *key;
+
+  if (!index || !bjid)
+    return NULL;
+
+  key = g_utf8_strdown(bjid, -1);
+  node = g_hash_table_lookup(index, key);
+  g_free(key);
+  return node;
+}
+
+//  storage_index_remove(index, bjid)
+// Remove the bjid entry from the index.
+static void storage_index_remove(GHashTable *index, const char *bjid)
+{
+  gchar *key;
+
+  if (!index)
+    return;
+
+  key = g_utf8_strdown(bjid, -1);
+  g_hash_table_remove(index, key);
+  g_free(key);
+}
+
+//  xmpp_reindex_storage_bookmarks()
+// Build the bookmarks index.  Must be called when the bookmarks storage
+// node is replaced.
+void xmpp_reindex_storage_bookmarks(void)
+{
+  storage_index_build(&bookmarks_index, bookmarks, "conference");
+}
+
+//  xmpp_reindex_storage_rosternotes()
+// Build the roster notes index.  Must be called when the rosternotes
+// storage node is replaced.
+void xmpp_reindex_storage_rosternotes(void)
+{
+  storage_index_build(&rosternotes_index, rosternotes, "note");
+}
+
 //  xmpp_is_bookmarked(roomjid)
 // Return TRUE if there's a bookmark for the given jid.
 guint xmpp_is_bookmarked(const char *bjid)
 {
-  LmMessageNode *x;
-
   if (!bookmarks)
     return FALSE;
 
-  // Walk through the storage bookmark tags
-  for (x = bookmarks->children ; x; x = x->next) {
-    // If the node is a conference item, check the jid.
-    if (x->name && !strcmp(x->name, "conference")) {
-      const char *fjid = lm_message_node_get_attribute(x, "jid");
-      if (fjid && !strcasecmp(bjid, fjid))
-        return TRUE;
-    }
-  }
-  return FALSE;
+  return (storage_index_lookup(bookmarks_index, bjid) != NULL);
 }
 
 //  xmpp_get_bookmark_nick(roomjid)
@@ -2152,15 +2828,9 @@ const char *xmpp_get_bookmark_nick(const char *bjid)
   if (!bookmarks || !bjid)
     return NULL;
 
-  // Walk through the storage bookmark tags
-  for (x = bookmarks->children ; x; x = x->next) {
-    // If the node is a conference item, check the jid.
-    if (x->name && !strcmp(x->name, "conference")) {
-      const char *fjid = lm_message_node_get_attribute(x, "jid");
-      if (fjid && !strcasecmp(bjid, fjid))
-        return lm_message_node_get_child_value(x, "nick");
-    }
-  }
+  x = storage_index_lookup(bookmarks_index, bjid);
+  if (x)
+    return lm_message_node_get_child_value(x, "nick");
   return NULL;
 }
 
@@ -2173,39 +2843,27 @@ const char *xmpp_get_bookmark_password(const char *bjid)
   if (!bookmarks || !bjid)
     return NULL;
 
-  // Walk through the storage bookmark tags
-  for (x = bookmarks->children ; x; x = x->next) {
-    // If the node is a conference item, check the jid.
-    if (x->name && !strcmp(x->name, "conference")) {
-      const char *fjid = lm_message_node_get_attribute(x, "jid");
-      if (fjid && !strcasecmp(bjid, fjid))
-        return lm_message_node_get_child_value(x, "password");
-    }
-  }
+  x = storage_index_lookup(bookmarks_index, bjid);
+  if (x)
+    return lm_message_node_get_child_value(x, "password");
   return NULL;
 }
 
 int xmpp_get_bookmark_autojoin(const char *bjid)
 {
   LmMessageNode *x;
+  const char *autojoin;
 
   if (!bookmarks || !bjid)
     return 0;
 
-  // Walk through the storage bookmark tags
-  for (x = bookmarks->children ; x; x = x->next) {
-    // If the node is a conference item, check the jid.
-    if (x->name && !strcmp(x->name, "conference")) {
-      const char *fjid = lm_message_node_get_attribute(x, "jid");
-      if (fjid && !strcasecmp(bjid, fjid)) {
-        const char *autojoin;
-        autojoin = lm_message_node_get_attribute(x, "autojoin");
-        if (autojoin && (!strcmp(autojoin, "1") || !strcmp(autojoin, "true")))
-          return 1;
-        return 0;
-      }
-    }
-  }
+  x = storage_index_lookup(bookmarks_index, bjid);
+  if (!x)
+    return 0;
+
+  autojoin = lm_message_node_get_attribute(x, "autojoin");
+  if (autojoin && (!strcmp(autojoin, "1") || !strcmp(autojoin, "true")))
+    return 1;
   return 0;
 }
 
@@ -2280,7 +2938,7 @@ void xmpp_set_storage_bookmark(const char *roomid, const char *name,
       const char *fjid = lm_message_node_get_attribute(x, "jid");
       if (!fjid)
         continue;
-      if (!strcmp(fjid, roomid)) {
+      if (!strcasecmp(fjid, roomid)) {
         // We've found a bookmark for this room.  Let's hide it and we'll
         // create a new one.
         lm_message_node_hide(x);
@@ -2291,6 +2949,9 @@ void xmpp_set_storage_bookmark(const char *roomid, const char *name,
     }
   }
 
+  if (changed)
+    storage_index_remove(bookmarks_index, roomid);
+
   // Let's create a node/bookmark for this roomid, if the name is not NULL.
   if (name) {
     x = lm_message_node_add_child(bookmarks, "conference", NULL);
@@ -2313,6 +2974,7 @@ void xmpp_set_storage_bookmark(const char *roomid, const char *name,
       lm_message_node_add_child(x, "flag_joins", strflagjoins[fjoins]);
     if (group && *group)
       lm_message_node_add_child(x, "group", group);
+    storage_index_add(bookmarks_index, x, "conference", TRUE);
     changed = TRUE;
   }
 
@@ -2391,17 +3053,9 @@ struct annotation *xmpp_get_storage_rosternotes(const char *barejid, int silent)
     return NULL;
   }
 
-  // Walk through the storage rosternotes tags
-  for (x = rosternotes->children ; x; x = x->next) {
-    const char *fjid;
-    // We want a note item
-    if (!x->name || strcmp(x->name, "note"))
-      continue;
-    // Just in case, check the jid...
-    fjid = lm_message_node_get_attribute(x, "jid");
-    if (fjid && !strcmp(fjid, barejid)) // We've found a note for this contact.
-      return parse_storage_rosternote(x);
-  }
+  x = storage_index_lookup(rosternotes_index, barejid);
+  if (x) // We've found a note for this contact.
+    return parse_storage_rosternote(x);
   return NULL;  // No note found
 }
 
@@ -2431,7 +3085,7 @@ void xmpp_set_storage_rosternotes(const char *barejid, const char *note)
       const char *fjid = lm_message_node_get_attribute(x, "jid");
       if (!fjid)
         continue;
-      if (!strcmp(fjid, barejid)) {
+      if (!strcasecmp(fjid, barejid)) {
         // We've found a note for this jid.  Let's hide it and we'll
         // create a new one.
         cdate = lm_message_node_get_attribute(x, "cdate");
@@ -2442,6 +3096,9 @@ void xmpp_set_storage_rosternotes(const char *barejid, const char *note)
     }
   }
 
+  if (changed)
+    storage_index_remove(rosternotes_index, barejid);
+
   // Let's create a node for this jid, if the note is not NULL.
   if (note) {
     char mdate[20];
@@ -2456,6 +3113,7 @@ void xmpp_set_storage_rosternotes(const char *barejid, const char *note)
                                    "cdate", cdate,
                                    "mdate", mdate,
                                    NULL);
+    storage_index_add(rosternotes_index, x, "note", TRUE);
     changed = TRUE;
   }
 
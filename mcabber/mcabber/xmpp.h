@@ -51,6 +51,11 @@ void xmpp_addbuddy(const char *bjid, const char *name, const char *group);
 void xmpp_updatebuddy(const char *bjid, const char *name, const char *group);
 void xmpp_delbuddy(const char *bjid);
 
+// Set in *encrypted by xmpp_send_msg() when the message is encrypted in a
+// worker thread, or waits for such a message.  hk_message_out() is then
+// called when it is sent.
+#define ENCRYPTED_PENDING   3
+
 void xmpp_send_msg(const char *fjid, const char *text, int type,
                    const char *subject, gboolean otrinject, gint *encrypted,
                    LmMessageSubType type_overwrite, gpointer *xep184);
@@ -82,11 +87,16 @@ guint xmpp_is_bookmarked(const char *bjid);
 const char *xmpp_get_bookmark_nick(const char *bjid);
 const char *xmpp_get_bookmark_password(const char *bjid);
 int xmpp_get_bookmark_autojoin(const char *bjid);
+void xmpp_reindex_storage_bookmarks(void);
+void xmpp_reindex_storage_rosternotes(void);
 
 void xmpp_request(const char *fjid, enum iqreq_type reqtype);
 void request_vcard(const char *bjid);
 void xmpp_request_storage(const gchar *storage);
 
+guint xmpp_msg_dedup_count(const char *bjid);
+void  xmpp_msg_dedup_free(void);
+
 #endif /* __MCABBER_XMPP_H__ */
 
 /* vim: set et cindent cinoptions=>2\:2(0 ts=2 sw=2:  For Vim users... */
@@ -696,6 +696,7 @@ static LmHandlerResult cb_storage_bookmarks(LmMessageHandler *h,
       if (bookmarks)
         lm_message_node_unref(bookmarks);
       bookmarks = lm_message_node_new("storage", "storage:bookmarks");
+      xmpp_reindex_storage_bookmarks();
       // We return 0 so that the IQ error message be
       // not displayed, as it isn't a real error.
     } else
@@ -721,6 +722,7 @@ static LmHandlerResult cb_storage_bookmarks(LmMessageHandler *h,
     lm_message_node_unref(bookmarks);
   lm_message_node_deep_ref(ansqry);
   bookmarks = ansqry;
+  xmpp_reindex_storage_bookmarks();
   return 0;
 }
 
@@ -743,6 +745,7 @@ static LmHandlerResult cb_storage_rosternotes(LmMessageHandler *h,
       if (rosternotes)
         lm_message_node_unref(rosternotes);
       rosternotes = lm_message_node_new("storage", "storage:rosternotes");
+      xmpp_reindex_storage_rosternotes();
       // We return 0 so that the IQ error message be
       // not displayed, as it isn't a real error.
     } else
@@ -762,6 +765,7 @@ static LmHandlerResult cb_storage_rosternotes(LmMessageHandler *h,
     lm_message_node_unref(rosternotes);
   lm_message_node_deep_ref(ansqry);
   rosternotes = ansqry;
+  xmpp_reindex_storage_rosternotes();
   return 0;
 }
 
@@ -33,7 +33,8 @@ module_info_t info_fifo = {
   .init            = NULL,
   .uninit          = NULL,
   .description     = "Reads and executes command from FIFO pipe\n"
-          "Recognizes options fifo_name (required), fifo_hide_commands and fifo_ignore.",
+          "Recognizes options fifo_name, fifo_hide_commands and fifo_ignore,\n"
+          "and control_socket and control_socket_quiet for the control socket.",
   .next            = NULL,
 };
 
@@ -51,40 +51,71 @@ static guint urlregex_hid = 0;  /* Hook handler id */
 static GRegex *url_regex = NULL;
 #endif
 
-/* Helper function */
 #ifdef HAVE_GLIB_REGEX
-static inline void scr_log_urls(const gchar *string)
+/* URL extraction job */
+typedef struct {
+  gchar  *message;
+  GSList *urls;
+} urlregex_job_t;
+
+/* Run in a worker thread (GRegex can be shared between threads) */
+static void urlregex_job_run(gpointer data)
 {
+  urlregex_job_t *job = data;
   GMatchInfo *match_info;
 
-  g_regex_match_full(url_regex, string, -1, 0, 0, &match_info, NULL);
+  g_regex_match_full(url_regex, job->message, -1, 0, 0, &match_info, NULL);
   while (g_match_info_matches(match_info)) {
-    gchar *url = g_match_info_fetch(match_info, 0);
-    scr_print_logwindow(url);
-    g_free(url);
+    job->urls = g_slist_prepend(job->urls, g_match_info_fetch(match_info, 0));
     g_match_info_next(match_info, NULL);
   }
   g_match_info_free(match_info);
+  job->urls = g_slist_reverse(job->urls);
+}
+
+/* Run in the main loop */
+static void urlregex_job_done(gpointer data)
+{
+  urlregex_job_t *job = data;
+  GSList *el;
+
+  for (el = job->urls; el; el = el->next)
+    scr_print_logwindow(el->data);
+}
+
+static void urlregex_job_free(gpointer data)
+{
+  urlregex_job_t *job = data;
+
+  g_slist_free_full(job->urls, g_free);
+  g_free(job->message);
+  g_free(job);
+}
+
+/* Helper function */
+static inline void scr_log_urls(const gchar *string)
+{
+  urlregex_job_t *job = g_new0(urlregex_job_t, 1);
+
+  job->message = g_strdup(string);
+  if (module_job_submit("urlregex", urlregex_job_run, urlregex_job_done,
+                        job, urlregex_job_free))
+    return;
+
+  /* Too many pending jobs, do it now */
+  urlregex_job_run(job);
+  urlregex_job_done(job);
+  urlregex_job_free(job);
 }
 #endif
 
 /* Event handler */
-static guint urlregex_hh(const gchar *hookname, hk_arg_t *args, gpointer userdata)
+static guint urlregex_hh(const gchar *hookname, const hk_message_t *msg,
+                         gpointer userdata)
 {
 #ifdef HAVE_GLIB_REGEX
-  if (url_regex) {
-    int i;
-    const char *msg = NULL;
-
-    for (i = 0; args[i].name; i++) {
-      if (!strcmp(args[i].name, "message")) {
-        msg = args[i].value;
-        break;
-      }
-    }
-    if (msg)
-      scr_log_urls(msg);
-  }
+  if (url_regex && msg->message)
+    scr_log_urls(msg->message);
 #endif
 
   /* We're done, let the other handlers do their job! */
@@ -101,8 +132,8 @@ static void urlregex_init(void)
     /* Add handler
      * We are only interested in incoming message events
      */
-    urlregex_hid = hk_add_handler(urlregex_hh, HOOK_POST_MESSAGE_IN,
-                                  G_PRIORITY_DEFAULT_IDLE, NULL);
+    urlregex_hid = hk_add_message_handler(urlregex_hh, HOOK_POST_MESSAGE_IN,
+                                          G_PRIORITY_DEFAULT_IDLE, NULL);
 #else
     scr_log_print(LPRINT_LOGNORM, "ERROR: Your glib version is too old, "
                   "cannot use url_regex.");
@@ -113,7 +144,8 @@ static void urlregex_init(void)
 /* Uninitialization */
 static void urlregex_uninit(void)
 {
-  /* Unregister event handler */
+  /* Unregister event handler
+   * (the pending jobs have been cancelled by the module loader) */
   hk_del_handler(HOOK_POST_MESSAGE_IN, urlregex_hid);
 #ifdef HAVE_GLIB_REGEX
   if (url_regex) {